@@ -1,19 +1,28 @@
 #if !defined CUDA_SUPPORT_H
 #define CUDA_SUPPORT_H
 
+#include "Common/HostAllocator.h"
+
 #include <cudawrappers/cu.hpp>
 
 #include <boost/multi_array.hpp>
 
 
-template <typename T, std::size_t DIM> class MultiArrayHostBuffer : public cu::HostMemory, public boost::multi_array_ref<T, DIM>
+template <typename T, std::size_t DIM> class MultiArrayHostBuffer : public HostAllocation, public boost::multi_array_ref<T, DIM>
 {
   public:
     template <typename ExtentList>
     MultiArrayHostBuffer(const ExtentList &extents, int flags = 0)
     :
-      cu::HostMemory(boost::multi_array_ref<T, DIM>(0, extents).num_elements() * sizeof(T), flags),
-      boost::multi_array_ref<T, DIM>((T *) *this, extents)
+      MultiArrayHostBuffer(extents, HostAllocator(HostAllocator::Pinned, flags))
+    {
+    }
+
+    template <typename ExtentList>
+    MultiArrayHostBuffer(const ExtentList &extents, const HostAllocator &allocator)
+    :
+      HostAllocation(boost::multi_array_ref<T, DIM>(0, extents).num_elements() * sizeof(T), allocator),
+      boost::multi_array_ref<T, DIM>((T *) memory(), extents)
     {
     }
 
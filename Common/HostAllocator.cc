@@ -0,0 +1,44 @@
+#include "Common/Config.h"
+
+#include "Common/HostAllocator.h"
+
+#include <cudawrappers/cu.hpp>
+
+#include <stdexcept>
+
+
+HostAllocation::HostAllocation(size_t size, const HostAllocator &allocator)
+{
+  if (allocator.kind == HostAllocator::Pinned) {
+    hostMemory = std::make_shared<cu::HostMemory>(size, allocator.cuFlags);
+    ptr = *hostMemory;
+    return;
+  }
+
+  mappedMemory = std::make_shared<NUMAMemory>(size, allocator.kind == HostAllocator::HugePages2M ? 2 << 20 : allocator.kind == HostAllocator::HugePages1G ? 1 << 30 : 0);
+  ptr = *mappedMemory;
+
+  if (allocator.place)
+    allocator.place(*mappedMemory);
+  else if (allocator.node >= 0)
+    mappedMemory->bind(0, size, allocator.node);
+
+  if (allocator.prefault)
+    mappedMemory->populate();
+
+  // registering pins the pages anyway
+  if (allocator.prefault && !allocator.pin)
+    mappedMemory->lock();
+
+  if (allocator.pin)
+    hostMemory = std::make_shared<cu::HostMemory>(ptr, size);
+}
+
+
+const cu::HostMemory &HostAllocation::pinnedMemory() const
+{
+  if (hostMemory == nullptr)
+    throw std::runtime_error("host memory is not pinned");
+
+  return *hostMemory;
+}
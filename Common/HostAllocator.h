@@ -0,0 +1,72 @@
+#ifndef COMMON_HOST_ALLOCATOR_H
+#define COMMON_HOST_ALLOCATOR_H
+
+#include "Common/NUMAMemory.h"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+
+namespace cu {
+  class HostMemory;
+}
+
+
+// How a host buffer is allocated.  Pinned memory comes from the CUDA driver
+// and needs a current context.  The other kinds are mmap()ed, with system
+// pages or 2 MB or 1 GB huge pages, placed on NUMA nodes, optionally faulted
+// in up front, and then pinned (registered with CUDA) unless pin is false;
+// unpinned memory needs no GPU, but is copied to or from one synchronously.
+
+struct HostAllocator
+{
+  enum Kind { Pinned, Plain, HugePages2M, HugePages1G };
+
+  HostAllocator(Kind kind = Pinned, unsigned cuFlags = 0)
+  :
+    kind(kind),
+    cuFlags(cuFlags),
+    node(-1),
+    prefault(false),
+    pin(true)
+  {
+  }
+
+  Kind     kind;
+  unsigned cuFlags;  // of Pinned memory, e.g., CU_MEMHOSTALLOC_WRITECOMBINED
+  int      node;     // of mmap()ed memory; -1: where first touched
+  bool     prefault; // fault in all pages of mmap()ed memory, in parallel, and mlock() them
+  bool     pin;      // register mmap()ed memory with CUDA; needs a current context
+
+  std::function<void (NUMAMemory &)> place; // of mmap()ed memory, instead of node
+};
+
+
+// Host memory allocated by a HostAllocator; copies share the memory.
+
+class HostAllocation
+{
+  public:
+    HostAllocation(size_t size, const HostAllocator &);
+
+    void *memory() const
+    {
+      return ptr;
+    }
+
+    bool isPinned() const
+    {
+      return hostMemory != nullptr;
+    }
+
+    // for cu::DeviceMemory on devices with unified memory; throws if not pinned
+    const cu::HostMemory &pinnedMemory() const;
+
+  private:
+    std::shared_ptr<NUMAMemory>	    mappedMemory; // destroyed after hostMemory
+    std::shared_ptr<cu::HostMemory> hostMemory;
+    void			    *ptr;
+};
+
+#endif
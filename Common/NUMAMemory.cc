@@ -0,0 +1,138 @@
+#include "Common/Config.h"
+
+#if defined __linux__
+#include "Common/NUMAMemory.h"
+#include "Common/SystemCallException.h"
+
+#include <numa.h>
+#include <numaif.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <map>
+#include <thread>
+
+
+static void setPolicy(void *address, size_t size, int mode, const unsigned long *nodemask, unsigned long maxnode)
+{
+  // without NUMA support, all memory is on node 0 anyway
+  if (size > 0 && mbind(address, size, mode, nodemask, maxnode, 0) < 0 && errno != ENOSYS)
+    throw SystemCallException("mbind");
+}
+
+
+NUMAMemory::NUMAMemory(size_t size, size_t pageSize)
+:
+  _size(size),
+  pageSize(pageSize != 0 ? pageSize : sysconf(_SC_PAGESIZE)),
+  allocated((std::max(size, (size_t) 1) + this->pageSize - 1) / this->pageSize * this->pageSize)
+{
+  int flags = MAP_PRIVATE | MAP_ANON;
+
+  if (this->pageSize != (size_t) sysconf(_SC_PAGESIZE))
+    flags |= MAP_HUGETLB | __builtin_ctzll(this->pageSize) << MAP_HUGE_SHIFT;
+
+  if ((ptr = mmap(nullptr, allocated, PROT_READ | PROT_WRITE, flags, -1, 0)) == MAP_FAILED)
+    throw SystemCallException("mmap");
+}
+
+
+NUMAMemory::~NUMAMemory() noexcept(false)
+{
+  if (munmap(ptr, allocated) != 0 && !std::uncaught_exceptions())
+    throw SystemCallException("munmap");
+}
+
+
+void NUMAMemory::interleave()
+{
+  if (numa_available() >= 0)
+    setPolicy(ptr, allocated, MPOL_INTERLEAVE, numa_all_nodes_ptr->maskp, numa_all_nodes_ptr->size + 1);
+
+  parts.clear();
+  parts.push_back(Part { 0, allocated, -1 });
+}
+
+
+void NUMAMemory::bind(size_t offset, size_t size, unsigned node)
+{
+  // a page shared by two parts goes to the part that starts in it
+  size_t begin = offset / pageSize * pageSize;
+  size_t end   = offset + size >= _size ? allocated : (offset + size) / pageSize * pageSize;
+
+  if (begin < end) {
+    unsigned long nodemask = 1UL << node;
+    setPolicy((char *) ptr + begin, end - begin, MPOL_BIND, &nodemask, 8 * sizeof nodemask);
+    parts.push_back(Part { begin, end, (int) node });
+  }
+}
+
+
+void NUMAMemory::populate()
+{
+  // split the parts into pieces and hand them out to threads on their nodes;
+  // faulting in a 100 GB ring buffer from one thread takes minutes
+  const size_t pieceSize = std::max((size_t) 64 << 20, pageSize);
+
+  std::map<int, std::vector<Part>> pieces; // per node
+  size_t covered = 0;
+
+  std::sort(parts.begin(), parts.end(), [] (const Part &a, const Part &b) { return a.begin < b.begin; });
+
+  for (size_t part = 0; part <= parts.size(); part ++) {
+    Part next = part < parts.size() ? parts[part] : Part { allocated, allocated, -1 };
+
+    if (covered < next.begin) // not placed explicitly
+      for (size_t begin = covered; begin < next.begin; begin += pieceSize)
+	pieces[-1].push_back(Part { begin, std::min(begin + pieceSize, next.begin), -1 });
+
+    for (size_t begin = next.begin; begin < next.end; begin += pieceSize)
+      pieces[next.node].push_back(Part { begin, std::min(begin + pieceSize, next.end), next.node });
+
+    covered = std::max(covered, next.end);
+  }
+
+  std::vector<std::thread> threads;
+  std::map<int, std::atomic<size_t>> nextPiece;
+
+  for (const std::pair<const int, std::vector<Part>> &node : pieces) {
+    unsigned nrThreads = std::thread::hardware_concurrency();
+
+    if (node.first >= 0 && numa_available() >= 0) {
+      struct bitmask *cpus = numa_allocate_cpumask();
+
+      if (numa_node_to_cpus(node.first, cpus) == 0)
+	nrThreads = numa_bitmask_weight(cpus);
+
+      numa_free_cpumask(cpus);
+    }
+
+    std::atomic<size_t> &next = nextPiece[node.first];
+    next = 0;
+
+    for (unsigned thread = 0; thread < std::max(std::min((size_t) nrThreads, node.second.size()), (size_t) 1); thread ++)
+      threads.emplace_back([this, &node, &next] () {
+	if (node.first >= 0 && numa_available() >= 0)
+	  numa_run_on_node(node.first);
+
+	for (size_t piece; (piece = next ++) < node.second.size();)
+	  for (size_t offset = node.second[piece].begin; offset < node.second[piece].end; offset += pageSize)
+	    * (volatile char *) ((char *) ptr + offset) = 0;
+      });
+  }
+
+  for (std::thread &thread : threads)
+    thread.join();
+}
+
+
+void NUMAMemory::lock()
+{
+  if (mlock(ptr, allocated) < 0)
+    throw SystemCallException("mlock");
+}
+
+#endif
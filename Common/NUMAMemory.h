@@ -0,0 +1,52 @@
+#ifndef COMMON_NUMA_MEMORY_H
+#define COMMON_NUMA_MEMORY_H
+
+#if defined __linux__
+
+#include <cstddef>
+#include <vector>
+
+
+// Anonymous memory that is placed on NUMA nodes explicitly, rather than on
+// the node of whichever thread happens to touch it first.  Set the placement
+// of parts with interleave() and bind(), then populate() to fault in all
+// pages in parallel, each part by threads on the node that it is bound to,
+// before the memory is used or pinned.  A pageSize other than the system's
+// maps huge pages of that size (2 MB or 1 GB) from the reserved pool.
+
+class NUMAMemory
+{
+  public:
+    NUMAMemory(size_t size, size_t pageSize = 0);
+    ~NUMAMemory() noexcept(false);
+
+    operator void * () const
+    {
+      return ptr;
+    }
+
+    size_t size() const
+    {
+      return _size;
+    }
+
+    void interleave(); // over all nodes
+    void bind(size_t offset, size_t size, unsigned node); // rounded to pages
+    void populate();
+    void lock(); // keeps the pages resident
+
+  private:
+    struct Part
+    {
+      size_t begin, end;
+      int    node; // -1: any node
+    };
+
+    void   *ptr;
+    size_t _size, pageSize, allocated;
+    std::vector<Part> parts;
+};
+
+#endif
+
+#endif
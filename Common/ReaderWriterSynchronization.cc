@@ -34,6 +34,11 @@ SynchronizedReaderAndWriter::~SynchronizedReaderAndWriter()
 void SynchronizedReaderAndWriter::startRead(const TimeStamp &begin, const TimeStamp &end)
 {
   itsReadPointer.advanceTo(begin);
+
+  // before waiting, as the writer may wait for this
+  if (itsReaderAdvanced)
+    itsReaderAdvanced();
+
   itsWritePointer.waitFor(end);
 }
 
@@ -41,6 +46,9 @@ void SynchronizedReaderAndWriter::startRead(const TimeStamp &begin, const TimeSt
 void SynchronizedReaderAndWriter::finishedRead(const TimeStamp &advanceTo)
 {
   itsReadPointer.advanceTo(advanceTo);
+
+  if (itsReaderAdvanced)
+    itsReaderAdvanced();
 }
 
 
@@ -51,6 +59,19 @@ void SynchronizedReaderAndWriter::startWrite(const TimeStamp &begin, const TimeS
 }
 
 
+bool SynchronizedReaderAndWriter::tryStartWrite(const TimeStamp &begin, const TimeStamp &end)
+{
+  itsWritePointer.advanceTo(begin); // avoid deadlock if there is a gap in the written data
+  return itsReadPointer.hasReached(end - itsBufferSize);
+}
+
+
+void SynchronizedReaderAndWriter::setReaderAdvancedCallback(const std::function<void ()> &callback)
+{
+  itsReaderAdvanced = callback;
+}
+
+
 void SynchronizedReaderAndWriter::finishedWrite(const TimeStamp &advanceTo)
 {
   itsWritePointer.advanceTo(advanceTo);
@@ -61,6 +82,9 @@ void SynchronizedReaderAndWriter::noMoreReading()
 {
   // advance read pointer to infinity, to unblock thread that waits in startWrite
   itsReadPointer.advanceTo(TimeStamp(0x7FFFFFFFFFFFFFFFLL, 0)); // we only use this TimeStamp for comparison so clockSpeed does not matter
+
+  if (itsReaderAdvanced)
+    itsReaderAdvanced();
 }
 
 
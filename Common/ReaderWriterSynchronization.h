@@ -5,6 +5,8 @@
 #include "SlidingPointer.h"
 #include "WallClockTime.h"
 
+#include <functional>
+
 
 class ReaderAndWriterSynchronization
 {
@@ -34,12 +36,18 @@ class SynchronizedReaderAndWriter : public ReaderAndWriterSynchronization
     virtual void startWrite(const TimeStamp &begin, const TimeStamp &end);
     virtual void finishedWrite(const TimeStamp &advanceTo);
 
+    // like startWrite(), but returns false rather than waiting for readers;
+    // readerAdvanced is called whenever a reader frees space
+    bool	 tryStartWrite(const TimeStamp &begin, const TimeStamp &end);
+    void	 setReaderAdvancedCallback(const std::function<void ()> &);
+
     virtual void noMoreReading();
     virtual void noMoreWriting();
 
   private:
     SlidingPointer<TimeStamp> itsReadPointer, itsWritePointer;
     unsigned		      itsBufferSize;
+    std::function<void ()>    itsReaderAdvanced;
 };
 
 
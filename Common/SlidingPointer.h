@@ -14,6 +14,7 @@ template <typename T> class SlidingPointer
 
     void advanceTo(const T &);
     void waitFor(const T &);
+    bool hasReached(const T &);
 
   //private:
     T			    currentValue;
@@ -58,4 +59,10 @@ template <typename T> inline void SlidingPointer<T>::waitFor(const T &value)
   valueUpdated.wait(lock, [this, value] { return currentValue >= value; });
 }
 
+template <typename T> inline bool SlidingPointer<T>::hasReached(const T &value)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return currentValue >= value;
+}
+
 #endif
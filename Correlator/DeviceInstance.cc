@@ -241,9 +241,9 @@ void DeviceInstance::doSubband(const TimeStamp &time,
     std::cout << "DeviceInstance:doSubband\n";
     filter.launchAsync(executeStream,
 		         devCorrectedData,
-			 cu::DeviceMemory(hostInputBuffer));
+			 cu::DeviceMemory(hostInputBuffer.pinnedMemory()));
 
-    cu::DeviceMemory devVisibilities(hostVisibilities);
+    cu::DeviceMemory devVisibilities(hostVisibilities.pinnedMemory());
     cu::DeviceMemory devCorrectedDataChannel0skipped(static_cast<CUdeviceptr>(devCorrectedData) + ps.nrSamplesPerChannel() * ps.nrStations() * ps.nrPolarizations() * ps.nrBytesPerComplexSample());
     tcc.launchAsync(executeStream, devVisibilities, devCorrectedDataChannel0skipped, pipeline.correlateCounter);
   }
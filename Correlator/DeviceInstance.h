@@ -32,6 +32,9 @@ class DeviceInstance
 		   unsigned startIndex = 0
 		  );
 
+    // if so, doSubband() reads hostInputBuffer in place, without a copy
+    virtual bool hasUnifiedMemory() const { return true; }
+
     void doSubband(const TimeStamp &,
 		   unsigned subband,
 		   const MultiArrayHostBuffer<char, 4> &hostInputBuffer,
@@ -87,6 +90,8 @@ class DeviceInstanceWithoutUnifiedMemory : public DeviceInstance
 		   unsigned startIndex = 0
 		  );
 
+    virtual bool hasUnifiedMemory() const { return false; }
+
     cu::Stream			  hostToDeviceStream, deviceToHostStream;
     cu::DeviceMemory              devInputBuffer;
     cu::DeviceMemory              devFracDelays;
@@ -0,0 +1,278 @@
+#include "Common/Config.h"
+
+#include "ISBI/AsyncFileReader.h"
+#include "Common/SystemCallException.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace {
+  // the pread() threads of all AsyncFileReaders, created as needed
+  class PreadPool
+  {
+    public:
+      static PreadPool &instance()
+      {
+	static PreadPool pool;
+	return pool;
+      }
+
+      void submit(const std::function<void ()> &job)
+      {
+	{
+	  std::lock_guard<std::mutex> lock(mutex);
+	  jobs.push_back(job);
+
+	  if (threads.size() < AsyncFileReader::maxNrPreadThreads && nrIdleThreads < jobs.size())
+	    threads.emplace_back(&PreadPool::threadBody, this);
+	}
+
+	jobAdded.notify_one();
+      }
+
+    private:
+      PreadPool()
+      :
+	nrIdleThreads(0),
+	stop(false)
+      {
+      }
+
+      ~PreadPool()
+      {
+	{
+	  std::lock_guard<std::mutex> lock(mutex);
+	  stop = true;
+	}
+
+	jobAdded.notify_all();
+
+	for (std::thread &thread : threads)
+	  thread.join();
+      }
+
+      void threadBody()
+      {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	for (;;) {
+	  ++ nrIdleThreads;
+
+	  while (jobs.empty() && !stop)
+	    jobAdded.wait(lock);
+
+	  -- nrIdleThreads;
+
+	  if (jobs.empty())
+	    return;
+
+	  std::function<void ()> job = std::move(jobs.front());
+	  jobs.pop_front();
+
+	  lock.unlock();
+	  job();
+	  lock.lock();
+	}
+      }
+
+      std::mutex			 mutex;
+      std::condition_variable		 jobAdded;
+      std::deque<std::function<void ()>> jobs;
+      std::vector<std::thread>		 threads;
+      size_t				 nrIdleThreads;
+      bool				 stop;
+  };
+}
+
+
+AsyncFileReader::AsyncFileReader(const std::string &name, off_t offset, size_t blockSize, unsigned nrBlocksInFlight, bool directIO)
+:
+  file(name, O_RDONLY | (directIO ? O_DIRECT : 0), 0),
+  blockSize((blockSize + alignment - 1) / alignment * alignment),
+  nextOffset(offset / alignment * alignment),
+  currentEnd(nextOffset),
+  slots(std::max(nrBlocksInFlight, 2U)), // the previous block is only resubmitted after the next one arrived
+  currentSlot(-1),
+  endOfFile(false)
+{
+  for (Slot &slot : slots) {
+    slot.buffer.resize(maxCarrySize + this->blockSize);
+    slot.state = IDLE;
+  }
+
+#if defined USE_IO_URING
+  int retval;
+
+  if ((useRing = (retval = io_uring_queue_init(slots.size(), &ring, 0)) == 0)) {
+#pragma omp critical (clog)
+    std::clog << "reading " << name << " through io_uring" << std::endl;
+  } else {
+#pragma omp critical (clog)
+    std::clog << "io_uring_queue_init: " << strerror(-retval) << ", falling back to pread" << std::endl;
+  }
+
+#endif
+
+  for (unsigned slot = 0; slot < slots.size(); slot ++)
+    submit(slot);
+}
+
+
+AsyncFileReader::~AsyncFileReader()
+{
+  // the kernel or the pread() pool may still write into buffers of pending
+  // reads
+  for (unsigned slot = 0; slot < slots.size(); slot ++)
+    waitFor(slot);
+
+#if defined USE_IO_URING
+  if (useRing)
+    io_uring_queue_exit(&ring);
+#endif
+}
+
+
+#if defined USE_IO_URING
+void AsyncFileReader::submitRead(unsigned slot)
+{
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+
+  if (sqe == nullptr)
+    throw Exception("io_uring submission queue full");
+
+  io_uring_prep_read(sqe, file.fd, slots[slot].buffer.data() + maxCarrySize + slots[slot].nrBytesRead, blockSize - slots[slot].nrBytesRead, slots[slot].offset + slots[slot].nrBytesRead);
+  io_uring_sqe_set_data(sqe, reinterpret_cast<void *>(static_cast<uintptr_t>(slot)));
+  slots[slot].state = PENDING;
+
+  int retval;
+
+  if ((retval = io_uring_submit(&ring)) < 0)
+    throw SystemCallException("io_uring_submit", -retval);
+}
+#endif
+
+
+void AsyncFileReader::submit(unsigned slot)
+{
+  slots[slot].offset = nextOffset;
+  slots[slot].nrBytesRead = 0;
+  nextOffset += blockSize;
+
+#if defined USE_IO_URING
+  if (useRing) {
+    submitRead(slot);
+    return;
+  }
+#endif
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    slots[slot].state = PENDING;
+  }
+
+  PreadPool::instance().submit([this, slot] { readBlock(slot); });
+}
+
+
+void AsyncFileReader::waitFor(unsigned slot)
+{
+#if defined USE_IO_URING
+  if (useRing) {
+    while (slots[slot].state == PENDING) {
+      struct io_uring_cqe *cqe;
+      int retval;
+
+      if ((retval = io_uring_wait_cqe(&ring, &cqe)) < 0)
+	throw SystemCallException("io_uring_wait_cqe", -retval);
+
+      unsigned completedSlot = reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe));
+      Slot     &completed = slots[completedSlot];
+      int      res = cqe->res;
+
+      io_uring_cqe_seen(&ring, cqe);
+
+      // like pread(), a read may return fewer bytes than asked for before
+      // the end of the file; only a read that returns nothing ends it
+      if (res > 0)
+	completed.nrBytesRead += res;
+
+      if (res == -EINTR || res == -EAGAIN || (res > 0 && completed.nrBytesRead < blockSize)) {
+	submitRead(completedSlot);
+      } else {
+	completed.result = res < 0 ? res : completed.nrBytesRead;
+	completed.state = DONE;
+      }
+    }
+
+    return;
+  }
+#endif
+
+  std::unique_lock<std::mutex> lock(mutex);
+
+  while (slots[slot].state == PENDING)
+    stateChanged.wait(lock);
+}
+
+
+void AsyncFileReader::readBlock(unsigned slot)
+{
+  char    *buffer = slots[slot].buffer.data() + maxCarrySize;
+  ssize_t bytes = 0, retval = 0;
+
+  while (bytes < (ssize_t) blockSize && (retval = pread(file.fd, buffer + bytes, blockSize - bytes, slots[slot].offset + bytes)) > 0)
+    bytes += retval;
+
+  ssize_t result = retval < 0 ? -errno : bytes;
+
+  // notify under the lock: once the slot is DONE, the reader may be destroyed
+  std::lock_guard<std::mutex> lock(mutex);
+  slots[slot].result = result;
+  slots[slot].state = DONE;
+  stateChanged.notify_all();
+}
+
+
+AsyncFileReader::Block AsyncFileReader::next(const char *carry, size_t carrySize)
+{
+  if (carrySize > maxCarrySize)
+    throw Exception("AsyncFileReader::next: carry too large");
+
+  int	   previousSlot = currentSlot;
+  unsigned slot = currentSlot = (currentSlot + 1) % slots.size();
+  size_t   size = 0;
+
+  if (slots[slot].state != IDLE) {
+    waitFor(slot);
+
+    if (slots[slot].result < 0)
+      throw SystemCallException("read", -slots[slot].result);
+
+    size = slots[slot].result;
+    endOfFile |= size < blockSize; // only the last read of the file is short
+    slots[slot].state = IDLE;
+
+    if (size > 0)
+      currentEnd = slots[slot].offset + size;
+  }
+
+  char *data = slots[slot].buffer.data() + maxCarrySize - carrySize;
+
+  if (carrySize > 0)
+    memcpy(data, carry, carrySize);
+
+  // the caller is done with the previous block; reuse its buffer
+  if (previousSlot >= 0 && !endOfFile)
+    submit(previousSlot);
+
+  return Block { data, currentEnd - (off_t) (carrySize + size), carrySize + size };
+}
@@ -0,0 +1,77 @@
+#ifndef ISBI_ASYNC_FILE_READER_H
+#define ISBI_ASYNC_FILE_READER_H
+
+#include "Common/AlignedStdAllocator.h"
+#include "Common/Stream/FileStream.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined USE_IO_URING
+#include <liburing.h>
+#endif
+
+
+// Keeps nrBlocksInFlight large, aligned reads on a file in flight, and
+// returns the blocks in file order.  Uses io_uring if available, and
+// otherwise a pool of at most maxNrPreadThreads threads that do pread() for
+// all readers together.
+
+class AsyncFileReader
+{
+  public:
+    static const size_t	  alignment = 4096, maxCarrySize = 1 << 20;
+    static const unsigned maxNrPreadThreads = 16;
+
+    struct Block {
+      const char *data;
+      off_t	 offset; // file offset of data[0]
+      size_t	 size;
+    };
+
+    AsyncFileReader(const std::string &name, off_t offset, size_t blockSize, unsigned nrBlocksInFlight, bool directIO);
+    ~AsyncFileReader();
+
+    // Waits for the next block and prepends carrySize bytes from carry (e.g.,
+    // the unprocessed tail of the previous block) to it.  The block remains
+    // valid until the next call.  At the end of the file, only the carry is
+    // returned.
+    Block next(const char *carry = nullptr, size_t carrySize = 0);
+
+  private:
+    enum SlotState { IDLE, PENDING, DONE };
+
+    struct Slot {
+      std::vector<char, AlignedStdAllocator<char, alignment>> buffer; // maxCarrySize + blockSize bytes
+      off_t     offset;
+      size_t    nrBytesRead; // by earlier, short completions of the pending read
+      ssize_t   result;
+      SlotState state;
+    };
+
+    void submit(unsigned slot);
+    void readBlock(unsigned slot); // with pread()
+#if defined USE_IO_URING
+    void submitRead(unsigned slot); // of the rest of the block
+#endif
+    void waitFor(unsigned slot);
+
+    FileStream		     file;
+    const size_t	     blockSize;
+    off_t		     nextOffset, currentEnd;
+    std::vector<Slot>	     slots;
+    int			     currentSlot; // returned by the previous call to next()
+    bool		     endOfFile;
+
+#if defined USE_IO_URING
+    struct io_uring	     ring;
+    bool		     useRing;
+#endif
+
+    std::mutex		     mutex;
+    std::condition_variable  stateChanged;
+};
+
+#endif
@@ -3,7 +3,9 @@
 #include "Common/BandPass.h"
 #include "ISBI/CorrelatorWorkQueue.h"
 
+#include <algorithm>
 #include <iostream>
+#include <stdexcept>
 
 
 CorrelatorWorkQueue::CorrelatorWorkQueue(ISBI_CorrelatorPipeline &pipeline, DeviceInstance &deviceInstance)
@@ -14,7 +16,9 @@ CorrelatorWorkQueue::CorrelatorWorkQueue(ISBI_CorrelatorPipeline &pipeline, Devi
 
   hostDelays(boost::extents[ps.nrBeams()][ps.nrStations()][ps.nrPolarizations()]),
 
-  validData(ps.inputDescriptors().size()) // FIXME???
+  validity(ps.inputDescriptors().size()), // FIXME???
+
+  hostStagingBuffer(ps.packedRingBuffer() ? new MultiArrayHostBuffer<char, 3>(boost::extents[ps.nrStations()][ps.nrPolarizations()][(NR_TAPS - 1) * ps.nrChannelsPerSubbandBeforeFilter() + ps.nrSamplesPerSubbandBeforeFilter()], CU_MEMHOSTALLOC_WRITECOMBINED) : nullptr)
 
 #if defined USE_SEPARATE_THREAD
 , stop(false),
@@ -22,14 +26,16 @@ CorrelatorWorkQueue::CorrelatorWorkQueue(ISBI_CorrelatorPipeline &pipeline, Devi
   bufferFull(0)
 #endif
 {
-
+  // the GPU would filter the packed ring buffer in place, as 8-bit samples
+  if (ps.packedRingBuffer() && deviceInstance.hasUnifiedMemory())
+    throw std::runtime_error("nrRingBufferBitsPerSample must be 8 on a GPU with unified memory");
 }
 
 
-bool CorrelatorWorkQueue::hasValidData(std::vector<SparseSet<TimeStamp> > &validData)
+bool CorrelatorWorkQueue::hasValidData(const std::vector<ValidityBitmap> &validity)
 {
-  for (SparseSet<TimeStamp> &set : validData)
-    if (!set.empty())
+  for (const ValidityBitmap &bitmap : validity)
+    if (bitmap.count() > 0)
       return true;
 
   return false;
@@ -59,24 +65,28 @@ bool CorrelatorWorkQueue::inTime(const TimeStamp &time)
 }
 
 
-void CorrelatorWorkQueue::computeWeights(const std::vector<SparseSet<TimeStamp> > &validData, Visibilities *visibilities)
+void CorrelatorWorkQueue::computeWeights(const std::vector<ValidityBitmap> &validity, Visibilities *visibilities)
 {
-  for (unsigned stat2 = 0, pair = 0; stat2 < validData.size(); stat2 ++)
+  // the blocks are delay compensated, so the samples that both stations of
+  // a baseline have are exactly those valid in both bitmaps
+  for (unsigned stat2 = 0, pair = 0; stat2 < validity.size(); stat2 ++)
     for (unsigned stat1 = 0; stat1 <= stat2 && pair < sizeof(visibilities->header.weights) / sizeof(visibilities->header.weights[0]); stat1 ++, pair ++)
-      visibilities->header.weights[pair] = ((uint32_t) (int64_t) (validData[stat1] & validData[stat2]).count() / ps.nrChannelsPerSubbandBeforeFilter() - (NR_TAPS - 1)) * ps.channelIntegrationFactor();
+      visibilities->header.weights[pair] = std::max((int) (ValidityBitmap::countCommon(validity[stat1], validity[stat2]) / ps.nrChannelsPerSubbandBeforeFilter()) - (NR_TAPS - 1), 0) * ps.channelIntegrationFactor();
 }
 
 
 void CorrelatorWorkQueue::doSubband(const TimeStamp &time, unsigned subband)
 {
   pipeline.startReadTransaction(time);
-  pipeline.inputSection.fillInMissingSamples(time, subband, validData);
+  // a GPU with unified memory filters the ring buffer in place, so nothing
+  // masks the flagged samples after a copy
+  pipeline.inputSection.getValidity(time, subband, validity, deviceInstance.hasUnifiedMemory());
 
-  if (hasValidData(validData) && inTime(time)) {
+  if (hasValidData(validity) && inTime(time)) {
     std::unique_ptr<Visibilities> visibilities = pipeline.outputSection.getVisibilitiesBuffer(subband);
     std::function<void (cu::Stream &, cu::DeviceMemory &, PerformanceCounter &)> enqueueCopyInputBuffer = [=] (cu::Stream &stream, cu::DeviceMemory &devInputBuffer, PerformanceCounter &counter)
     {
-      pipeline.inputSection.enqueueHostToDeviceCopy(stream, devInputBuffer, counter, time, subband);
+      pipeline.inputSection.enqueueHostToDeviceCopy(stream, devInputBuffer, counter, time, subband, validity, hostStagingBuffer.get());
     };
 
     unsigned nrHistorySamples = (NR_TAPS - 1) * ps.nrChannelsPerSubbandBeforeFilter();
@@ -85,7 +95,7 @@ void CorrelatorWorkQueue::doSubband(const TimeStamp &time, unsigned subband)
 
     visibilities->startTime = time;
     visibilities->endTime = time + ps.nrSamplesPerSubbandBeforeFilter();
-    computeWeights(validData, visibilities.get());
+    computeWeights(validity, visibilities.get());
     pipeline.outputSection.putVisibilitiesBuffer(std::move(visibilities), time, subband);
   } else {
     if (subband == 0)
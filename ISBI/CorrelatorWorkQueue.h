@@ -3,12 +3,13 @@
 
 #include "ISBI/CorrelatorPipeline.h"
 #include "ISBI/Parset.h"
+#include "ISBI/ValidityBitmap.h"
 #include "ISBI/Visibilities.h"
 #include "Common/CUDA_Support.h"
-#include "Common/SparseSet.h"
 #include "Common/TimeStamp.h"
 #include "Correlator/DeviceInstance.h"
 
+#include <memory>
 #include <vector>
 
 
@@ -27,11 +28,15 @@ class CorrelatorWorkQueue
     MultiArrayHostBuffer<float, 3> hostDelays;
 
   private:
-    bool hasValidData(std::vector<SparseSet<TimeStamp>> &);
+    bool hasValidData(const std::vector<ValidityBitmap> &);
     bool inTime(const TimeStamp &);
-    void computeWeights(const std::vector<SparseSet<TimeStamp> > &validData, Visibilities *);
+    void computeWeights(const std::vector<ValidityBitmap> &validity, Visibilities *);
 
-    std::vector<SparseSet<TimeStamp>> validData;
+    std::vector<ValidityBitmap> validity; // per station, of the current block
+
+    // expanded input of a packed ring buffer; doSubband() waits for the
+    // transfer to complete, so one buffer per work queue suffices
+    std::unique_ptr<MultiArrayHostBuffer<char, 3>> hostStagingBuffer;
 };
 
 #endif
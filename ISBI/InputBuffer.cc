@@ -3,6 +3,12 @@
 #include "Common/Affinity.h"
 
 #include "ISBI/InputBuffer.h"
+#include "ISBI/Mark5BStream.h"
+#include "ISBI/PcapReader.h"
+#include "ISBI/VDIFDecoder.h"
+#include "ISBI/VDIFReceiver.h"
+#include "ISBI/VDIFReorderWindow.h"
+#include "ISBI/VDIFScanReader.h"
 #include "ISBI/VDIFStream.h"
 
 #include <byteswap.h>
@@ -16,49 +22,18 @@
 #include <cassert>
 #include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
 #include <vector>
 
 #undef FAKE_TIMES
-#undef USE_RECVMMSG
 
 #define ISBI_DELAYS
 
 volatile std::sig_atomic_t InputBuffer::signalCaught = false;
 
-namespace {
-  const std::array<int8_t, 256 * 4> decodeLUT = [] {
-    std::array<int8_t, 256 * 4> lut{};
-    for (unsigned byte = 0; byte < 256; ++byte) {
-      lut[4 * byte + 0] = DECODER_LEVEL_2BIT[(byte >> 0) & 0x3];
-      lut[4 * byte + 1] = DECODER_LEVEL_2BIT[(byte >> 2) & 0x3];
-      lut[4 * byte + 2] = DECODER_LEVEL_2BIT[(byte >> 4) & 0x3];
-      lut[4 * byte + 3] = DECODER_LEVEL_2BIT[(byte >> 6) & 0x3];
-    }
-    return lut;
-  } ();
-
-  inline void decodeMappedChannelSamples(
-      int8_t *__restrict dst,
-      unsigned nrSamples,
-      const uint8_t *__restrict payload,
-      size_t payloadBytes,
-      unsigned nchan,
-      size_t dataIndex)
-  {
-    for (unsigned sample = 0; sample < nrSamples; ++sample, dataIndex += nchan) {
-      const size_t byteIndex = dataIndex >> 2;
-
-      if (byteIndex >= payloadBytes) {
-        dst[sample] = 0;
-        continue;
-      }
-
-      const size_t lutIndex = (static_cast<size_t>(payload[byteIndex]) << 2) + (dataIndex & 0x3);
-      dst[sample] = decodeLUT[lutIndex];
-    }
-  }
-}
-
 void uncached_memcpy(void *__restrict dst, const void *__restrict src, size_t size)
 {
 #if defined __AVX__
@@ -93,28 +68,24 @@ void uncached_memcpy(void *__restrict dst, const void *__restrict src, size_t si
 void uncached_memclear(void *dst, size_t size)
 {
 #if defined __AVX__
-  size_t done = 0;
-
-#if 0
-  // size should be multiple of sizeof(int)
-
-  while (done < size && ((ptrdiff_t) ((char *) dst + done) & 0x1F) != 0) {
-    * (int *) ((char *) dst + done) = 0;
-    done += sizeof(int);
+  // plain stores up to a 32-byte boundary and after the last one, streaming
+  // stores in between
+  char	 *begin = static_cast<char *>(dst), *end = begin + size;
+  char	 *alignedBegin = reinterpret_cast<char *>(((uintptr_t) begin + 31) & ~(uintptr_t) 31);
+  char	 *alignedEnd   = reinterpret_cast<char *>((uintptr_t) end & ~(uintptr_t) 31);
+
+  if (alignedBegin >= alignedEnd) {
+    memset(dst, 0, size);
+    return;
   }
-#endif
 
-  while (done + sizeof(__m256i) <= size) {
-    _mm256_stream_si256((__m256i *) ((char *) dst + done), _mm256_setzero_si256());
-    done += sizeof(__m256i);
-  }
+  memset(begin, 0, alignedBegin - begin);
 
-#if 0
-  while (done < size) {
-    * (int *) ((char *) dst + done) = 0;
-    done += sizeof(int);
-  }
-#endif
+  for (char *ptr = alignedBegin; ptr < alignedEnd; ptr += sizeof(__m256i))
+    _mm256_stream_si256((__m256i *) ptr, _mm256_setzero_si256());
+
+  memset(alignedEnd, 0, end - alignedEnd);
+  _mm_sfence(); // before the GPU reads the block
 #else
   memset(dst, 0, size);
 #endif
@@ -141,42 +112,41 @@ InputBuffer::InputBuffer(const ISBI_Parset &ps, MultiArrayHostBuffer<char, 4> ho
   myFirstStation(myFirstStation),
   myNrStations(myNrStations),
   nrRingBufferSamplesPerSubband(ps.nrRingBufferSamplesPerSubband()),
-  mappedChannels([&] {
-    std::vector<uint32_t> channels(myNrSubbands * ps.nrPolarizations());
-
-    for (unsigned subband = 0; subband < myNrSubbands; ++subband) {
-      const unsigned subbandOffset = (myFirstSubband + subband) * ps.nrPolarizations();
-
-      for (unsigned pol = 0; pol < ps.nrPolarizations(); ++pol) {
-        channels[subband * ps.nrPolarizations() + pol] = ps.channelMapping()[subbandOffset + pol];
-      }
-    }
-
-    return channels;
-  }()),
-  ringBufferBases([&] {
-    std::vector<int8_t *> bases(myNrSubbands * ps.nrPolarizations());
-
-    for (unsigned subband = 0; subband < myNrSubbands; ++subband) {
-      for (unsigned pol = 0; pol < ps.nrPolarizations(); ++pol) {
-        bases[subband * ps.nrPolarizations() + pol] =
-            reinterpret_cast<int8_t *>(
-                hostRingBuffer[myFirstSubband + subband][myFirstStation][pol][0].origin());
-      }
-    }
-
-    return bases;
-  }()),
+  nrRingBufferBitsPerSample(ps.nrRingBufferBitsPerSample()),
+  threads(std::max<size_t>(ps.vdifThreadIds().size(), 1)),
+  threadIndices(1024, ps.vdifThreadIds().size() > 0 ? -1 : 0), // without a list, all frames belong to one thread
+  nrChannelsPerThread(0),
+  nrDecodeThreads(ps.nrDecodeThreads()),
   hostRingBuffer(hostRingBuffer),
   nrTimesPerPacket(nrTimesPerPacket),
   nrHistorySamples((NR_TAPS - 1) * ps.nrChannelsPerSubbandBeforeFilter()),
   latestWriteTime(0, ps.clockSpeed()),
   stop(false),
+  dataQualitySnapshot(myNrSubbands * ps.nrPolarizations(), SampleStatistics()),
+  clearedData(myNrSubbands),
   readerAndWriterSynchronization(nrRingBufferSamplesPerSubband, ps.startTime() - nrHistorySamples - ps.maxDelay()),
-  inputThread(&InputBuffer::inputThreadBody, this),
-  logThread(&InputBuffer::logThreadBody, this),
-  noInputThreadPtr(ps.realTime() ? new std::thread(&InputBuffer::noInputThreadBody, this) : 0)
+  inputStarted(false),
+  runsPending(false),
+  nrBitsPerSample(0),
+  timeStamp(0, ps.clockSpeed()),
+  stopTime(ps.stopTime() + ps.nrSamplesPerSubbandBeforeFilter()),
+  printedImpossibleTimeStampWarning(false),
+  forcedLastTime(false),
+  nrUnknownThreadPackets(0)
 {
+  for (unsigned thread = 0; thread < ps.vdifThreadIds().size(); thread ++)
+    threadIndices[ps.vdifThreadIds()[thread]] = thread;
+
+  for (VDIFThread &thread : threads) {
+    thread.packets.reserve(maxNrPacketsInBuffer);
+    thread.timestamps.reserve(maxNrPacketsInBuffer);
+    thread.reorderWindow.reset(new VDIFReorderWindow(ps.reorderWindowSize(), maxNrPacketsInBuffer, maxPacketSize));
+    thread.decodeStates.resize(nrDecodeThreads);
+    thread.expectedTimeStamp = thread.latestWriteTime = TimeStamp(0, ps.clockSpeed());
+  }
+
+  assignChannels(0);
+
 #if defined __AVX__
   // check alignment for _mm256_stream_si256
   assert((ptrdiff_t) hostRingBuffer[0].origin() % 32 == 0);
@@ -185,294 +155,643 @@ InputBuffer::InputBuffer(const ISBI_Parset &ps, MultiArrayHostBuffer<char, 4> ho
 #endif
 
 #pragma omp critical (clog)
-  std::clog << logMessage() << " created by CPU " << currentCPU() << " on node " << currentNode() << ", memory at node " << node(hostRingBuffer) << std::endl;
+  std::clog << logMessage() << " created by CPU " << currentCPU() << " on node " << currentNode() << ", memory at node " << node(hostRingBuffer[myFirstSubband][myFirstStation].origin()) << std::endl;
 }
 
 InputBuffer::~InputBuffer()
+{
+}
+
+
+void InputBuffer::stopInput()
 {
   readerAndWriterSynchronization.noMoreReading(); // FIXME: not here
   stop = true;
+}
+
+
+void InputBuffer::noMoreWriting()
+{
+  readerAndWriterSynchronization.noMoreWriting();
+}
+
+
+void InputBuffer::assignChannels(unsigned nrChannelsPerThread)
+{
+  // channel numbers in the channel mapping count through the channels of
+  // all threads, in the order of vdifThreadIds; channels beyond those are
+  // left to the first thread, whose decoder writes zeros for them
+  std::vector<std::vector<uint32_t>> mappedChannels(threads.size());
+  std::vector<std::vector<unsigned>> channelIndices(threads.size());
+  std::vector<std::vector<int8_t *>> ringBufferBases(threads.size());
+  std::vector<std::vector<bool>>     feedsSubband(threads.size(), std::vector<bool>(myNrSubbands, false));
+
+  for (unsigned subband = 0; subband < myNrSubbands; ++subband) {
+    for (unsigned pol = 0; pol < ps.nrPolarizations(); ++pol) {
+      uint32_t channel = ps.channelMapping()[(myFirstSubband + subband) * ps.nrPolarizations() + pol];
+      unsigned thread  = nrChannelsPerThread > 0 && channel / nrChannelsPerThread < threads.size() ? channel / nrChannelsPerThread : 0;
+
+      mappedChannels[thread].push_back(nrChannelsPerThread > 0 && channel / nrChannelsPerThread < threads.size() ? channel % nrChannelsPerThread : channel);
+      channelIndices[thread].push_back(subband * ps.nrPolarizations() + pol);
+      ringBufferBases[thread].push_back(reinterpret_cast<int8_t *>(hostRingBuffer[myFirstSubband + subband][myFirstStation][pol][0].origin()));
+      feedsSubband[thread][subband] = true;
+    }
+  }
 
-  if (noInputThreadPtr.get() != nullptr)
-    noInputThreadPtr->join();
+  {
+    // getCurrentValidData() reads the assignment from the correlator threads
+    std::lock_guard<std::mutex> lock(validDataMutex);
+
+    for (unsigned thread = 0; thread < threads.size(); ++thread) {
+      threads[thread].mappedChannels.swap(mappedChannels[thread]);
+      threads[thread].channelIndices.swap(channelIndices[thread]);
+      threads[thread].ringBufferBases.swap(ringBufferBases[thread]);
+      threads[thread].feedsSubband.swap(feedsSubband[thread]);
+    }
+  }
 
-  logThread.join();
-  inputThread.join();
+  for (VDIFThread &thread : threads)
+    for (DecodeState &state : thread.decodeStates) {
+      state.chunkOutputs.resize(thread.mappedChannels.size());
+      state.packedChunk.resize(ps.packedRingBuffer() ? thread.mappedChannels.size() * ringBufferChunkSize : 0);
+      state.sampleStatistics.assign(thread.mappedChannels.size(), SampleStatistics());
+    }
+
+  this->nrChannelsPerThread = nrChannelsPerThread;
 }
 
 
-void InputBuffer::handleConsecutivePackets(std::array<std::array<char, maxPacketSize>, maxNrPacketsInBuffer>& packetBuffer, unsigned firstPacket, unsigned lastPacket) {
-  const VDIFHeader* header = reinterpret_cast<const VDIFHeader*>(packetBuffer[firstPacket].data());
-  TimeStamp beginTime(header->timestamp(ps.sampleRate()), ps.clockSpeed());
+void InputBuffer::deinterleavePacket(VDIFThread &thread, DecodeState &state, const VDIFHeader *header, unsigned timeIndex)
+{
+  // The payload is decoded in chunks that end on a cache-line boundary in
+  // the ring buffer (or at its end), so that each payload byte is read once,
+  // the decoded chunk stays in L1, and every mapped channel is written a
+  // full cache line at a time.
+
+  const uint8_t *payload = reinterpret_cast<const uint8_t*>(header) + header->headerSize();
+  const size_t payloadBytes = header->dataSize();
+  std::unique_ptr<VDIFDecoder> &decoder = state.decoder;
+
+  if (decoder == nullptr || decoder->nrBitsPerSample() != header->bits_per_sample + 1U || decoder->nrChannels() != header->numberOfChannels()) {
+    decoder.reset(new VDIFDecoder(header->bits_per_sample + 1, header->numberOfChannels(), ringBufferChunkSize));
+
+    if (&state == &thread.decodeStates[0])
+#pragma omp critical (clog)
+      std::clog << logMessage() << ": decoding " << decoder->name() << " for thread " << header->thread_id << std::endl;
+  }
+
+  for (unsigned time = 0; time < nrTimesPerPacket;) {
+    const unsigned nrTimes = std::min({ ringBufferChunkSize - timeIndex % ringBufferChunkSize, nrTimesPerPacket - time, nrRingBufferSamplesPerSubband - timeIndex });
+
+    for (unsigned mapping = 0; mapping < thread.mappedChannels.size(); ++mapping)
+      state.chunkOutputs[mapping] = nrRingBufferBitsPerSample < 8 ? &state.packedChunk[mapping * ringBufferChunkSize] : thread.ringBufferBases[mapping] + timeIndex;
+
+    decoder->decode(payload, payloadBytes, time, nrTimes, thread.mappedChannels.data(), state.chunkOutputs.data(), thread.mappedChannels.size());
+
+    for (unsigned mapping = 0; mapping < thread.mappedChannels.size(); ++mapping)
+      state.sampleStatistics[mapping].add(state.chunkOutputs[mapping], nrTimes);
+
+    if (nrRingBufferBitsPerSample < 8)
+      for (unsigned mapping = 0; mapping < thread.mappedChannels.size(); ++mapping)
+        packSamples(reinterpret_cast<uint8_t *>(thread.ringBufferBases[mapping]), timeIndex, state.chunkOutputs[mapping], nrTimes, nrRingBufferBitsPerSample);
+
+    time += nrTimes;
+
+    if ((timeIndex += nrTimes) == nrRingBufferSamplesPerSubband)
+      timeIndex = 0;
+  }
+}
+
+
+void InputBuffer::writePackets(VDIFThread &thread, DecodeState &state, const char *const packets[], const int64_t timestamps[], unsigned firstPacket, unsigned lastPacket)
+{
+  unsigned timeIndex = TimeStamp(timestamps[firstPacket], ps.clockSpeed()) % nrRingBufferSamplesPerSubband;
+
+  for (unsigned packet = firstPacket; packet < lastPacket; ++packet) {
+    deinterleavePacket(thread, state, reinterpret_cast<const VDIFHeader*>(packets[packet]), timeIndex);
+
+    timeIndex += nrTimesPerPacket;
+    if (timeIndex >= nrRingBufferSamplesPerSubband)
+      timeIndex -= nrRingBufferSamplesPerSubband;
+  }
+}
+
+
+void InputBuffer::addValidData(VDIFThread &thread, const TimeStamp &beginTime, const TimeStamp &endTime)
+{
+  thread.latestWriteTime = endTime;
+
+  std::lock_guard<std::mutex> lock(validDataMutex);
+  thread.validData.exclude(TimeStamp(0, 1), endTime - nrRingBufferSamplesPerSubband);
+  const SparseSet<TimeStamp>::Ranges &ranges = thread.validData.getRanges();
+
+  if (ranges.size() < 16 || ranges.back().end == beginTime) {
+    thread.validData.include(beginTime, endTime);
+  }
+}
+
+
+TimeStamp InputBuffer::writtenUntil()
+{
+  // the time up to which all threads have written; a thread that lags more
+  // than half the ring buffer is assumed to be gone, and must not stall the
+  // others (its data is flagged anyway)
+  TimeStamp latest = latestWriteTime, until(0x7FFFFFFFFFFFFFFFLL, ps.clockSpeed());
+
+  for (const VDIFThread &thread : threads)
+    if (!thread.mappedChannels.empty() && thread.latestWriteTime > latest)
+      latest = thread.latestWriteTime;
+
+  for (const VDIFThread &thread : threads)
+    if (!thread.mappedChannels.empty() && thread.latestWriteTime + nrRingBufferSamplesPerSubband / 2 >= latest && thread.latestWriteTime < until)
+      until = thread.latestWriteTime;
+
+  if (until == TimeStamp(0x7FFFFFFFFFFFFFFFLL, ps.clockSpeed()))
+    until = latest;
+
+  // like forceProgress(), make what a left-out thread still has for earlier
+  // times too late, so that it never writes where the readers may be
+  for (VDIFThread &thread : threads)
+    thread.latestWriteTime = std::max(thread.latestWriteTime, until);
+
+  return until;
+}
+
+
+bool InputBuffer::handleRuns()
+{
+  TimeStamp beginTime(0x7FFFFFFFFFFFFFFFLL, ps.clockSpeed()), endTime(0, ps.clockSpeed());
+
+  for (const VDIFThread &thread : threads)
+    for (const std::pair<unsigned, unsigned> &run : thread.runs) {
+      beginTime = std::min(beginTime, TimeStamp(thread.reorderWindow->timestamps()[run.first], ps.clockSpeed()));
+      endTime = std::max(endTime, TimeStamp(thread.reorderWindow->timestamps()[run.second - 1] + nrTimesPerPacket, ps.clockSpeed()));
+    }
+
+  if (endTime == TimeStamp(0, ps.clockSpeed()))
+    return true;
 
   std::lock_guard<std::mutex> latestWriteTimeLock(latestWriteTimeMutex);
 
-  if (beginTime >= latestWriteTime) {
-    unsigned timeIndex = beginTime % nrRingBufferSamplesPerSubband;
-    unsigned myNrTimes = (lastPacket - firstPacket) * nrTimesPerPacket;
+  // rather than occupying a worker while the correlator catches up, keep
+  // the runs (the reorder windows hold their frames until the next read)
+  runsPending = !readerAndWriterSynchronization.tryStartWrite(beginTime, endTime);
 
-    TimeStamp endTime(beginTime + myNrTimes);
+  if (runsPending)
+    return false;
 
-    latestWriteTime = endTime;
+  // Slice the runs into at most about nrDecodeThreads tasks.  The threads
+  // write disjoint ring-buffer rows, and the slices of a run disjoint times,
+  // except that packed samples of adjacent slices could share a byte.
+  unsigned nrPackets = 0;
 
-    readerAndWriterSynchronization.startWrite(beginTime, endTime);
-    const unsigned nrPolarizations = ps.nrPolarizations();
+  for (const VDIFThread &thread : threads)
+    for (const std::pair<unsigned, unsigned> &run : thread.runs)
+      nrPackets += run.second - run.first;
 
-    for (unsigned packet = firstPacket; packet < lastPacket; ++packet) {
-      const VDIFHeader* packetHeader = reinterpret_cast<const VDIFHeader*>(packetBuffer[packet].data());
-      const uint8_t *payload = reinterpret_cast<const uint8_t*>(packetBuffer[packet].data() + packetHeader->headerSize());
-      const size_t payloadBytes = packetHeader->dataSize();
-      const unsigned nchan = packetHeader->numberOfChannels();
-      const unsigned firstSpan = std::min(nrTimesPerPacket, nrRingBufferSamplesPerSubband - timeIndex);
-      const unsigned secondSpan = nrTimesPerPacket - firstSpan;
+  unsigned nrPacketsPerTask = nrTimesPerPacket * nrRingBufferBitsPerSample % 8 == 0 ? std::max((nrPackets + nrDecodeThreads - 1) / nrDecodeThreads, 1U) : nrPackets;
 
-      for (unsigned subband = 0; subband < myNrSubbands; ++subband) {
-        const unsigned mappingBase = subband * nrPolarizations;
+  decodeTasks.clear();
 
-        for (unsigned pol = 0; pol < nrPolarizations; ++pol) {
-          const size_t mappedIndex = mappedChannels[mappingBase + pol];
-          int8_t *ringBuffer = ringBufferBases[mappingBase + pol];
+  for (unsigned t = 0; t < threads.size(); ++t) {
+    const VDIFThread &thread = threads[t];
 
-          decodeMappedChannelSamples(ringBuffer + timeIndex, firstSpan, payload, payloadBytes, nchan, mappedIndex);
+    for (const std::pair<unsigned, unsigned> &run : thread.runs)
+      if (TimeStamp(thread.reorderWindow->timestamps()[run.first], ps.clockSpeed()) >= thread.latestWriteTime)
+        for (unsigned first = run.first; first < run.second; first += nrPacketsPerTask)
+          decodeTasks.push_back(DecodeTask { t, first, std::min(first + nrPacketsPerTask, run.second) });
+  }
 
-          if (secondSpan > 0) {
-            decodeMappedChannelSamples(
-                ringBuffer,
-                secondSpan,
-                payload,
-                payloadBytes,
-                nchan,
-                mappedIndex + static_cast<size_t>(firstSpan) * nchan);
-          }
-        }
-      }
+#pragma omp parallel num_threads(nrDecodeThreads) if (decodeTasks.size() > 1 && nrDecodeThreads > 1)
+  {
+    unsigned worker = omp_get_thread_num();
 
-      timeIndex += nrTimesPerPacket;
-      if (timeIndex >= nrRingBufferSamplesPerSubband)
-        timeIndex -= nrRingBufferSamplesPerSubband;
+#pragma omp for schedule(dynamic)
+    for (unsigned task = 0; task < decodeTasks.size(); ++task) {
+      VDIFThread &thread = threads[decodeTasks[task].thread];
+      writePackets(thread, thread.decodeStates[worker], thread.reorderWindow->frames(), thread.reorderWindow->timestamps(), decodeTasks[task].firstPacket, decodeTasks[task].lastPacket);
     }
+  }
 
-    {
-      std::lock_guard<std::mutex> lock(validDataMutex);
-      validData.exclude(TimeStamp(0, 1), endTime - nrRingBufferSamplesPerSubband);
-      const SparseSet<TimeStamp>::Ranges &ranges = validData.getRanges();
+  // the bookkeeping follows the order of the runs
+  for (VDIFThread &thread : threads)
+    for (const std::pair<unsigned, unsigned> &run : thread.runs) {
+      TimeStamp runBeginTime(thread.reorderWindow->timestamps()[run.first], ps.clockSpeed());
 
-      if (ranges.size() < 16 || ranges.back().end == beginTime) {
-        validData.include(beginTime, endTime);
-      }
+      if (runBeginTime >= thread.latestWriteTime)
+        addValidData(thread, runBeginTime, runBeginTime + (run.second - run.first) * nrTimesPerPacket);
     }
 
-    readerAndWriterSynchronization.finishedWrite(endTime);
-  }
+  latestWriteTime = std::max(latestWriteTime, writtenUntil());
+  readerAndWriterSynchronization.finishedWrite(latestWriteTime);
+  return true;
 }
 
 
 
 
-void InputBuffer::inputThreadBody() {
-  TimeStamp expectedTimeStamp(0, ps.clockSpeed()), stopTime = ps.stopTime() + ps.nrSamplesPerSubbandBeforeFilter();
+void InputBuffer::startInput()
+{
 #if defined FAKE_TIMES
-  //expectedTimeStamp = ps.startTime() - nrHistorySamples - 20;
-  expectedTimeStamp = TimeStamp::now(ps.clockSpeed()) - nrHistorySamples - 20;
+  //TimeStamp expectedTimeStamp = ps.startTime() - nrHistorySamples - 20;
+  TimeStamp expectedTimeStamp = TimeStamp::now(ps.clockSpeed()) - nrHistorySamples - 20;
+
+  for (VDIFThread &thread : threads)
+    thread.expectedTimeStamp = expectedTimeStamp;
+
 #pragma omp critical (clog)
   std::clog<<"expectedTimeStamp " << expectedTimeStamp << std::endl;
 
 #endif
 
-  VDIFStream vdifStream(ps.inputDescriptors()[myFirstStation], ps.sampleRate());
-  assert(&vdifStream != nullptr);
+  const std::string &descriptor = ps.inputDescriptors()[myFirstStation];
+
+  if (VDIFReceiver::isUDPDescriptor(descriptor)) {
+    receiver.reset(new VDIFReceiver(descriptor, ps.sampleRate(), maxNrPacketsInBuffer, maxPacketSize, ps.udpReceiveBufferSize(), ps.udpBusyPollMicroseconds()));
+    receiver->setNonBlocking(); // the InputEngine waits for data
+  } else if (Mark5BStream::isMark5BDescriptor(descriptor)) {
+    int64_t referenceTime = (int64_t) ps.startTime() / ps.sampleRate();
+
+    scanReader.reset(new VDIFScanReader(VDIFScanReader::fileNames(descriptor.substr(7)), [this, referenceTime] (const std::string &fileName) {
+      return new Mark5BStream(fileName, ps.sampleRate(), ps.nrMark5BChannels(), ps.nrMark5BBitsPerSample(), referenceTime);
+    }));
+  } else if (PcapReader::isPcapDescriptor(descriptor)) {
+    unsigned	udpPort;
+    std::string files;
+
+    PcapReader::parseDescriptor(descriptor, udpPort, files);
+
+    if (ps.pcapReplaySpeed() > 0)
+      pacer.reset(new PcapReader::Pacer(ps.pcapReplaySpeed())); // the InputEngine waits for its timer
+
+    scanReader.reset(new VDIFScanReader(VDIFScanReader::fileNames(files), [this, udpPort] (const std::string &fileName) {
+      return new PcapReader(fileName, ps.sampleRate(), udpPort, pacer.get());
+    }));
+  } else {
+    scanReader.reset(new VDIFScanReader(VDIFScanReader::fileNames(descriptor), [this] (const std::string &fileName) {
+      return new VDIFStream(fileName, ps.sampleRate(), ps.nrAsyncInputReads(), ps.asyncInputReadSize(), ps.directInput());
+    }));
+  }
+
+  if (scanReader != nullptr) {
 
 #pragma omp critical (clog)
-  std::clog << "Station " << myFirstStation << " first VDIF timestamp: "
-          << vdifStream.getFirstTimestamp() << " samples"
-          << " vs ps.startTime()=" << ps.startTime() << std::endl;
+    std::clog << "Station " << myFirstStation << " first VDIF timestamp: "
+            << scanReader->getFirstTimestamp() << " samples"
+            << " vs ps.startTime()=" << ps.startTime() << std::endl;
+
+    if (ps.seekIndex())
+      scanReader->seek(ps.startTime() - nrHistorySamples - ps.maxDelay());
+  }
+
+  nextStatisticsTime = std::chrono::steady_clock::now();
+  inputStarted = true;
+}
+
 
-  std::array<std::array<char, maxPacketSize>, maxNrPacketsInBuffer> packetBuffer;
+InputBuffer::InputState InputBuffer::processInput()
+{
+  if (!inputStarted)
+    startInput();
+
+  // the runs of the previous read must be written before reading more
+  if (runsPending)
+    return !handleRuns() ? INPUT_BLOCKED : timeStamp < stopTime && !stop && !signalCaught ? INPUT_READY : INPUT_FINISHED;
 
-  bool printedImpossibleTimeStampWarning = false;
-  unsigned nrPackets, firstPacket, nextPacket;
-  TimeStamp timeStamp(0, ps.clockSpeed()); 
+  if (stop || signalCaught)
+    return INPUT_FINISHED;
 
-#if defined USE_RECVMMSG
-  struct iovec   iovecs[maxNrPacketsInBuffer];
-  struct mmsghdr msgvec[maxNrPacketsInBuffer];
+  unsigned nrPackets;
 
-  for (int packet = 0; packet < maxNrPacketsInBuffer; packet ++) {
-    iovecs[packet].iov_base		  = packetBuffer[packet];
-    iovecs[packet].iov_len		  = maxPacketSize;
-    msgvec[packet].msg_hdr.msg_iov    = &iovecs[packet];
-    msgvec[packet].msg_hdr.msg_iovlen = 1;
+  try {
+    nrPackets = receiver != nullptr ? receiver->read(packets.data(), timestamps.data(), maxNrPacketsInBuffer) : scanReader->read(packets.data(), timestamps.data(), maxNrPacketsInBuffer);
+  }
+  catch (Stream::EndOfStreamException) {
+#pragma omp critical (clog)
+    std::clog <<  logMessage()  << " caught EndOfStreamException" << std::endl;
+    nrPackets = 0;
+    stop = true;
+  } 
+
+  // Nothing queued on the socket, or no captured packet due yet; keep the
+  // packets held back in the reorder windows until more arrive.  On a
+  // socket that stays idle for the network jitter, release them (by
+  // adding no packets), before forced progress would make them late.
+  if (receiver != nullptr && nrPackets > 0) {
+    receiver->stopIdleTimer();
+  } else if (receiver != nullptr && !stop && !receiver->idleTimerExpired()) {
+    for (const VDIFThread &thread : threads)
+      if (thread.reorderWindow->nrHeldFrames() > 0)
+        receiver->startIdleTimer(ps.networkJitter());
+
+    return INPUT_WAITING;
+  } else if (pacer != nullptr && nrPackets == 0 && !stop) {
+    return INPUT_WAITING;
   }
-#endif
 
-  do {
-    //#if defined USE_RECVMMSG  
-    try {
-      for (nrPackets = 0; nrPackets < maxNrPacketsInBuffer; nrPackets ++) {
-        vdifStream.read(packetBuffer[nrPackets].data());
-      }
-    }
-    catch (Stream::EndOfStreamException) {
+  if (nrPackets > 0 && reinterpret_cast<const VDIFHeader *>(packets[0])->samplesPerFrame() != nrTimesPerPacket) {
+    nrTimesPerPacket = reinterpret_cast<const VDIFHeader *>(packets[0])->samplesPerFrame();
+
 #pragma omp critical (clog)
-      std::clog <<  logMessage()  << " caught EndOfStreamException" << std::endl;
-      stop = true;
-    } 
-
-    /* catch (const SystemCallException &ex) {
-       if (ex.error != EAGAIN && ex.error != EINTR) // expect timeout; rethrow others
-       throw;
-       }*/
-
-    for (firstPacket = nextPacket = 0; nextPacket < nrPackets; nextPacket ++) {
-      const VDIFHeader* header = reinterpret_cast<const VDIFHeader*>(packetBuffer[nextPacket].data());
-      timeStamp = TimeStamp(header->timestamp(ps.sampleRate()), ps.clockSpeed());
-
-      if (timeStamp != expectedTimeStamp) {
-        if (firstPacket < nextPacket) {
-          handleConsecutivePackets(packetBuffer, firstPacket, nextPacket);
-        }
+    std::clog << logMessage() << ": " << nrTimesPerPacket << " samples per frame" << std::endl;
+  }
+
+  if (nrPackets > 0 && reinterpret_cast<const VDIFHeader *>(packets[0])->bits_per_sample + 1U != nrBitsPerSample) {
+    nrBitsPerSample = reinterpret_cast<const VDIFHeader *>(packets[0])->bits_per_sample + 1;
+
+    // a packed ring buffer would silently clamp and requantize wider input
+    if (nrBitsPerSample > nrRingBufferBitsPerSample) {
+      std::stringstream message;
+      message << logMessage() << ": " << nrBitsPerSample << "-bit input does not fit in a ring buffer of " << nrRingBufferBitsPerSample << " bits per sample";
+      throw std::runtime_error(message.str());
+    }
+  }
+
+  if (std::chrono::steady_clock::now() >= nextStatisticsTime) {
+    VDIFReorderWindow::Statistics statistics = { 0, 0, 0, 0 };
+    nextStatisticsTime = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+    snapshotDataQuality();
+
+    for (const VDIFThread &thread : threads) {
+      VDIFReorderWindow::Statistics threadStatistics = thread.reorderWindow->statistics();
+      statistics.nrReordered += threadStatistics.nrReordered;
+      statistics.nrLate += threadStatistics.nrLate;
+      statistics.nrDuplicates += threadStatistics.nrDuplicates;
+      statistics.nrOversized += threadStatistics.nrOversized;
+    }
 
-        if (ps.realTime() && abs(TimeStamp::now(ps.clockSpeed()) - timeStamp) > 15 * ps.subbandBandwidth()) {
-          if (!printedImpossibleTimeStampWarning) {
-            printedImpossibleTimeStampWarning = true;
 #pragma omp critical (clog)
-            std::clog << logMessage() << ": impossible timestamp " << timeStamp << std::endl;
-          }
+    {
+      std::clog << logMessage() << ": " << statistics.nrReordered << " packets reordered, " << statistics.nrLate << " late, " << statistics.nrDuplicates << " duplicate";
+
+      if (statistics.nrOversized > 0)
+        std::clog << ", " << statistics.nrOversized << " larger than " << maxPacketSize << " bytes";
 
-          firstPacket = nextPacket + 1;
-          timeStamp = 0;
-        } else {
-          printedImpossibleTimeStampWarning = false;
+      if (nrUnknownThreadPackets > 0)
+        std::clog << ", " << nrUnknownThreadPackets << " from unknown VDIF threads";
+
+      if (receiver != nullptr) {
+        VDIFReceiver::Statistics receiverStatistics = receiver->statistics();
+        std::clog << "; received " << receiverStatistics.nrReceived << " packets, " << receiverStatistics.nrInvalid << " invalid, " << receiverStatistics.nrKernelDrops << " dropped by the kernel";
+      }
+
+      SampleStatistics total = SampleStatistics();
+      std::vector<unsigned> zeroChannels;
+
+      for (unsigned channel = 0; channel < dataQualitySnapshot.size(); channel ++) {
+        total += dataQualitySnapshot[channel];
+
+        // 1- and 2-bit samples never decode to zero, except for missing
+        // channels; for wider samples, zero is a normal level
+        if (nrBitsPerSample <= 2 && dataQualitySnapshot[channel].zeroFraction() > .01)
+          zeroChannels.push_back(channel);
+      }
+
+      if (total.nrSamples > 0) {
+        std::clog << "; sampler states " << std::fixed << std::setprecision(1) << 100 * total.stateFraction(0) << '/' << 100 * total.stateFraction(1) << '/' << 100 * total.stateFraction(2) << '/' << 100 * total.stateFraction(3) << "%, power " << std::setprecision(2) << total.power() << std::defaultfloat << std::setprecision(6);
+
+        for (unsigned channel : zeroChannels)
+          std::clog << ", subband " << myFirstSubband + channel / ps.nrPolarizations() << " pol " << channel % ps.nrPolarizations() << ' ' << std::setprecision(3) << 100 * dataQualitySnapshot[channel].zeroFraction() << std::setprecision(6) << "% zeros";
+      }
+
+      std::clog << std::endl;
+    }
+  }
+
+  // discard impossible timestamps before they can disturb the reordering
+  if (ps.realTime()) {
+    TimeStamp now = TimeStamp::now(ps.clockSpeed());
+    unsigned nrPossiblePackets = 0;
+
+    for (unsigned packet = 0; packet < nrPackets; packet ++) {
+      // not timeStamp, which must only follow released packets
+      TimeStamp packetTime(timestamps[packet], ps.clockSpeed());
+
+      if (abs(now - packetTime) > 15 * ps.subbandBandwidth()) {
+        if (!printedImpossibleTimeStampWarning) {
+          printedImpossibleTimeStampWarning = true;
+#pragma omp critical (clog)
+          std::clog << logMessage() << ": impossible timestamp " << packetTime << std::endl;
         }
+      } else {
+        printedImpossibleTimeStampWarning = false;
+        packets[nrPossiblePackets] = packets[packet];
+        timestamps[nrPossiblePackets ++] = timestamps[packet];
       }
+    }
+
+    nrPackets = nrPossiblePackets;
+  }
+
+  for (VDIFThread &thread : threads) {
+    thread.packets.clear();
+    thread.timestamps.clear();
+    thread.runs.clear();
+  }
 
-      expectedTimeStamp = timeStamp + nrTimesPerPacket;
+  for (unsigned packet = 0; packet < nrPackets; packet ++) {
+    const VDIFHeader *header = reinterpret_cast<const VDIFHeader *>(packets[packet]);
+    int		thread = threadIndices[header->thread_id];
+
+    if (thread < 0) {
+      ++ nrUnknownThreadPackets;
+      continue;
     }
 
+    if (threads.size() > 1 && header->numberOfChannels() != nrChannelsPerThread) {
+      assignChannels(header->numberOfChannels());
 
-    if (firstPacket < nextPacket) {
-      handleConsecutivePackets(packetBuffer, firstPacket, nextPacket);
-    } 
+#pragma omp critical (clog)
+      std::clog << logMessage() << ": " << nrChannelsPerThread << " channels per VDIF thread" << std::endl;
+    }
 
+    threads[thread].packets.push_back(packets[packet]);
+    threads[thread].timestamps.push_back(timestamps[packet]);
+  }
 
-    //#endif
-  } while (timeStamp < stopTime && !stop && !signalCaught);
+  // order the packets of each thread and find the runs of consecutive
+  // ones; no packets at all (at the end of the input) releases the
+  // packets that the windows hold back
+  for (VDIFThread &thread : threads) {
+    if (nrPackets > 0 && thread.packets.empty())
+      continue;
 
-  readerAndWriterSynchronization.noMoreWriting();
+    unsigned nrOrderedPackets = thread.reorderWindow->add(thread.packets.data(), thread.timestamps.data(), thread.packets.size(), nrTimesPerPacket);
+    const int64_t *orderedTimestamps = thread.reorderWindow->timestamps();
+    unsigned firstPacket = 0, nextPacket;
 
-#if !defined CREATE_BACKTRACE_ON_EXCEPTION
-  /*  } catch (std::exception &ex) {
-      readerAndWriterSynchronization.noMoreWriting();
+    for (nextPacket = 0; nextPacket < nrOrderedPackets; nextPacket ++) {
+      timeStamp = TimeStamp(orderedTimestamps[nextPacket], ps.clockSpeed());
 
+      if (timeStamp != thread.expectedTimeStamp && firstPacket < nextPacket) {
+        thread.runs.emplace_back(firstPacket, nextPacket);
+        firstPacket = nextPacket;
+      }
 
-#pragma omp critical (cerr)
-std::cerr << logMessage() << " caught std::exception: " << ex.what() << std::endl;
-}*/
+      thread.expectedTimeStamp = timeStamp + nrTimesPerPacket;
+    }
 
-#endif
+    if (firstPacket < nextPacket)
+      thread.runs.emplace_back(firstPacket, nextPacket);
+  }
+
+  if (!handleRuns())
+    return INPUT_BLOCKED;
+
+  return timeStamp < stopTime && !stop && !signalCaught ? INPUT_READY : INPUT_FINISHED;
 }
 
 
-void InputBuffer::logThreadBody()
+void InputBuffer::snapshotDataQuality()
 {
-#if !defined CREATE_BACKTRACE_ON_EXCEPTION
-  try {
-#endif
-    while (!stop && !signalCaught) {
-      std::this_thread::sleep_for(std::chrono::seconds(1));
+  // called between reads, while no decode worker accumulates
+  std::vector<SampleStatistics> snapshot(dataQualitySnapshot.size(), SampleStatistics());
+
+  for (VDIFThread &thread : threads)
+    for (DecodeState &state : thread.decodeStates)
+      for (unsigned mapping = 0; mapping < state.sampleStatistics.size(); ++mapping) {
+        snapshot[thread.channelIndices[mapping]] += state.sampleStatistics[mapping];
+        state.sampleStatistics[mapping] = SampleStatistics();
+      }
 
-      std::lock_guard<std::mutex> lock(validDataMutex);
-#pragma omp critical (clog)
-      std::clog << logMessage() << ", valid: " << validData << std::endl;
-    }
-#if !defined CREATE_BACKTRACE_ON_EXCEPTION
-  } catch (std::exception &ex) {
-#pragma omp critical (cerr)
-    std::cerr << logMessage() << "caught std::exception: " << ex.what() << std::endl;
-  }
-#endif
+  std::lock_guard<std::mutex> lock(dataQualityMutex);
+  dataQualitySnapshot.swap(snapshot);
 }
 
 
+std::vector<SampleStatistics> InputBuffer::dataQuality() const
+{
+  std::lock_guard<std::mutex> lock(dataQualityMutex);
+  return dataQualitySnapshot;
+}
+
 
-void InputBuffer::noInputThreadBody()
+void InputBuffer::logValidData()
 {
-#if !defined CREATE_BACKTRACE_ON_EXCEPTION
-  try {
-#endif
-    // forces the correlator to proceed even if no data is received
+  SparseSet<TimeStamp> validData = getCurrentValidData(TimeStamp(0, ps.clockSpeed()), TimeStamp(0x7FFFFFFFFFFFFFFFLL, ps.clockSpeed()));
 
-    WallClockTime wallClock;
-    bool lateLastTime = false;
+#pragma omp critical (clog)
+  std::clog << logMessage() << ", valid: " << validData << std::endl;
+}
 
-    for (TimeStamp timeStamp = ps.startTime(); timeStamp < ps.stopTime() + ps.nrSamplesPerSubbandBeforeFilter() * ps.visibilitiesIntegration() && !stop && !signalCaught; timeStamp += ps.subbandBandwidth() / 10) {
-      wallClock.waitUntil(timeStamp + ps.subbandBandwidth() / 3);
 
-      std::lock_guard<std::mutex> lock(latestWriteTimeMutex);
+bool InputBuffer::forceProgress(const TimeStamp &timeStamp)
+{
+  std::lock_guard<std::mutex> lock(latestWriteTimeMutex);
 
-      if (latestWriteTime < timeStamp) {
-	readerAndWriterSynchronization.startWrite(latestWriteTime, timeStamp);
-	readerAndWriterSynchronization.finishedWrite(timeStamp);
-	latestWriteTime = timeStamp;
+  if (latestWriteTime < timeStamp) {
+    // never wait for the readers while holding the lock that the input
+    // workers of this station need
+    if (!readerAndWriterSynchronization.tryStartWrite(latestWriteTime, timeStamp))
+      return false;
 
-	if (!lateLastTime) {
-#pragma omp critical (clog)
-	  std::clog << logMessage() << ": forcing correlator to continue without data " << timeStamp << std::endl;
-	  lateLastTime = true;
-	}
-      } else if (lateLastTime) {
-#pragma omp critical (clog)
-	std::clog << logMessage() << ": resumed normal operation " << timeStamp << std::endl;
-	lateLastTime = false;
-      }
-    }
+    readerAndWriterSynchronization.finishedWrite(timeStamp);
+    latestWriteTime = timeStamp;
 
-    readerAndWriterSynchronization.noMoreWriting();
-#if !defined CREATE_BACKTRACE_ON_EXCEPTION
-  } catch (std::exception &ex) {
-#pragma omp critical (cerr)
-    std::cerr << logMessage() << " caught std::exception: " << ex.what() << std::endl;
+    // data that arrives for earlier times is too late
+    for (VDIFThread &thread : threads)
+      thread.latestWriteTime = std::max(thread.latestWriteTime, timeStamp);
 
-    readerAndWriterSynchronization.noMoreWriting();
+    if (!forcedLastTime) {
+#pragma omp critical (clog)
+      std::clog << logMessage() << ": forcing correlator to continue without data " << timeStamp << std::endl;
+      forcedLastTime = true;
+    }
+  } else if (forcedLastTime) {
+#pragma omp critical (clog)
+    std::clog << logMessage() << ": resumed normal operation " << timeStamp << std::endl;
+    forcedLastTime = false;
   }
-#endif
+
+  return true;
 }
 
 
 
-SparseSet<TimeStamp> InputBuffer::getCurrentValidData(const TimeStamp &earlyStartTime, const TimeStamp &endTime)
+SparseSet<TimeStamp> InputBuffer::getCurrentValidData(const TimeStamp &earlyStartTime, const TimeStamp &endTime, int subband)
 {
+  // valid only where every thread that feeds the subband (or, for subband
+  // -1, any subband) has data
+  SparseSet<TimeStamp> validData(earlyStartTime, endTime);
+  bool fed = false;
+
   std::lock_guard<std::mutex> lock(validDataMutex);
-  return validData & SparseSet<TimeStamp>(earlyStartTime, endTime);
+
+  for (const VDIFThread &thread : threads)
+    if (subband < 0 ? !thread.mappedChannels.empty() : thread.feedsSubband[subband]) {
+      validData = validData & thread.validData;
+      fed = true;
+    }
+
+  return fed ? validData : SparseSet<TimeStamp>();
 }
 
-void InputBuffer::fillInMissingSamples(const TimeStamp &startTime, unsigned subband, SparseSet<TimeStamp> &validData)
+void InputBuffer::getValidity(const TimeStamp &startTime, int delay, unsigned subband, ValidityBitmap &validity, bool clearFlagged)
 {
-  TimeStamp earlyStartTime   = startTime - nrHistorySamples - ps.maxDelay();
-  TimeStamp endTime          = startTime + ps.nrSamplesPerSubbandBeforeFilter() + ps.maxDelay();
+  // normally, flagged samples are not cleared here: the GPU copy zeroes them
+  // (or the expansion of a packed ring buffer does), so the ring buffer is
+  // not written twice
+  TimeStamp firstTime = startTime - nrHistorySamples + delay;
+  unsigned  nrSamples = nrHistorySamples + ps.nrSamplesPerSubbandBeforeFilter();
+  SparseSet<TimeStamp> validData = getCurrentValidData(firstTime, firstTime + nrSamples, subband - myFirstSubband);
+
+  validity.assign(validData, firstTime, nrSamples);
+
+  if (clearFlagged && !ps.packedRingBuffer()) {
+    clearFlaggedSamples(subband, validData, firstTime, firstTime + nrSamples);
+  } else {
+    // every invalid run costs a separate memset, so merge the runs that are
+    // only separated by less than one filter input of valid samples; these
+    // hardly contribute to the correlations anyway
+    validity.flagShortGaps(ps.nrChannelsPerSubbandBeforeFilter());
+  }
 
-  validData = getCurrentValidData(earlyStartTime, endTime);
-  SparseSet<TimeStamp> flaggedData = validData.invert(earlyStartTime, endTime);
-  const SparseSet<TimeStamp>::Ranges &flaggedRanges = flaggedData.getRanges();
-  size_t size = myNrStations * ps.nrBytesPerRealSample(); 
-  
-  for (const SparseSet<TimeStamp>::range &it : flaggedRanges) {
-    for (unsigned timeIndex = it.begin % nrRingBufferSamplesPerSubband, timeEndIndex = it.end % nrRingBufferSamplesPerSubband; timeIndex != timeEndIndex;) {
-      for (unsigned pol = 0; pol < ps.nrPolarizations(); pol++) {
-        uncached_memclear(hostRingBuffer[subband][myFirstStation][pol][timeIndex].origin(), size);
-      }
+  if (subband == 0)
+#pragma omp critical (clog)
+    std::clog << logMessage() << ' ' << firstTime << " flagged: " << 100.0 * (nrSamples - validity.count()) / nrSamples << '%' << std::endl;
+}
 
-      if (++ timeIndex == nrRingBufferSamplesPerSubband)
-        timeIndex = 0;
-    }
+
+void InputBuffer::clearFlaggedSamples(unsigned subband, const SparseSet<TimeStamp> &validData, const TimeStamp &firstTime, const TimeStamp &endTime)
+{
+  // Consecutive blocks overlap by the history and the delays; what an
+  // earlier block of this subband cleared is still zero, as flagged data
+  // is never written later.  A range is only marked as cleared once it
+  // is, so that a concurrent block of the same subband cannot skip it
+  // too early.
+  SparseSet<TimeStamp> toClear;
+
+  {
+    std::lock_guard<std::mutex> lock(clearedDataMutex);
+    SparseSet<TimeStamp> &cleared = clearedData[subband - myFirstSubband];
+
+    cleared.exclude(TimeStamp(0, 1), endTime - nrRingBufferSamplesPerSubband);
+    toClear = validData.invert(firstTime, endTime) & cleared.invert(firstTime, endTime);
   }
 
-  unsigned nrHistorySamples = (NR_TAPS - 1) * ps.nrChannelsPerSubbandBeforeFilter();
-  unsigned nrSamples        = nrHistorySamples + ps.nrSamplesPerSubbandBeforeFilter();
+  // per station and polarization, the ring buffer is contiguous in time;
+  // clear whole ranges, split only where they wrap
+  const size_t bytesPerSample = ps.nrBytesPerRealSample();
 
-  if (subband == 0)
-#pragma omp critical (clog)
-    std::clog << logMessage() << ' ' << earlyStartTime << " flagged: " << 100.0 * (int64_t) flaggedData.count() / nrSamples << "% (" << flaggedRanges.size() << ')' << std::endl;
+  for (const SparseSet<TimeStamp>::range &range : toClear.getRanges()) {
+    unsigned beginIndex = range.begin % nrRingBufferSamplesPerSubband;
+    unsigned nrSamples  = range.end - range.begin;
+    unsigned firstPart  = std::min(nrSamples, nrRingBufferSamplesPerSubband - beginIndex);
+
+    for (unsigned station = myFirstStation; station < myFirstStation + myNrStations; station ++)
+      for (unsigned pol = 0; pol < ps.nrPolarizations(); pol++) {
+        char *row = hostRingBuffer[subband][station][pol].origin();
+
+        uncached_memclear(row + beginIndex * bytesPerSample, firstPart * bytesPerSample);
+
+        if (firstPart < nrSamples)
+          uncached_memclear(row, (nrSamples - firstPart) * bytesPerSample);
+      }
+  }
+
+  std::lock_guard<std::mutex> lock(clearedDataMutex);
+  clearedData[subband - myFirstSubband] |= toClear;
 }
 
 
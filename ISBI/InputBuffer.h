@@ -6,55 +6,153 @@
 #include "Common/ReaderWriterSynchronization.h"
 #include "Common/SparseSet.h"
 #include "Common/TimeStamp.h"
+#include "ISBI/PcapReader.h"
+#include "ISBI/ValidityBitmap.h"
+#include "ISBI/VDIFDecoder.h"
+#include "ISBI/VDIFReceiver.h"
+#include "ISBI/VDIFReorderWindow.h"
+#include "ISBI/VDIFScanReader.h"
 #include "ISBI/VDIFStream.h"
 
 #include <boost/multi_array.hpp>
 
 #include <cstdint>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <csignal>
 #include <functional>
 #include <mutex>
-#include <thread>
 #include <vector>
 
 
+// Receives or reads the VDIF input of a station into the ring buffer.  An
+// InputBuffer has no threads of its own: an InputEngine repeatedly calls
+// processInput() from a shared worker pool, and calls forceProgress() and
+// logValidData() from its housekeeping threads.
+
 class InputBuffer{
 public:
     InputBuffer(const ISBI_Parset &, MultiArrayHostBuffer<char, 4> hostRingBuffer[], unsigned myFirstSubband, unsigned myNrSubbands, unsigned myFirstStation, unsigned myNrStations, unsigned nrTimesPerPacket);
     ~InputBuffer();
 
-    void fillInMissingSamples(const TimeStamp &time, unsigned subband, SparseSet<TimeStamp> &validData);
+    enum InputState {
+      INPUT_READY, // call processInput() again
+      INPUT_WAITING, // wait until pollDescriptor() is readable
+      INPUT_BLOCKED, // wait until the reader advanced callback is called
+      INPUT_FINISHED
+    };
+
+    // opens the input on the first call; handles one read
+    InputState processInput();
+    int pollDescriptor() const { return receiver != nullptr ? receiver->fd() : pacer != nullptr ? pacer->fd() : -1; }
+
+    void stopInput(); // unblocks a writer waiting for readers
+    void setReaderAdvancedCallback(const std::function<void ()> &callback) { readerAndWriterSynchronization.setReaderAdvancedCallback(callback); }
+    void noMoreWriting();
+    bool forceProgress(const TimeStamp &); // without input, lets real-time correlation proceed up to this time; false if the readers are not there yet
+    void logValidData();
+
+    // per (subband, polarization) of this station, accumulated while
+    // decoding during the most recent second
+    std::vector<SampleStatistics> dataQuality() const;
+
+    // which samples of the block that starts (after the history) at time
+    // plus delay are valid; clearFlagged also zeroes the others in the ring
+    // buffer, for a GPU that reads it in place
+    void getValidity(const TimeStamp &time, int delay, unsigned subband, ValidityBitmap &, bool clearFlagged = false);
 
     void startReadTransaction(const TimeStamp &);
     void endReadTransaction(const TimeStamp &);
 
     static void caughtSignal();
+    static bool signalWasCaught() { return signalCaught; }
 
 private:
     const static unsigned	maxNrPacketsInBuffer = 64;
     const static unsigned	maxPacketSize	     = 8032; // this must not be a power of 2, or performance will collapse due to limited cache associativity
-
-    void inputThreadBody(), noInputThreadBody(), logThreadBody();
+    const static unsigned	ringBufferChunkSize  = 64; // samples per channel written at once; one cache line
+
+    // the scratch state of one decode worker for one VDIF thread
+    struct DecodeState {
+      std::unique_ptr<VDIFDecoder> decoder; // specialized on the format of the most recent frame
+      std::vector<int8_t *>	chunkOutputs; // per mapped channel: where the decoder writes the current chunk
+      std::vector<int8_t>	packedChunk; // decoded chunk of all mapped channels, before packing
+      std::vector<SampleStatistics> sampleStatistics; // per mapped channel, since the last snapshot
+    };
+
+    // A station may record several VDIF threads (thread_id), each with its
+    // own channels.  Frames are routed to their thread, which has its own
+    // packet order, run detection, ring-buffer rows, and valid data.
+    struct VDIFThread {
+      std::vector<uint32_t>	mappedChannels; // channel numbers within the frames of this thread
+      std::vector<unsigned>	channelIndices; // per mapped channel: subband * nrPolarizations + polarization
+      std::vector<int8_t *>	ringBufferBases; // rows of packed samples if nrRingBufferBitsPerSample < 8
+      std::vector<bool>		feedsSubband; // these four are replaced under validDataMutex
+      std::vector<DecodeState>	decodeStates; // per decode worker
+
+      std::vector<const char *> packets; // this thread's share of the current read
+      std::vector<int64_t>	timestamps;
+      std::unique_ptr<VDIFReorderWindow> reorderWindow;
+      std::vector<std::pair<unsigned, unsigned>> runs; // of consecutive packets in reorderWindow, to be written
+      TimeStamp			expectedTimeStamp, latestWriteTime;
+      SparseSet<TimeStamp>	validData;
+    };
+
+    // a slice of a run, decoded by one worker; slices cover disjoint times
+    struct DecodeTask {
+      unsigned			thread, firstPacket, lastPacket;
+    };
+
+    void startInput();
     std::function<std::ostream & (std::ostream &)> logMessage() const;
 
-    void handleConsecutivePackets(std::array<std::array<char, maxPacketSize>, maxNrPacketsInBuffer>& packetBuffer, unsigned firstPacket, unsigned lastPacket);
-    SparseSet<TimeStamp> getCurrentValidData(const TimeStamp &earlyStartTime, const TimeStamp &endTime);
+    void assignChannels(unsigned nrChannelsPerThread);
+    void deinterleavePacket(VDIFThread &, DecodeState &, const VDIFHeader *, unsigned timeIndex);
+    void writePackets(VDIFThread &, DecodeState &, const char *const packets[], const int64_t timestamps[], unsigned firstPacket, unsigned lastPacket);
+    void addValidData(VDIFThread &, const TimeStamp &beginTime, const TimeStamp &endTime);
+    bool handleRuns(); // false if the readers did not free enough ring buffer space yet
+    void snapshotDataQuality();
+    void clearFlaggedSamples(unsigned subband, const SparseSet<TimeStamp> &validData, const TimeStamp &firstTime, const TimeStamp &endTime);
+    TimeStamp writtenUntil(); // advances the threads that lag too much
+    SparseSet<TimeStamp> getCurrentValidData(const TimeStamp &earlyStartTime, const TimeStamp &endTime, int subband = -1);
 
     const ISBI_Parset	&ps;
-    unsigned			myFirstSubband, myNrSubbands, myFirstStation, myNrStations, nrRingBufferSamplesPerSubband, nrTimesPerPacket, nrHistorySamples;
-    std::vector<uint32_t>	mappedChannels;
-    std::vector<int8_t *>	ringBufferBases;
+    unsigned			myFirstSubband, myNrSubbands, myFirstStation, myNrStations, nrRingBufferSamplesPerSubband, nrRingBufferBitsPerSample, nrTimesPerPacket, nrHistorySamples;
+    std::vector<VDIFThread>	threads;
+    std::vector<int>		threadIndices; // per thread_id, -1 if not used
+    unsigned			nrChannelsPerThread; // 0 until known, or if there is only one thread
+    unsigned			nrDecodeThreads;
+    std::vector<DecodeTask>	decodeTasks;
 
     MultiArrayHostBuffer<char, 4> *hostRingBuffer;
-    SparseSet<TimeStamp>	validData;
     TimeStamp			latestWriteTime;
     std::mutex			validDataMutex, latestWriteTimeMutex;
     std::atomic<bool>		stop;
 
+    std::vector<SampleStatistics> dataQualitySnapshot;
+    mutable std::mutex		dataQualityMutex;
+
+    std::vector<SparseSet<TimeStamp>> clearedData; // per subband: flagged ring buffer ranges that are already zero
+    std::mutex			clearedDataMutex;
+
     SynchronizedReaderAndWriter readerAndWriterSynchronization;
-    std::thread			inputThread, logThread;
-    std::unique_ptr<std::thread> noInputThreadPtr;
+
+    // the state of processInput() between calls; live input arrives over
+    // UDP, recorded input is read from (a sequence of) VDIF files, or
+    // replayed from captured UDP traffic, optionally at its original pace
+    bool			inputStarted;
+    bool			runsPending; // written by the next handleRuns(), before reading more
+    std::unique_ptr<VDIFReceiver> receiver;
+    std::unique_ptr<PcapReader::Pacer> pacer;
+    std::unique_ptr<VDIFScanReader> scanReader;
+    std::array<const char *, maxNrPacketsInBuffer> packets; // point into the mapped file, read blocks, or receive buffer
+    std::array<int64_t, maxNrPacketsInBuffer> timestamps;
+    unsigned			nrBitsPerSample; // of the input, 0 until known
+    TimeStamp			timeStamp, stopTime;
+    bool			printedImpossibleTimeStampWarning, forcedLastTime;
+    uint64_t			nrUnknownThreadPackets;
+    std::chrono::steady_clock::time_point nextStatisticsTime;
 
     static volatile std::sig_atomic_t signalCaught;
 };
@@ -0,0 +1,352 @@
+#include "Common/Config.h"
+
+#include "ISBI/InputEngine.h"
+#include "Common/Affinity.h"
+#include "Common/SystemCallException.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+#include <map>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+
+InputEngine::Pool::Pool(const cpu_set_t &cpus)
+:
+  cpus(cpus)
+{
+  if ((epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    throw SystemCallException("epoll_create1");
+
+  if ((eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE)) < 0)
+    throw SystemCallException("eventfd");
+
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = nullptr; // distinguishes the eventFd from the sockets
+
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &event) < 0)
+    throw SystemCallException("epoll_ctl");
+}
+
+
+InputEngine::Pool::~Pool()
+{
+  close(eventFd);
+  close(epollFd);
+}
+
+
+InputEngine::InputEngine(const ISBI_Parset &ps, const std::vector<std::unique_ptr<InputBuffer>> &inputBuffers)
+:
+  ps(ps),
+  inputBuffers(inputBuffers),
+  stop(false)
+{
+  // one pool per input buffer node, or a single pool on all allowed CPUs
+  std::map<unsigned, Pool *> poolOfNode;
+
+  for (unsigned stationSet = 0; stationSet < inputBuffers.size(); stationSet ++) {
+    Pool *pool;
+
+#if defined __linux__
+    if (ps.inputBufferNodes().size() > 0) {
+      unsigned node = ps.inputBufferNodes()[stationSet];
+
+      if (poolOfNode.find(node) == poolOfNode.end()) {
+	pools.emplace_back(new Pool(ps.allowedCPUs(node)));
+	poolOfNode[node] = pools.back().get();
+      }
+
+      pool = poolOfNode[node];
+    } else
+#endif
+    {
+      if (pools.empty())
+	pools.emplace_back(new Pool(ps.allowedCPUs()));
+
+      pool = pools.back().get();
+    }
+
+    pool->sources.push_back(Source { inputBuffers[stationSet].get(), false, false, false });
+  }
+
+  for (std::unique_ptr<Pool> &pool : pools) {
+    std::vector<unsigned> cpus;
+
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu ++)
+      if (CPU_ISSET(cpu, &pool->cpus))
+	cpus.push_back(cpu);
+
+    // each worker gets nrDecodeThreads CPUs for decoding
+    unsigned nrCPUsPerWorker = ps.nrDecodeThreads();
+    unsigned nrWorkers = ps.nrInputThreads() > 0 ? ps.nrInputThreads() : std::min((unsigned) pool->sources.size(), std::max((unsigned) cpus.size() / nrCPUsPerWorker, 1U));
+
+    for (Source &source : pool->sources) {
+      Pool &sourcePool = *pool;
+      source.inputBuffer->setReaderAdvancedCallback([this, &sourcePool, &source] { resume(sourcePool, source); });
+      pool->readyQueue.push_back(&source);
+    }
+
+    for (unsigned worker = 0; worker < nrWorkers; worker ++) {
+      cpu_set_t workerCPUs;
+      CPU_ZERO(&workerCPUs);
+
+      for (unsigned cpu = 0; cpu < nrCPUsPerWorker; cpu ++)
+	CPU_SET(cpus[(worker * nrCPUsPerWorker + cpu) % cpus.size()], &workerCPUs);
+
+      pool->workers.emplace_back(&InputEngine::workerThreadBody, this, std::ref(*pool), workerCPUs);
+    }
+
+#pragma omp critical (clog)
+    std::clog << "input: " << nrWorkers << " thread(s) for " << pool->sources.size() << " station(s)" << std::endl;
+  }
+
+  logThread = std::thread(&InputEngine::logThreadBody, this);
+
+  if (ps.realTime())
+    noInputThreadPtr.reset(new std::thread(&InputEngine::noInputThreadBody, this));
+}
+
+
+InputEngine::~InputEngine()
+{
+  // unblocks workers that wait for the correlator to free ring buffer space
+  for (const std::unique_ptr<InputBuffer> &inputBuffer : inputBuffers)
+    inputBuffer->stopInput();
+
+  stop = true;
+  wallClock.cancelWait();
+
+  for (std::unique_ptr<Pool> &pool : pools) {
+    uint64_t nrWakeUps = pool->workers.size();
+
+    if (write(pool->eventFd, &nrWakeUps, sizeof nrWakeUps) < 0)
+#pragma omp critical (cerr)
+      std::cerr << "cannot wake up input workers: " << SystemCallException("write").what() << std::endl;
+  }
+
+  if (noInputThreadPtr.get() != nullptr)
+    noInputThreadPtr->join();
+
+  logThread.join();
+
+  for (std::unique_ptr<Pool> &pool : pools)
+    for (std::thread &worker : pool->workers)
+      worker.join();
+
+  for (const std::unique_ptr<InputBuffer> &inputBuffer : inputBuffers)
+    inputBuffer->setReaderAdvancedCallback(nullptr);
+}
+
+
+void InputEngine::workerThreadBody(Pool &pool, cpu_set_t cpus)
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    BoundThread boundThread(cpus); // also binds the OpenMP threads that decode
+
+    while (!stop) {
+      Source *source = nullptr;
+
+      {
+	std::lock_guard<std::mutex> lock(pool.mutex);
+
+	if (!pool.readyQueue.empty()) {
+	  source = pool.readyQueue.front();
+	  pool.readyQueue.pop_front();
+	}
+      }
+
+      if (source != nullptr) {
+	run(pool, *source);
+	continue;
+      }
+
+      struct epoll_event events[16];
+      int nrEvents = epoll_wait(pool.epollFd, events, 16, -1);
+
+      if (nrEvents < 0) {
+	if (errno == EINTR)
+	  continue;
+
+	throw SystemCallException("epoll_wait");
+      }
+
+      for (int event = 0; event < nrEvents; event ++)
+	if (events[event].data.ptr != nullptr) {
+	  enqueue(pool, * static_cast<Source *>(events[event].data.ptr));
+	} else {
+	  uint64_t value; // another worker may have taken it already
+
+	  if (read(pool.eventFd, &value, sizeof value) < 0 && errno != EAGAIN)
+	    throw SystemCallException("read");
+	}
+    }
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+#pragma omp critical (cerr)
+    std::cerr << "input worker caught std::exception: " << ex.what() << std::endl;
+  }
+#endif
+}
+
+
+void InputEngine::run(Pool &pool, Source &source)
+{
+  InputBuffer::InputState state = InputBuffer::INPUT_READY;
+
+  try {
+    // a bounded number of reads, so that the other stations get their turn
+    for (unsigned read = 0; read < maxNrReadsPerTurn && state == InputBuffer::INPUT_READY; read ++)
+      state = source.inputBuffer->processInput();
+  } catch (std::exception &ex) {
+#pragma omp critical (cerr)
+    std::cerr << "input caught std::exception: " << ex.what() << std::endl;
+
+    state = InputBuffer::INPUT_FINISHED;
+  }
+
+  switch (state) {
+    case InputBuffer::INPUT_READY :	enqueue(pool, source);
+					break;
+
+    case InputBuffer::INPUT_WAITING :	wait(pool, source);
+					break;
+
+    case InputBuffer::INPUT_BLOCKED :	park(pool, source);
+					break;
+
+    case InputBuffer::INPUT_FINISHED :	finish(source);
+					break;
+  }
+}
+
+
+void InputEngine::enqueue(Pool &pool, Source &source)
+{
+  {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.readyQueue.push_back(&source);
+  }
+
+  uint64_t one = 1;
+
+  if (write(pool.eventFd, &one, sizeof one) < 0)
+    throw SystemCallException("write");
+}
+
+
+void InputEngine::wait(Pool &pool, Source &source)
+{
+  int fd = source.inputBuffer->pollDescriptor();
+
+  if (fd < 0) {
+    enqueue(pool, source); // nothing to wait for
+    return;
+  }
+
+  // one-shot, so that only one worker takes the source when data arrives
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLONESHOT;
+  event.data.ptr = &source;
+
+  if (epoll_ctl(pool.epollFd, source.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) < 0)
+    throw SystemCallException("epoll_ctl");
+
+  source.registered = true;
+}
+
+
+void InputEngine::park(Pool &pool, Source &source)
+{
+  {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+
+    // the correlator may have freed space since processInput() looked
+    if (!source.wakeUp) {
+      source.parked = true;
+      return;
+    }
+
+    source.wakeUp = false;
+  }
+
+  enqueue(pool, source);
+}
+
+
+void InputEngine::resume(Pool &pool, Source &source)
+{
+  // called by the correlator, after it advanced its read pointer
+  {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+
+    if (!source.parked) {
+      source.wakeUp = true;
+      return;
+    }
+
+    source.parked = false;
+  }
+
+  enqueue(pool, source);
+}
+
+
+void InputEngine::finish(Source &source)
+{
+  source.inputBuffer->noMoreWriting();
+}
+
+
+void InputEngine::logThreadBody()
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    while (!stop && !InputBuffer::signalWasCaught()) {
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+
+      for (const std::unique_ptr<InputBuffer> &inputBuffer : inputBuffers)
+	inputBuffer->logValidData();
+    }
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+#pragma omp critical (cerr)
+    std::cerr << "input log thread caught std::exception: " << ex.what() << std::endl;
+  }
+#endif
+}
+
+
+void InputEngine::noInputThreadBody()
+{
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  try {
+#endif
+    // forces the correlator to proceed even if no data is received
+
+    for (TimeStamp timeStamp = ps.startTime(); timeStamp < ps.stopTime() + ps.nrSamplesPerSubbandBeforeFilter() * ps.visibilitiesIntegration() && !stop && !InputBuffer::signalWasCaught(); timeStamp += ps.subbandBandwidth() / 10) {
+      wallClock.waitUntil(timeStamp + ps.subbandBandwidth() / 3);
+
+      // a station whose readers lag behind is skipped, rather than waited
+      // for; the next tick forces it further
+      for (const std::unique_ptr<InputBuffer> &inputBuffer : inputBuffers)
+	inputBuffer->forceProgress(timeStamp);
+    }
+#if !defined CREATE_BACKTRACE_ON_EXCEPTION
+  } catch (std::exception &ex) {
+#pragma omp critical (cerr)
+    std::cerr << "input caught std::exception: " << ex.what() << std::endl;
+  }
+#endif
+
+  for (const std::unique_ptr<InputBuffer> &inputBuffer : inputBuffers)
+    inputBuffer->noMoreWriting();
+}
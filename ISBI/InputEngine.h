@@ -0,0 +1,75 @@
+#ifndef ISBI_INPUT_ENGINE_H
+#define ISBI_INPUT_ENGINE_H
+
+#include "ISBI/Parset.h"
+#include "ISBI/InputBuffer.h"
+#include "Common/WallClockTime.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+
+
+// Drives the InputBuffers with a small pool of worker threads per NUMA node,
+// rather than a thread per station.  Each worker is bound to its own
+// nrDecodeThreads CPUs, on which it decodes a station's packets.  A
+// station that has data is taken from a ready queue and handled for a
+// bounded number of reads, so that the stations share the workers fairly;
+// a socket without data is handed to epoll, which puts the station back in
+// the queue once a datagram arrives.  Likewise, a station whose ring buffer
+// is full is parked until the correlator frees space, so that a worker never
+// waits for the correlator.
+
+class InputEngine
+{
+  public:
+    InputEngine(const ISBI_Parset &, const std::vector<std::unique_ptr<InputBuffer>> &);
+    ~InputEngine();
+
+  private:
+    const static unsigned maxNrReadsPerTurn = 16;
+
+    struct Source {
+      InputBuffer *inputBuffer;
+      bool	  registered; // with the epoll set of its pool
+      bool	  parked, wakeUp; // under the mutex of its pool
+    };
+
+    struct Pool {
+      Pool(const cpu_set_t &);
+      ~Pool();
+
+      cpu_set_t			cpus;
+      int			epollFd, eventFd; // eventFd counts the sources in readyQueue
+      std::vector<Source>	sources;
+      std::mutex		mutex;
+      std::deque<Source *>	readyQueue;
+      std::vector<std::thread>	workers;
+    };
+
+    void workerThreadBody(Pool &, cpu_set_t cpus);
+    void run(Pool &, Source &);
+    void enqueue(Pool &, Source &);
+    void wait(Pool &, Source &);
+    void park(Pool &, Source &);
+    void resume(Pool &, Source &);
+    void finish(Source &);
+
+    void logThreadBody();
+    void noInputThreadBody();
+
+    const ISBI_Parset			 &ps;
+    const std::vector<std::unique_ptr<InputBuffer>> &inputBuffers;
+    std::vector<std::unique_ptr<Pool>>	 pools;
+    std::atomic<bool>			 stop;
+    WallClockTime			 wallClock;
+    std::thread				 logThread;
+    std::unique_ptr<std::thread>	 noInputThreadPtr;
+};
+
+#endif
@@ -3,7 +3,9 @@
 #include "Common/Affinity.h"
 #include "ISBI/InputBuffer.h"
 #include "ISBI/InputSection.h"
+#include "ISBI/VDIFDecoder.h"
 
+#include <cstring>
 #include <fstream>
 
 InputSection::InputSection(const ISBI_Parset &ps)
@@ -13,8 +15,44 @@ InputSection::InputSection(const ISBI_Parset &ps)
   hostRingBuffers([&] () {
     std::vector<MultiArrayHostBuffer<char, 4>> buffers; 
 
-    for (unsigned subband = 0; subband < ps.nrSubbands(); subband ++)
-        buffers.emplace_back(std::move(boost::extents[ps.nrStations()][ps.nrPolarizations()][ps.nrRingBufferSamplesPerSubband()][ps.nrBytesPerRealSample()]), CU_MEMHOSTALLOC_WRITECOMBINED);
+    for (unsigned subband = 0; subband < ps.nrSubbands(); subband ++) {
+      boost::array<size_t, 4> extents = ps.packedRingBuffer() ?
+        boost::array<size_t, 4> {{ ps.nrStations(), ps.nrPolarizations(), ps.nrRingBufferBytesPerSubband(), 1 }} :
+        boost::array<size_t, 4> {{ ps.nrStations(), ps.nrPolarizations(), ps.nrRingBufferSamplesPerSubband(), ps.nrBytesPerRealSample() }};
+
+      // packed samples are partially rewritten and expanded by the CPU, which
+      // is too slow on uncached write-combined memory
+      HostAllocator allocator(ps.ringBufferMemory(), ps.packedRingBuffer() ? 0 : CU_MEMHOSTALLOC_WRITECOMBINED);
+      allocator.prefault = ps.prefaultHostMemory();
+      allocator.pin = ps.pinHostMemory();
+
+      if (ps.ringBufferPlacement() != ISBI_Parset::DefaultPlacement) {
+        // placed memory is mmap()ed and registered, which cannot be write
+        // combined; its pages are faulted in on the nodes they are bound to
+        size_t bytesPerStation = ps.nrPolarizations() * ps.nrRingBufferBytesPerSubband();
+
+        if (allocator.kind == HostAllocator::Pinned)
+          allocator.kind = HostAllocator::Plain;
+
+        allocator.prefault = true;
+        allocator.place = [&ps, subband, bytesPerStation] (NUMAMemory &memory) {
+          switch (ps.ringBufferPlacement()) {
+            case ISBI_Parset::InterleavedPlacement: memory.interleave();
+                                                    break;
+
+            case ISBI_Parset::StationPlacement:     for (unsigned station = 0; station < ps.nrStations(); station ++)
+                                                      memory.bind(station * bytesPerStation, bytesPerStation, ps.inputBufferNodes()[station]);
+
+                                                    break;
+
+            default:                                memory.bind(0, memory.size(), ps.outputBufferNodes()[subband]);
+                                                    break;
+          }
+        };
+      }
+
+      buffers.emplace_back(extents, allocator);
+    }
 
     return std::move(buffers);
   } ()),
@@ -28,7 +66,9 @@ InputSection::InputSection(const ISBI_Parset &ps)
     }
 
     return std::move(buffers);
-  } ())
+  } ()),
+
+  inputEngine(new InputEngine(ps, inputBuffers))
 {
 }
 
@@ -36,6 +76,8 @@ InputSection::InputSection(const ISBI_Parset &ps)
 
 InputSection::~InputSection()
 {
+  inputEngine = nullptr;
+
 #pragma omp parallel for
   for (unsigned i = 0; i < inputBuffers.size(); i ++)
     inputBuffers[i] = nullptr;
@@ -44,7 +86,8 @@ InputSection::~InputSection()
 
 
 
-void InputSection::enqueueHostToDeviceCopy(cu::Stream &stream, cu::DeviceMemory &devBuffer, PerformanceCounter &counter, const TimeStamp &startTime, unsigned subband) {
+int InputSection::delaySamples(const TimeStamp &startTime, unsigned station) const
+{
   int referenceStation = 0;
   auto getDelayAt = [&](const std::map<int64_t, double>& delays, int64_t timestamp) {
     auto it = delays.find(timestamp);
@@ -55,18 +98,31 @@ void InputSection::enqueueHostToDeviceCopy(cu::Stream &stream, cu::DeviceMemory
     return it->second;
   };
 
-  for (unsigned station = 0; station < ps.nrStations(); station++) {
-    double delayAtStart  = getDelayAt(ps.delays()[station], (int64_t)startTime);
+  double delayAtStart  = getDelayAt(ps.delays()[station], (int64_t)startTime);
 
-    if (station != referenceStation) {
-      double delayAtStartR = getDelayAt(ps.delays()[referenceStation], (int64_t)startTime);
-      delayAtStart -= delayAtStartR;
-    } else {
-      delayAtStart = 0.0;
-    }
+  if (station != referenceStation) {
+    double delayAtStartR = getDelayAt(ps.delays()[referenceStation], (int64_t)startTime);
+    delayAtStart -= delayAtStartR;
+  } else {
+    delayAtStart = 0.0;
+  }
+
+  double Fs = (double)ps.sampleRate();
+  return static_cast<int>(std::floor(delayAtStart * Fs + 0.5));
+}
+
+
+void InputSection::enqueueHostToDeviceCopy(cu::Stream &stream, cu::DeviceMemory &devBuffer, PerformanceCounter &counter, const TimeStamp &startTime, unsigned subband, const std::vector<ValidityBitmap> &validity, MultiArrayHostBuffer<char, 3> *stagingBuffer) {
+  if (ps.packedRingBuffer()) {
+    expandPackedSamples(*stagingBuffer, startTime, subband, validity);
 
-    double Fs = (double)ps.sampleRate();
-    int delay = static_cast<int>(std::floor(delayAtStart * Fs + 0.5));
+    PerformanceCounter::Measurement measurement(counter, stream, 0, 0, stagingBuffer->bytesize());
+    stream.memcpyHtoDAsync(devBuffer, stagingBuffer->origin(), stagingBuffer->bytesize());
+    return;
+  }
+
+  for (unsigned station = 0; station < ps.nrStations(); station++) {
+    int delay = delaySamples(startTime, station);
 
     std::cout << "inputSection=" << delay << std::endl;
 
@@ -117,6 +173,13 @@ void InputSection::enqueueHostToDeviceCopy(cu::Stream &stream, cu::DeviceMemory
               secondPart * nrBytesPerTime
               );
         }
+
+        // mask the flagged samples in device memory, where clearing is
+        // cheap, rather than in the write-combined ring buffer
+        validity[station].forEachInvalidRange([&] (unsigned begin, unsigned end) {
+          cu::DeviceMemory dst(devBuffer + offset + begin * nrBytesPerTime);
+          stream.memsetAsync(dst, 0, (end - begin) * nrBytesPerTime);
+        });
       }
     }
   }
@@ -132,10 +195,45 @@ void InputSection::enqueueHostToDeviceCopy(cu::Stream &stream, cu::DeviceMemory
 
 
 
-void InputSection::fillInMissingSamples(const TimeStamp &time, unsigned subband, std::vector<SparseSet<TimeStamp> > &validData)
+void InputSection::expandPackedSamples(MultiArrayHostBuffer<char, 3> &stagingBuffer, const TimeStamp &startTime, unsigned subband, const std::vector<ValidityBitmap> &validity)
+{
+  // expands the block into the same [station][pol][time] layout that the
+  // unpacked ring buffer is copied to the GPU in; flagged samples are zeroed
+  // here since a packed 2-bit ring buffer cannot hold zeros
+
+  unsigned nrHistorySamples = (NR_TAPS - 1) * ps.nrChannelsPerSubbandBeforeFilter();
+  unsigned n = nrHistorySamples + ps.nrSamplesPerSubbandBeforeFilter();
+
+  assert(stagingBuffer.shape()[2] == n);
+
+  for (unsigned station = 0; station < ps.nrStations(); station++) {
+    int delay = delaySamples(startTime, station);
+
+    TimeStamp earlyStartTime   = startTime - nrHistorySamples + delay;
+
+    unsigned startTimeIndex = earlyStartTime % ps.nrRingBufferSamplesPerSubband();
+    unsigned firstPart = std::min(n, ps.nrRingBufferSamplesPerSubband() - startTimeIndex);
+
+    for (unsigned pol = 0; pol < ps.nrPolarizations(); pol++) {
+      int8_t *dst = reinterpret_cast<int8_t *>(stagingBuffer[station][pol].origin());
+      const uint8_t *row = reinterpret_cast<const uint8_t *>(hostRingBuffers[subband][station][pol][0].origin());
+
+      unpackSamples(dst, row, startTimeIndex, firstPart, ps.nrRingBufferBitsPerSample());
+      unpackSamples(dst + firstPart, row, 0, n - firstPart, ps.nrRingBufferBitsPerSample());
+
+      validity[station].forEachInvalidRange([dst] (unsigned begin, unsigned end) {
+	memset(dst + begin, 0, end - begin);
+      });
+    }
+  }
+}
+
+
+void InputSection::getValidity(const TimeStamp &time, unsigned subband, std::vector<ValidityBitmap> &validity, bool clearFlagged)
 {
+  // one station per input buffer
   for (unsigned stationSet = 0; stationSet < inputBuffers.size(); stationSet ++)
-    inputBuffers[stationSet]->fillInMissingSamples(time, subband, validData[stationSet]);
+    inputBuffers[stationSet]->getValidity(time, delaySamples(time, stationSet), subband, validity[stationSet], clearFlagged);
 }
 
 
@@ -3,9 +3,10 @@
 
 #include "ISBI/Parset.h"
 #include "ISBI/InputBuffer.h"
+#include "ISBI/InputEngine.h"
+#include "ISBI/ValidityBitmap.h"
 #include "Common/CUDA_Support.h"
 #include "Common/PerformanceCounter.h"
-#include "Common/SparseSet.h"
 #include "Common/TimeStamp.h"
 
 #include <vector>
@@ -18,13 +19,21 @@ class InputSection
     InputSection();
     ~InputSection();
     
-    void fillInMissingSamples(const TimeStamp &, unsigned subband, std::vector<SparseSet<TimeStamp> > &validData);
-    void enqueueHostToDeviceCopy(cu::Stream &, cu::DeviceMemory &devBuffer, PerformanceCounter &, const TimeStamp &, unsigned subband);
+    // per station, which samples of its delay-compensated block are valid;
+    // clearFlagged zeroes the others in the ring buffer itself
+    void getValidity(const TimeStamp &, unsigned subband, std::vector<ValidityBitmap> &validity, bool clearFlagged = false);
+    // flagged samples are zeroed in the device buffer, after the copy; with a
+    // packed ring buffer, the block is expanded into stagingBuffer
+    // ([station][pol][time]), which must remain untouched until the copy is done
+    void enqueueHostToDeviceCopy(cu::Stream &, cu::DeviceMemory &devBuffer, PerformanceCounter &, const TimeStamp &, unsigned subband, const std::vector<ValidityBitmap> &validity, MultiArrayHostBuffer<char, 3> *stagingBuffer = nullptr);
 
     void startReadTransaction(const TimeStamp &);
     void endReadTransaction(const TimeStamp &);
 
   private:
+    int  delaySamples(const TimeStamp &, unsigned station) const;
+    void expandPackedSamples(MultiArrayHostBuffer<char, 3> &stagingBuffer, const TimeStamp &, unsigned subband, const std::vector<ValidityBitmap> &validity);
+
     const ISBI_Parset &ps;
   
   public:
@@ -32,6 +41,7 @@ class InputSection
 
   private:
     std::vector<std::unique_ptr<InputBuffer>> inputBuffers;
+    std::unique_ptr<InputEngine> inputEngine;
     unsigned nrRingBufferSamplesPerSubband;
     const static unsigned nrTimesPerPacket = 2000;
 };
@@ -0,0 +1,250 @@
+#include "Common/Config.h"
+
+#include "ISBI/Mark5BStream.h"
+#include "Common/SystemCallException.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static const size_t  bufferSize	    = 8 << 20;
+static const unsigned vdifHeaderSize = 32, vdifFrameSize = vdifHeaderSize + Mark5BStream::vdifPayloadSize;
+static const int64_t mjdOf1970	    = 40587;
+
+
+Mark5BStream::Mark5BStream(const std::string &fileName, double sampleRate, unsigned nrChannels, unsigned nrBitsPerSample, int64_t referenceTime)
+:
+  file(fileName),
+  fileName(fileName),
+  samplesPerSecond(std::llround(sampleRate)),
+  referenceMJD(referenceTime / 86400 + mjdOf1970),
+  nrChannels(nrChannels),
+  nrBitsPerSample(nrBitsPerSample),
+  buffer(bufferSize),
+  begin(0),
+  end(0),
+  fileOffset(0),
+  endOfFile(false),
+  _nrResyncs(0)
+{
+  if ((nrBitsPerSample != 1 && nrBitsPerSample != 2) || nrChannels == 0 || (nrChannels & (nrChannels - 1)) != 0 || nrChannels * nrBitsPerSample > 32)
+    throw std::runtime_error("unsupported Mark5B format");
+
+  samplesPerVDIFFrame = vdifPayloadSize * 8 / nrBitsPerSample / nrChannels;
+
+  // a 2-bit sample is a sign bit (1: positive) followed by a magnitude bit
+  // (1: high); VDIF codes go from the most negative level up.  The 1-bit
+  // encodings are the same.
+  static const uint8_t vdifCode[4] = { 1, 2, 0, 3 };
+
+  for (unsigned byte = 0; byte < 256; byte ++)
+    if (nrBitsPerSample == 2)
+      translation[byte] = vdifCode[byte & 3] | vdifCode[byte >> 2 & 3] << 2 | vdifCode[byte >> 4 & 3] << 4 | vdifCode[byte >> 6] << 6;
+    else
+      translation[byte] = byte;
+
+  uint32_t header[4];
+  int64_t  second;
+
+  for (;;) {
+    if (!fill(frameSize))
+      throw std::runtime_error("Could not find a valid Mark5B frame in " + fileName);
+
+    memcpy(header, &buffer[begin], sizeof header);
+
+    if (header[0] == syncWord && parseTime(header, second))
+      break;
+
+    if (!resync())
+      throw std::runtime_error("Could not find a valid Mark5B frame in " + fileName);
+  }
+
+  firstTimestamp = second * samplesPerSecond + (int64_t) (header[1] & 0x7FFF) * nrVDIFFramesPerFrame * samplesPerVDIFFrame;
+  firstFrameOffset = fileOffset - (end - begin);
+  _nrResyncs = 0;
+}
+
+
+Mark5BStream::~Mark5BStream()
+{
+  if (_nrResyncs > 0)
+#pragma omp critical (clog)
+    std::clog << fileName << ": lost Mark5B frame sync " << _nrResyncs << " times" << std::endl;
+}
+
+
+bool Mark5BStream::isMark5BDescriptor(const std::string &descriptor)
+{
+  return descriptor.compare(0, 7, "mark5b:") == 0;
+}
+
+
+bool Mark5BStream::fill(size_t minBytes)
+{
+  if (end - begin >= minBytes)
+    return true;
+
+  // move the remainder to the front, and read the rest
+  std::memmove(&buffer[0], &buffer[begin], end - begin);
+  end -= begin;
+  begin = 0;
+
+  try {
+    while (!endOfFile && end < minBytes) {
+      size_t size = file.tryRead(&buffer[end], buffer.size() - end);
+      end += size;
+      fileOffset += size;
+    }
+  } catch (Stream::EndOfStreamException &) {
+    endOfFile = true;
+  }
+
+  return end - begin >= minBytes;
+}
+
+
+bool Mark5BStream::resync()
+{
+  // the sync word, as it appears in the (little-endian) file
+  static const char pattern[4] = { '\xED', '\xDE', '\xAD', '\xAB' };
+
+  ++ _nrResyncs;
+  ++ begin;
+
+  for (;;) {
+    const void *found = memmem(&buffer[begin], end - begin, pattern, sizeof pattern);
+
+    if (found != nullptr) {
+      begin = static_cast<const char *>(found) - &buffer[0];
+      return true;
+    }
+
+    // a partial sync word may remain at the end
+    begin = std::max(begin, end - std::min(end - begin, sizeof pattern - 1));
+
+    if (!fill(end - begin + 1))
+      return false;
+  }
+}
+
+
+bool Mark5BStream::parseTime(const uint32_t header[], int64_t &second) const
+{
+  // header[2] holds the last three digits of the MJD and the second of the
+  // day as binary-coded decimals, JJJSSSSS
+  unsigned digits[8];
+
+  for (unsigned digit = 0; digit < 8; digit ++)
+    if ((digits[digit] = header[2] >> (28 - 4 * digit) & 0xF) > 9)
+      return false;
+
+  int64_t truncatedMJD = digits[0] * 100 + digits[1] * 10 + digits[2];
+  int64_t secondOfDay  = (((digits[3] * 10 + digits[4]) * 10 + digits[5]) * 10 + digits[6]) * 10 + digits[7];
+
+  if (secondOfDay >= 86400)
+    return false;
+
+  int64_t mjd = referenceMJD + (truncatedMJD - referenceMJD % 1000 + 1500) % 1000 - 500;
+  second = (mjd - mjdOf1970) * 86400 + secondOfDay;
+  return true;
+}
+
+
+void Mark5BStream::convert(const char *frame, int64_t second, unsigned part, char *vdifFrame, int64_t &timestamp)
+{
+  uint32_t header[4];
+  memcpy(header, frame, sizeof header);
+
+  unsigned epoch = VDIFHeader::epochStarts.size() - 1;
+
+  while (epoch > 0 && VDIFHeader::epochStarts[epoch] > second)
+    -- epoch;
+
+  VDIFHeader *vdifHeader = reinterpret_cast<VDIFHeader *>(vdifFrame);
+  memset(vdifHeader, 0, vdifHeaderSize);
+  vdifHeader->sec_from_epoch	  = second - VDIFHeader::epochStarts[epoch];
+  vdifHeader->ref_epoch		  = epoch;
+  vdifHeader->dataframe_in_second = (header[1] & 0x7FFF) * nrVDIFFramesPerFrame + part;
+  vdifHeader->dataframe_length	  = vdifFrameSize / 8;
+  vdifHeader->log2_nchan	  = __builtin_ctz(nrChannels);
+  vdifHeader->bits_per_sample	  = nrBitsPerSample - 1;
+
+  const uint8_t *in  = reinterpret_cast<const uint8_t *>(frame + headerSize + part * vdifPayloadSize);
+  uint8_t	*out = reinterpret_cast<uint8_t *>(vdifFrame + vdifHeaderSize);
+
+  for (unsigned byte = 0; byte < vdifPayloadSize; byte ++)
+    out[byte] = translation[in[byte]];
+
+  timestamp = second * samplesPerSecond + (int64_t) vdifHeader->dataframe_in_second * samplesPerVDIFFrame;
+}
+
+
+unsigned Mark5BStream::read(const char *frames[], int64_t timestamps[], unsigned maxNrFrames)
+{
+  if (vdifFrames.size() < maxNrFrames * vdifFrameSize)
+    vdifFrames.resize(maxNrFrames * vdifFrameSize);
+
+  unsigned nrFrames = 0;
+
+  while (nrFrames + nrVDIFFramesPerFrame <= maxNrFrames && fill(frameSize)) {
+    uint32_t header[4];
+    int64_t  second;
+
+    memcpy(header, &buffer[begin], sizeof header);
+
+    if (header[0] != syncWord || !parseTime(header, second)) {
+      if (resync())
+	continue;
+
+      break;
+    }
+
+    for (unsigned part = 0; part < nrVDIFFramesPerFrame; part ++, nrFrames ++) {
+      convert(&buffer[begin], second, part, &vdifFrames[nrFrames * vdifFrameSize], timestamps[nrFrames]);
+      frames[nrFrames] = &vdifFrames[nrFrames * vdifFrameSize];
+    }
+
+    begin += frameSize;
+  }
+
+  if (nrFrames == 0)
+    throw Stream::EndOfStreamException("Mark5BStream::read EOF reached");
+
+  return nrFrames;
+}
+
+
+void Mark5BStream::seek(int64_t timestamp)
+{
+  struct stat stat;
+
+  if (fstat(file.fd, &stat) < 0)
+    throw SystemCallException("fstat " + fileName);
+
+  if (!S_ISREG(stat.st_mode)) {
+    std::cout << "Cannot seek in " << fileName << std::endl;
+    return;
+  }
+
+  // assume that no data was lost; a frame early, to be safe
+  int64_t frame  = (timestamp - firstTimestamp) / (nrVDIFFramesPerFrame * samplesPerVDIFFrame) - 1;
+  off_t   offset = firstFrameOffset + frame * frameSize;
+
+  if (frame <= 0 || offset <= fileOffset - static_cast<off_t>(end - begin) || offset >= stat.st_size)
+    return;
+
+  std::cout << "Seeking to offset " << offset << " in " << fileName << std::endl;
+
+  if (lseek(file.fd, offset, SEEK_SET) < 0)
+    throw SystemCallException("lseek " + fileName);
+
+  begin = end = 0;
+  fileOffset = offset;
+  endOfFile = false;
+}
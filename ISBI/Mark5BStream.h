@@ -0,0 +1,72 @@
+#ifndef ISBI_MARK5B_STREAM_H
+#define ISBI_MARK5B_STREAM_H
+
+#include "Common/Stream/FileStream.h"
+#include "ISBI/VDIFFrameSource.h"
+#include "ISBI/VDIFStream.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Reads a Mark5B recording and hands it out as VDIF frames, so that it goes
+// through the same reordering, decoding, and ring-buffer path as VDIF input.
+// A Mark5B frame (a 16-byte header and 10000 bytes of data) does not fit in
+// an InputBuffer packet slot, so it becomes two VDIF frames of 5000 bytes.
+// The payload is copied once, while its 2-bit samples are translated from
+// sign/magnitude bit pairs to VDIF offset-binary codes.  Mark5B does not
+// record the number of channels, the sample size, or the full date; these
+// come from the parset.  After corrupt or lost data, the reader resyncs on
+// the next sync word.
+
+class Mark5BStream : public VDIFFrameSource
+{
+  public:
+    static const uint32_t syncWord		= 0xABADDEED;
+    static const unsigned headerSize		= 16, payloadSize = 10000, frameSize = headerSize + payloadSize;
+    static const unsigned nrVDIFFramesPerFrame	= 2, vdifPayloadSize = payloadSize / nrVDIFFramesPerFrame;
+
+    // nrBitsPerSample is 1 or 2; referenceTime (in seconds since 1970) lies
+    // within 500 days of the recording, and resolves its truncated MJD
+    Mark5BStream(const std::string &fileName, double sampleRate, unsigned nrChannels, unsigned nrBitsPerSample, int64_t referenceTime);
+    ~Mark5BStream();
+
+    // "mark5b:" followed by a file name, glob pattern, or file list
+    static bool isMark5BDescriptor(const std::string &descriptor);
+
+    // reads at most maxNrFrames / 2 Mark5B frames
+    unsigned read(const char *frames[], int64_t timestamps[], unsigned maxNrFrames) override;
+
+    // Estimates the offset of timestamp from the frame rate, and resyncs
+    // there.  Only works on regular files.
+    void seek(int64_t timestamp) override;
+
+    int64_t getFirstTimestamp() const override { return firstTimestamp; }
+
+    uint64_t nrResyncs() const { return _nrResyncs; }
+
+  private:
+    bool fill(size_t minBytes);
+    bool resync();
+    bool parseTime(const uint32_t header[], int64_t &second) const; // second since 1970; false if the time code is invalid
+    void convert(const char *frame, int64_t second, unsigned part, char *vdifFrame, int64_t &timestamp);
+
+    FileStream		   file;
+    std::string		   fileName;
+    int64_t		   samplesPerSecond, referenceMJD;
+    unsigned		   nrChannels, nrBitsPerSample, samplesPerVDIFFrame;
+    std::array<uint8_t, 256> translation; // Mark5B sample byte to VDIF sample byte
+
+    std::vector<char>	   buffer;
+    size_t		   begin, end; // unprocessed bytes in buffer
+    off_t		   fileOffset, firstFrameOffset; // of buffer[end], and of the first valid frame
+    bool		   endOfFile;
+
+    std::vector<char>	   vdifFrames;
+    int64_t		   firstTimestamp;
+    uint64_t		   _nrResyncs;
+};
+
+#endif
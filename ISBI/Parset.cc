@@ -1,3 +1,5 @@
+#include "Common/Config.h"
+
 #include "ISBI/Parset.h"
 #include <boost/program_options.hpp>
 #include <fstream>
@@ -25,9 +27,31 @@ std::vector<std::string> AARTFAAC_Parset::getDescriptors(const std::string &arg)
 ISBI_Parset::ISBI_Parset(int argc, char **argv)
 :
   CorrelatorParset(argc, argv, false),
-  _nrRingBufferSamplesPerSubband(128015360),
+#if defined __linux__
+  _ringBufferPlacement(DefaultPlacement),
+  _visibilitiesPlacement(DefaultPlacement),
+#endif
+  _ringBufferMemory(HostAllocator::Pinned),
+  _visibilitiesMemory(HostAllocator::Pinned),
+  _prefaultHostMemory(false),
+  _pinHostMemory(true),
+  _nrRingBufferSamplesPerSubband(0),
+  _networkJitter(.1),
+  _nrRingBufferBitsPerSample(8),
   _visibilitiesIntegration(1),
-  _maxDelaySamples(1000)
+  _maxDelaySamples(1000),
+  _nrAsyncInputReads(0),
+  _asyncInputReadSize(8 << 20),
+  _directInput(false),
+  _seekIndex(false),
+  _udpReceiveBufferSize(0),
+  _udpBusyPollMicroseconds(0),
+  _reorderWindowSize(16),
+  _nrInputThreads(0),
+  _nrDecodeThreads(1),
+  _nrMark5BChannels(16),
+  _nrMark5BBitsPerSample(2),
+  _pcapReplaySpeed(0)
 {
   using namespace boost::program_options;
 
@@ -39,9 +63,30 @@ ISBI_Parset::ISBI_Parset(int argc, char **argv)
 #if defined __linux__
     ("inputBufferNodes,A", value<std::string>()->notifier([this] (std::string arg) { _inputBufferNodes = getNodeVector(arg.c_str()); }))
     ("outputBufferNodes,O", value<std::string>()->notifier([this] (std::string arg) { _outputBufferNodes = getNodeVector(arg.c_str()); }))
+    ("ringBufferPlacement", value<std::string>()->notifier([this] (const std::string &arg) { _ringBufferPlacement = getMemoryPlacement(arg); })) // default, interleaved, station, or subband
+    ("visibilitiesPlacement", value<std::string>()->notifier([this] (const std::string &arg) { _visibilitiesPlacement = getMemoryPlacement(arg); })) // default, interleaved, or subband
 #endif
-    ("nrRingBufferSamplesPerSubband,T", value<unsigned>(&_nrRingBufferSamplesPerSubband))
+    ("ringBufferMemory", value<std::string>()->notifier([this] (const std::string &arg) { _ringBufferMemory = getHostMemoryKind(arg); })) // pinned, plain, hugepages (2 MB), or hugepages1G
+    ("visibilitiesMemory", value<std::string>()->notifier([this] (const std::string &arg) { _visibilitiesMemory = getHostMemoryKind(arg); }))
+    ("prefaultHostMemory", value<bool>(&_prefaultHostMemory)) // fault in and lock all pages of non-pinned buffers at startup
+    ("pinHostMemory", value<bool>(&_pinHostMemory)) // register mmap()ed buffers with CUDA; false copies them synchronously
+    ("nrRingBufferSamplesPerSubband,T", value<unsigned>(&_nrRingBufferSamplesPerSubband)) // 0: the minimum that is safe
+    ("networkJitter", value<double>(&_networkJitter)) // seconds that input may arrive late or out of order; sizes the ring buffer
+    ("nrRingBufferBitsPerSample", value<unsigned>(&_nrRingBufferBitsPerSample)) // 2 or 4: keep samples bit-packed until transfer; the input must not be wider
     ("visibilitiesIntegration,I", value<unsigned>(&_visibilitiesIntegration))
+    ("nrAsyncInputReads", value<unsigned>(&_nrAsyncInputReads)) // 0: memory map input files
+    ("asyncInputReadSize", value<size_t>(&_asyncInputReadSize))
+    ("directInput", value<bool>(&_directInput))
+    ("seekIndex", value<bool>(&_seekIndex)) // start reading input files at the start time, using (and creating) <file>.index; building one scans the whole file
+    ("udpReceiveBufferSize", value<size_t>(&_udpReceiveBufferSize)) // 0: system default
+    ("udpBusyPollMicroseconds", value<unsigned>(&_udpBusyPollMicroseconds))
+    ("reorderWindowSize", value<unsigned>(&_reorderWindowSize)) // packets held back to wait for late ones; 0: only sort each read
+    ("vdifThreadIds", value<std::string>()->notifier([this] (const std::string &arg) { _vdifThreadIds = splitArgs<unsigned>(arg); } )) // channels are numbered through these threads, in this order
+    ("nrInputThreads", value<unsigned>(&_nrInputThreads)) // per input buffer node; 0: one per station, at most one per nrDecodeThreads CPUs
+    ("nrDecodeThreads", value<unsigned>(&_nrDecodeThreads)) // CPUs that decode the packets of one station in parallel
+    ("nrMark5BChannels", value<unsigned>(&_nrMark5BChannels)) // of "mark5b:" inputs, which do not record their format
+    ("nrMark5BBitsPerSample", value<unsigned>(&_nrMark5BBitsPerSample))
+    ("pcapReplaySpeed", value<double>(&_pcapReplaySpeed)) // of "pcap:" inputs, relative to the capture; 0: as fast as possible
   ;
 
 
@@ -61,8 +106,98 @@ ISBI_Parset::ISBI_Parset(int argc, char **argv)
 
   if (_outputBufferNodes.size() != 0 && _outputBufferNodes.size() != _outputDescriptors.size())
     throw Error("output buffer node list has unexpected size");
+
+  if ((_ringBufferPlacement == StationPlacement && _inputBufferNodes.size() == 0) || ((_ringBufferPlacement == SubbandPlacement || _visibilitiesPlacement == SubbandPlacement) && _outputBufferNodes.size() == 0))
+    throw Error("station placement needs input buffer nodes, subband placement needs output buffer nodes");
+
+  if (_visibilitiesPlacement == StationPlacement)
+    throw Error("visibilities cannot be placed per station");
+#endif
+
+  if (_nrRingBufferBitsPerSample != 2 && _nrRingBufferBitsPerSample != 4 && _nrRingBufferBitsPerSample != 8)
+    throw Error("nrRingBufferBitsPerSample must be 2, 4, or 8");
+
+  // placed buffers are always mmap()ed
+  if (!_pinHostMemory && ((_ringBufferMemory == HostAllocator::Pinned && _ringBufferPlacement == DefaultPlacement) || (_visibilitiesMemory == HostAllocator::Pinned && _visibilitiesPlacement == DefaultPlacement)))
+    throw Error("unpinned host memory must be mmap()ed: set ringBufferMemory and visibilitiesMemory");
+
+  if (_networkJitter < 0)
+    throw Error("networkJitter must not be negative");
+
+  if (_nrRingBufferSamplesPerSubband == 0)
+    _nrRingBufferSamplesPerSubband = minNrRingBufferSamplesPerSubband();
+  else if (_nrRingBufferSamplesPerSubband < (NR_TAPS - 1) * nrChannelsPerSubbandBeforeFilter() + nrSamplesPerSubbandBeforeFilter() + 2 * maxDelay())
+    throw Error("nrRingBufferSamplesPerSubband cannot hold a single block");
+
+  if ((uint64_t) _nrRingBufferSamplesPerSubband * _nrRingBufferBitsPerSample % 8 != 0)
+    throw Error("nrRingBufferSamplesPerSubband must fill a whole number of bytes");
+
+  if ((_nrMark5BBitsPerSample != 1 && _nrMark5BBitsPerSample != 2) || _nrMark5BChannels == 0 || (_nrMark5BChannels & (_nrMark5BChannels - 1)) != 0 || _nrMark5BChannels * _nrMark5BBitsPerSample > 32)
+    throw Error("Mark5B input needs 1 or 2 bits per sample, and a power of 2 channels of at most 32 bits together");
+
+  if (_pcapReplaySpeed < 0)
+    throw Error("pcapReplaySpeed must not be negative");
+
+  if (_nrDecodeThreads == 0)
+    throw Error("nrDecodeThreads must be at least 1");
+
+  for (unsigned threadId : _vdifThreadIds)
+    if (threadId >= 1024 || std::count(_vdifThreadIds.begin(), _vdifThreadIds.end(), threadId) > 1)
+      throw Error("vdifThreadIds must be distinct VDIF thread ids (0-1023)");
+
+}
+
+
+#if defined __linux__
+ISBI_Parset::MemoryPlacement ISBI_Parset::getMemoryPlacement(const std::string &arg)
+{
+  if (arg == "default")
+    return DefaultPlacement;
+  else if (arg == "interleaved")
+    return InterleavedPlacement;
+  else if (arg == "station")
+    return StationPlacement;
+  else if (arg == "subband")
+    return SubbandPlacement;
+  else
+    throw Error("unknown memory placement \'" + arg + '\'');
+}
 #endif
 
+
+unsigned ISBI_Parset::minNrRingBufferSamplesPerSubband() const
+{
+  // A block is read from its history to its end, widened by the maximum
+  // delay on both sides.  The work queues process up to one block per
+  // subband at a time, so consecutive blocks are read concurrently, while
+  // the input fills the next one; late and out-of-order input is written
+  // up to the network jitter behind the newest data.  In real time, a block
+  // that falls out of this window is dropped (see CorrelatorWorkQueue::inTime).
+  uint64_t nrBlocksInFlight = (nrQueuesPerGPU() * nrGPUs() + nrSubbands() - 1) / nrSubbands() + 1;
+  uint64_t nrSamples	    = (NR_TAPS - 1) * nrChannelsPerSubbandBeforeFilter() + 2 * maxDelay() + nrBlocksInFlight * nrSamplesPerSubbandBeforeFilter() + (uint64_t) ceil(_networkJitter * clockSpeed());
+
+  // whole chunks, which are also whole bytes if bit-packed
+  nrSamples = (nrSamples + 63) / 64 * 64;
+
+  if (nrSamples > 0xFFFFFFC0)
+    throw Error("ring buffer would exceed 2^32 samples per subband; reduce networkJitter or the block size");
+
+  return nrSamples;
+}
+
+
+HostAllocator::Kind ISBI_Parset::getHostMemoryKind(const std::string &arg)
+{
+  if (arg == "pinned")
+    return HostAllocator::Pinned;
+  else if (arg == "plain")
+    return HostAllocator::Plain;
+  else if (arg == "hugepages")
+    return HostAllocator::HugePages2M;
+  else if (arg == "hugepages1G")
+    return HostAllocator::HugePages1G;
+  else
+    throw Error("unknown host memory kind \'" + arg + '\'');
 }
 
 
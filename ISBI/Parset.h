@@ -1,6 +1,7 @@
 #if !defined ISBI_PARSET_H
 #define ISBI_PARSET_H
 
+#include "Common/HostAllocator.h"
 #include "Correlator/Parset.h"
 
 class ISBI_Parset : public CorrelatorParset
@@ -8,18 +9,50 @@ class ISBI_Parset : public CorrelatorParset
   public:
     ISBI_Parset(int argc, char **argv);
 
+    // where the pages of host buffers go: as first touched (default), spread
+    // over all nodes, on the input buffer node of their station, or on the
+    // output buffer node of their subband (that also processes it)
+    enum MemoryPlacement { DefaultPlacement, InterleavedPlacement, StationPlacement, SubbandPlacement };
+
     const std::vector<std::string> &inputDescriptors() const { return _inputDescriptors; }
     const std::vector<std::string> &outputDescriptors() const { return _outputDescriptors; }
 
 #if defined __linux__
     std::vector<unsigned>  inputBufferNodes() const { return _inputBufferNodes; }
     std::vector<unsigned>  outputBufferNodes() const { return _outputBufferNodes; }
+    MemoryPlacement        ringBufferPlacement() const { return _ringBufferPlacement; }
+    MemoryPlacement        visibilitiesPlacement() const { return _visibilitiesPlacement; }
 #endif
 
+    HostAllocator::Kind ringBufferMemory() const { return _ringBufferMemory; }
+    HostAllocator::Kind visibilitiesMemory() const { return _visibilitiesMemory; }
+    bool     prefaultHostMemory() const { return _prefaultHostMemory; }
+    bool     pinHostMemory() const { return _pinHostMemory; }
+
     unsigned visibilitiesIntegration() const { return _visibilitiesIntegration; }
     unsigned nrRingBufferSamplesPerSubband() const { return _nrRingBufferSamplesPerSubband; }
+    unsigned minNrRingBufferSamplesPerSubband() const;
+    double   networkJitter() const { return _networkJitter; }
+    unsigned nrRingBufferBitsPerSample() const { return _nrRingBufferBitsPerSample; }
+    bool     packedRingBuffer() const { return _nrRingBufferBitsPerSample < 8; }
+    size_t   nrRingBufferBytes() const { return (size_t) nrSubbands() * nrStations() * nrPolarizations() * nrRingBufferBytesPerSubband(); }
+    size_t   nrRingBufferBytesPerSubband() const { return packedRingBuffer() ? (size_t) _nrRingBufferSamplesPerSubband * _nrRingBufferBitsPerSample / 8 : (size_t) _nrRingBufferSamplesPerSubband * nrBytesPerRealSample(); }
 
     const int maxDelay() const { return _maxDelaySamples; }; 
+
+    unsigned nrAsyncInputReads() const { return _nrAsyncInputReads; }
+    size_t   asyncInputReadSize() const { return _asyncInputReadSize; }
+    bool     directInput() const { return _directInput; }
+    bool     seekIndex() const { return _seekIndex; }
+    size_t   udpReceiveBufferSize() const { return _udpReceiveBufferSize; }
+    unsigned udpBusyPollMicroseconds() const { return _udpBusyPollMicroseconds; }
+    unsigned reorderWindowSize() const { return _reorderWindowSize; }
+    const std::vector<unsigned> &vdifThreadIds() const { return _vdifThreadIds; }
+    unsigned nrInputThreads() const { return _nrInputThreads; }
+    unsigned nrDecodeThreads() const { return _nrDecodeThreads; }
+    unsigned nrMark5BChannels() const { return _nrMark5BChannels; }
+    unsigned nrMark5BBitsPerSample() const { return _nrMark5BBitsPerSample; }
+    double   pcapReplaySpeed() const { return _pcapReplaySpeed; }
     
     virtual std::vector<std::string> compileOptions() const;
 
@@ -28,11 +61,34 @@ class ISBI_Parset : public CorrelatorParset
 
 #if defined __linux__
     std::vector<unsigned> _inputBufferNodes, _outputBufferNodes;
+    MemoryPlacement       _ringBufferPlacement, _visibilitiesPlacement;
+
+    static MemoryPlacement getMemoryPlacement(const std::string &arg);
 #endif
 
+    HostAllocator::Kind _ringBufferMemory, _visibilitiesMemory;
+    bool     _prefaultHostMemory, _pinHostMemory;
+
+    static HostAllocator::Kind getHostMemoryKind(const std::string &arg);
+
     unsigned _nrRingBufferSamplesPerSubband;
+    double   _networkJitter;
+    unsigned _nrRingBufferBitsPerSample;
     unsigned _visibilitiesIntegration;
     int _maxDelaySamples;
+
+    unsigned _nrAsyncInputReads;
+    size_t   _asyncInputReadSize;
+    bool     _directInput;
+    bool     _seekIndex;
+    size_t   _udpReceiveBufferSize;
+    unsigned _udpBusyPollMicroseconds;
+    unsigned _reorderWindowSize;
+    std::vector<unsigned> _vdifThreadIds;
+    unsigned _nrInputThreads;
+    unsigned _nrDecodeThreads;
+    unsigned _nrMark5BChannels, _nrMark5BBitsPerSample;
+    double   _pcapReplaySpeed;
 };
 
 
@@ -0,0 +1,454 @@
+#include "Common/Config.h"
+
+#include "ISBI/PcapReader.h"
+#include "Common/Stream/Descriptor.h"
+#include "Common/Stream/Stream.h"
+#include "Common/SystemCallException.h"
+#include "ISBI/VDIFStream.h"
+
+#include <algorithm>
+#include <byteswap.h>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+
+// the link types that carry IP packets, see https://www.tcpdump.org/linktypes.html
+enum LinkType {
+  ETHERNET	   = 1,
+  RAW_IP	   = 101,
+  LINUX_COOKED	   = 113,
+  LINUX_COOKED_V2  = 276
+};
+
+
+static uint16_t networkOrder16(const char *data)
+{
+  uint16_t value;
+  memcpy(&value, data, sizeof value);
+  return ntohs(value);
+}
+
+
+PcapReader::Pacer::Pacer(double speed)
+:
+  speed(speed),
+  started(false)
+{
+  if ((timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+    throw SystemCallException("timerfd_create");
+}
+
+
+PcapReader::Pacer::~Pacer()
+{
+  close(timerFd);
+}
+
+
+bool PcapReader::Pacer::isDue(int64_t captureTime)
+{
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+  if (!started) {
+    started = true;
+    firstCaptureTime = captureTime;
+    startTime = now;
+    return true;
+  }
+
+  std::chrono::steady_clock::time_point dueTime = startTime + std::chrono::nanoseconds(std::llround((captureTime - firstCaptureTime) / speed));
+
+  if (dueTime <= now)
+    return true;
+
+  // steady_clock is CLOCK_MONOTONIC; clear an earlier expiration first
+  int64_t	    nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(dueTime.time_since_epoch()).count();
+  struct itimerspec spec = {};
+  uint64_t	    nrExpirations;
+
+  spec.it_value.tv_sec  = nanoseconds / 1000000000;
+  spec.it_value.tv_nsec = nanoseconds % 1000000000;
+
+  if (::read(timerFd, &nrExpirations, sizeof nrExpirations) < 0 && errno != EAGAIN)
+    throw SystemCallException("read timerfd");
+
+  if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+    throw SystemCallException("timerfd_settime");
+
+  return false;
+}
+
+
+PcapReader::PcapReader(const std::string &fileName, double sampleRate, unsigned udpPort, Pacer *pacer)
+:
+  fileName(fileName),
+  samplesPerSecond(std::llround(sampleRate)),
+  udpPort(udpPort),
+  frameSize(0),
+  pacer(pacer),
+  pcapng(false),
+  swapped(false),
+  havePending(false),
+  nrPackets(0),
+  nrIgnored(0)
+{
+  int fd = open(fileName.c_str(), O_RDONLY);
+  struct stat stat;
+
+  if (fd < 0)
+    throw SystemCallException("open " + fileName);
+
+  if (fstat(fd, &stat) < 0) {
+    close(fd);
+    throw SystemCallException("fstat " + fileName);
+  }
+
+  fileSize = stat.st_size;
+  file = fileSize > 0 ? static_cast<const char *>(mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0)) : nullptr;
+  close(fd);
+
+  if (file == MAP_FAILED)
+    throw SystemCallException("mmap " + fileName);
+
+  madvise(const_cast<char *>(file), fileSize, MADV_SEQUENTIAL);
+
+  try {
+    parseFileHeader();
+
+    if (!(havePending = nextFrame(pending.frame, pending.timestamp, pending.captureTime)))
+      throw std::runtime_error("Could not find a VDIF frame in " + fileName);
+  } catch (...) {
+    munmap(const_cast<char *>(file), fileSize);
+    throw;
+  }
+
+  firstTimestamp = pending.timestamp;
+}
+
+
+PcapReader::~PcapReader()
+{
+  if (nrIgnored > 0)
+#pragma omp critical (clog)
+    std::clog << fileName << ": ignored " << nrIgnored << " of " << nrPackets << " packets" << std::endl;
+
+  munmap(const_cast<char *>(file), fileSize);
+}
+
+
+bool PcapReader::isPcapDescriptor(const std::string &descriptor)
+{
+  return descriptor.compare(0, 5, "pcap:") == 0;
+}
+
+
+void PcapReader::parseDescriptor(const std::string &descriptor, unsigned &udpPort, std::string &files)
+{
+  size_t colon = descriptor.find(':', 5);
+
+  if (colon != std::string::npos && colon > 5 && descriptor.find_first_not_of("0123456789", 5) == colon) {
+    udpPort = std::stoul(descriptor.substr(5, colon - 5));
+    files   = descriptor.substr(colon + 1);
+  } else {
+    udpPort = 0;
+    files   = descriptor.substr(5);
+  }
+
+  if (udpPort > 65535 || files.empty())
+    throw BadDescriptor(descriptor);
+}
+
+
+uint16_t PcapReader::get16(const char *data) const
+{
+  uint16_t value;
+  memcpy(&value, data, sizeof value);
+  return swapped ? bswap_16(value) : value;
+}
+
+
+uint32_t PcapReader::get32(const char *data) const
+{
+  uint32_t value;
+  memcpy(&value, data, sizeof value);
+  return swapped ? bswap_32(value) : value;
+}
+
+
+void PcapReader::parseFileHeader()
+{
+  uint32_t magic;
+
+  if (fileSize < 24)
+    throw std::runtime_error(fileName + " is not a pcap file");
+
+  memcpy(&magic, file, sizeof magic);
+
+  switch (magic) {
+    case 0xA1B2C3D4 :
+    case 0xD4C3B2A1 : interfaces = { Interface { 0, 1000000 } };
+		      break;
+
+    case 0xA1B23C4D :
+    case 0x4D3CB2A1 : interfaces = { Interface { 0, 1000000000 } };
+		      break;
+
+    case 0x0A0D0D0A : pcapng = true; // the section header is read as any block
+		      position = 0;
+		      return;
+
+    default :	      throw std::runtime_error(fileName + " is not a pcap file");
+  }
+
+  swapped = magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1;
+  interfaces[0].linkType = get32(file + 20) & 0xFFFF; // the upper bits describe the frame check sequence
+  position = 24;
+}
+
+
+void PcapReader::parseInterface(const char *block, size_t size)
+{
+  Interface interface { get16(block + 8), 1000000 };
+
+  // options are (code, length, value) triples, padded to 32 bits
+  for (size_t offset = 16; offset + 4 <= size - 4;) {
+    uint16_t code = get16(block + offset), length = get16(block + offset + 2);
+
+    if (code == 0 || offset + 4 + length > size - 4)
+      break;
+
+    if (code == 9 && length >= 1) { // if_tsresol: a negative power of 10, or of 2 if the top bit is set
+      uint8_t resolution = block[offset + 4];
+
+      if (resolution & 0x80)
+	interface.tsUnitsPerSecond = (int64_t) 1 << std::min(resolution & 0x7F, 62);
+      else
+	for (interface.tsUnitsPerSecond = 1; resolution > 0 && interface.tsUnitsPerSecond <= 100000000000000000; resolution --)
+	  interface.tsUnitsPerSecond *= 10;
+    }
+
+    offset += 4 + (length + 3) / 4 * 4;
+  }
+
+  interfaces.push_back(interface);
+}
+
+
+bool PcapReader::nextPacket(const char *&data, size_t &size, uint16_t &linkType, int64_t &captureTime)
+{
+  // a record cut off at the end of the file ends the capture
+  for (;;) {
+    if (!pcapng) {
+      if (position + 16 > fileSize)
+	return false;
+
+      const char *record = file + position;
+      uint32_t	 capturedLength = get32(record + 8);
+
+      if (position + 16 + capturedLength > fileSize)
+	return false;
+
+      data	  = record + 16;
+      size	  = capturedLength;
+      linkType	  = interfaces[0].linkType;
+      captureTime = get32(record) * (int64_t) 1000000000 + get32(record + 4) * (1000000000 / interfaces[0].tsUnitsPerSecond);
+      position	 += 16 + capturedLength;
+      return true;
+    }
+
+    if (position + 12 > fileSize)
+      return false;
+
+    const char *block = file + position;
+    uint32_t   type, length;
+
+    memcpy(&type, block, sizeof type); // reads the same in both byte orders if it is a section header
+
+    if (type == 0x0A0D0D0A) {
+      uint32_t byteOrderMagic;
+      memcpy(&byteOrderMagic, block + 8, sizeof byteOrderMagic);
+
+      if (byteOrderMagic != 0x1A2B3C4D && byteOrderMagic != 0x4D3C2B1A)
+	throw std::runtime_error(fileName + ": corrupt pcapng section header");
+
+      swapped = byteOrderMagic == 0x4D3C2B1A;
+      interfaces.clear();
+    }
+
+    type = get32(block);
+    length = get32(block + 4);
+
+    if (length < 12 || length % 4 != 0 || position + length > fileSize)
+      return false;
+
+    position += length;
+
+    if (type == 1) {
+      parseInterface(block, length);
+    } else if (type == 6 && length >= 32) { // enhanced packet block
+      uint32_t interface = get32(block + 8), capturedLength = get32(block + 20);
+
+      if (interface < interfaces.size() && 28 + capturedLength <= length - 4) {
+	uint64_t timestamp = (uint64_t) get32(block + 12) << 32 | get32(block + 16);
+
+	data	    = block + 28;
+	size	    = capturedLength;
+	linkType    = interfaces[interface].linkType;
+	captureTime = (int64_t) ((__int128) timestamp * 1000000000 / interfaces[interface].tsUnitsPerSecond);
+	return true;
+      }
+    }
+  }
+}
+
+
+bool PcapReader::udpPayload(const char *data, size_t size, uint16_t linkType, const char *&payload, size_t &payloadSize) const
+{
+  uint16_t etherType;
+  size_t   offset;
+
+  switch (linkType) {
+    case ETHERNET :	   if (size < 14)
+			     return false;
+
+			   etherType = networkOrder16(data + 12);
+
+			   for (offset = 14; (etherType == 0x8100 || etherType == 0x88A8) && offset + 4 <= size; offset += 4) // VLAN tags
+			     etherType = networkOrder16(data + offset + 2);
+
+			   break;
+
+    case LINUX_COOKED :	   if (size < 16)
+			     return false;
+
+			   etherType = networkOrder16(data + 14);
+			   offset = 16;
+			   break;
+
+    case LINUX_COOKED_V2 : if (size < 20)
+			     return false;
+
+			   etherType = networkOrder16(data);
+			   offset = 20;
+			   break;
+
+    case RAW_IP :	   if (size < 1)
+			     return false;
+
+			   etherType = (data[0] >> 4 & 0xF) == 6 ? 0x86DD : 0x0800;
+			   offset = 0;
+			   break;
+
+    default :		   return false;
+  }
+
+  const char *ip = data + offset, *udp;
+  size_t     ipSize = size - offset, udpSize;
+
+  if (etherType == 0x0800) {
+    size_t headerSize = (ip[0] & 0xF) * 4;
+
+    // fragments cannot be reassembled without copying
+    if (ipSize < 20 || (ip[0] >> 4 & 0xF) != 4 || headerSize < 20 || ipSize < headerSize || ip[9] != IPPROTO_UDP || (networkOrder16(ip + 6) & 0x3FFF) != 0)
+      return false;
+
+    udp = ip + headerSize;
+    udpSize = ipSize - headerSize;
+  } else if (etherType == 0x86DD) {
+    if (ipSize < 40 || ip[6] != IPPROTO_UDP) // no extension headers
+      return false;
+
+    udp = ip + 40;
+    udpSize = ipSize - 40;
+  } else {
+    return false;
+  }
+
+  if (udpSize < 8 || (udpPort != 0 && networkOrder16(udp + 2) != udpPort))
+    return false;
+
+  uint16_t udpLength = networkOrder16(udp + 4); // not the captured size, which includes Ethernet padding
+
+  if (udpLength < 8 || udpLength > udpSize) // cut off by the snapshot length
+    return false;
+
+  payload = udp + 8;
+  payloadSize = udpLength - 8;
+  return true;
+}
+
+
+bool PcapReader::nextFrame(const char *&frame, int64_t &timestamp, int64_t &captureTime)
+{
+  const char *data, *payload;
+  size_t     size, payloadSize;
+  uint16_t   linkType;
+
+  while (nextPacket(data, size, linkType, captureTime)) {
+    ++ nrPackets;
+
+    if (udpPayload(data, size, linkType, payload, payloadSize) && payloadSize >= sizeof(VDIFHeader)) {
+      const VDIFHeader *header = reinterpret_cast<const VDIFHeader *>(payload);
+
+      // as VDIFReceiver accepts datagrams
+      if (VDIFStream::checkHeader(*header) == HeaderStatus::VALID && header->headerSize() + header->dataSize() == payloadSize && (frameSize == 0 || payloadSize == frameSize)) {
+	frameSize = payloadSize;
+	frame = payload;
+	timestamp = header->timestamp(samplesPerSecond, header->samplesPerFrame());
+	return true;
+      }
+    }
+
+    ++ nrIgnored;
+  }
+
+  return false;
+}
+
+
+unsigned PcapReader::read(const char *frames[], int64_t timestamps[], unsigned maxNrFrames)
+{
+  // a frame that is not due yet is kept for the next call
+  unsigned nrFrames = 0;
+
+  while (nrFrames < maxNrFrames) {
+    if (!havePending && !(havePending = nextFrame(pending.frame, pending.timestamp, pending.captureTime))) {
+      if (nrFrames == 0)
+	throw Stream::EndOfStreamException("PcapReader::read EOF reached");
+
+      break;
+    }
+
+    if (pacer != nullptr && !pacer->isDue(pending.captureTime))
+      break;
+
+    frames[nrFrames] = pending.frame;
+    timestamps[nrFrames ++] = pending.timestamp;
+    havePending = false;
+  }
+
+  return nrFrames;
+}
+
+
+void PcapReader::seek(int64_t timestamp)
+{
+  uint64_t nrSkipped = 0;
+
+  for (; havePending || (havePending = nextFrame(pending.frame, pending.timestamp, pending.captureTime)); havePending = false, nrSkipped ++)
+    if (pending.timestamp >= timestamp)
+      break;
+
+  if (nrSkipped > 0)
+    std::cout << "Skipped " << nrSkipped << " frames in " << fileName << std::endl;
+}
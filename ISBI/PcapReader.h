@@ -0,0 +1,107 @@
+#ifndef ISBI_PCAP_READER_H
+#define ISBI_PCAP_READER_H
+
+#include "ISBI/VDIFFrameSource.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Replays VDIF-over-UDP traffic from a pcap or pcapng capture, so that the
+// packet loss and reordering of a real link can be reproduced offline.  The
+// file is memory mapped, and the frames handed out point to the UDP payloads
+// in the mapping; nothing is copied.  Ethernet (with VLAN tags), Linux
+// cooked, and raw IP captures of IPv4 and IPv6 are understood; other
+// packets, fragments, and packets cut off by the snapshot length are
+// skipped.
+
+class PcapReader : public VDIFFrameSource
+{
+  public:
+    // Hands out each packet no earlier than its capture time, relative to
+    // the first packet, divided by speed.  One pacer is shared by the files
+    // of a capture sequence.  Replaces waiting for a socket by waiting for a
+    // timer: while no packet is due, read() returns 0, and fd() becomes
+    // readable when the next one is.
+    class Pacer
+    {
+      public:
+	Pacer(double speed);
+	~Pacer();
+
+	int fd() const { return timerFd; }
+
+      private:
+	friend class PcapReader;
+
+	bool isDue(int64_t captureTime); // in ns; if not, arms the timer
+
+	double				      speed;
+	int				      timerFd;
+	bool				      started;
+	int64_t				      firstCaptureTime;
+	std::chrono::steady_clock::time_point startTime;
+    };
+
+    // udpPort 0 accepts VDIF frames sent to any port; pacer nullptr replays
+    // as fast as possible
+    PcapReader(const std::string &fileName, double sampleRate, unsigned udpPort = 0, Pacer * = nullptr);
+    ~PcapReader();
+
+    // "pcap:" followed by an optional "<udp port>:" and a file name, glob
+    // pattern, or file list; stores the port and the rest
+    static bool isPcapDescriptor(const std::string &descriptor);
+    static void parseDescriptor(const std::string &descriptor, unsigned &udpPort, std::string &files);
+
+    // Returns 0 if a pacer holds back the next packet; throws an
+    // EndOfStreamException at the end of the capture.
+    unsigned read(const char *frames[], int64_t timestamps[], unsigned maxNrFrames) override;
+
+    // Skips the packets with earlier frames, up to the first later one.
+    void seek(int64_t timestamp) override;
+
+    int64_t getFirstTimestamp() const override { return firstTimestamp; }
+
+    struct Statistics {
+      uint64_t nrPackets, nrIgnored; // ignored: not (valid) VDIF over UDP
+    };
+
+    Statistics statistics() const { return Statistics { nrPackets, nrIgnored }; }
+
+  private:
+    struct Interface {
+      uint16_t linkType;
+      int64_t  tsUnitsPerSecond; // of the capture timestamps
+    };
+
+    uint16_t get16(const char *) const;
+    uint32_t get32(const char *) const;
+    void     parseFileHeader();
+    void     parseInterface(const char *block, size_t size);
+    bool     nextPacket(const char *&data, size_t &size, uint16_t &linkType, int64_t &captureTime); // advances position; false at the end
+    bool     udpPayload(const char *data, size_t size, uint16_t linkType, const char *&payload, size_t &payloadSize) const;
+    bool     nextFrame(const char *&frame, int64_t &timestamp, int64_t &captureTime); // the next valid VDIF frame
+
+    std::string		   fileName;
+    int64_t		   samplesPerSecond;
+    unsigned		   udpPort, frameSize; // frameSize of the first valid frame
+    Pacer		   *pacer;
+
+    const char		   *file;
+    size_t		   fileSize, position;
+    bool		   pcapng, swapped; // swapped: other byte order than ours
+    std::vector<Interface> interfaces; // of the current pcapng section; just one for pcap
+
+    struct {
+      const char	   *frame;
+      int64_t		   timestamp, captureTime;
+    }			   pending; // the next frame, if havePending
+    bool		   havePending;
+
+    int64_t		   firstTimestamp;
+    uint64_t		   nrPackets, nrIgnored;
+};
+
+#endif
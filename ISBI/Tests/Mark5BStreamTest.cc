@@ -0,0 +1,96 @@
+#include "Common/Config.h"
+
+#include "ISBI/Mark5BStream.h"
+#include "ISBI/VDIFStream.h"
+#include "ISBI/Tests/TestSupport.h"
+
+#include <iostream>
+#include <vector>
+
+
+static const unsigned nrFrames = 100, nrFramesPerSecond = 50, nrChannels = 16;
+static const double   sampleRate = nrFramesPerSecond * Mark5BStream::payloadSize * 8 / 2 / nrChannels;
+static const int64_t  mjd = 60000, secondOfDay = 43210; // 2023-02-25, 12:00:10
+
+
+static uint32_t bcd(unsigned value, unsigned nrDigits)
+{
+  uint32_t code = 0;
+
+  for (unsigned digit = 0; digit < nrDigits; digit ++, value /= 10)
+    code |= (value % 10) << (4 * digit);
+
+  return code;
+}
+
+
+// writes 2-bit Mark5B frames with garbage between two of them and a corrupt
+// sync word in another, and checks that the VDIF frames that come out are
+// consecutive, correctly timed, and carry the translated samples
+
+int main()
+{
+  TemporaryFile file("Mark5BStreamTest");
+
+  for (unsigned frame = 0; frame < nrFrames; frame ++) {
+    int64_t  second = secondOfDay + frame / nrFramesPerSecond;
+    uint32_t header[4] = { frame == 60 ? 0xABADDEEF : Mark5BStream::syncWord, frame % nrFramesPerSecond, bcd(mjd % 1000, 3) << 20 | bcd(second, 5), 0 };
+    std::vector<uint8_t> payload(Mark5BStream::payloadSize);
+
+    for (unsigned byte = 0; byte < payload.size(); byte ++)
+      payload[byte] = frame + byte;
+
+    file.write(header, sizeof header);
+    file.write(payload.data(), payload.size());
+
+    if (frame == 30)
+      file.write("garbage\xED\xDE", 9);
+  }
+
+  file.close();
+
+  Mark5BStream stream(file.name(), sampleRate, nrChannels, 2, (mjd - 40587) * 86400);
+
+  const unsigned samplesPerVDIFFrame = Mark5BStream::vdifPayloadSize * 8 / 2 / nrChannels;
+  const int8_t	 mark5BLevels[4] = { -1, 1, -3, 3 };
+  const char	 *frames[64];
+  int64_t	 timestamps[64];
+  unsigned	 nrVDIFFrames = 0;
+
+  if (stream.getFirstTimestamp() != ((mjd - 40587) * 86400 + secondOfDay) * (int64_t) sampleRate)
+    fail("wrong first timestamp", 0);
+
+  try {
+    for (;;) {
+      unsigned nrRead = stream.read(frames, timestamps, 64);
+
+      for (unsigned index = 0; index < nrRead; index ++, nrVDIFFrames ++) {
+	unsigned frame = nrVDIFFrames / 2 + (nrVDIFFrames >= 120); // frame 60 is lost
+	const VDIFHeader *header = reinterpret_cast<const VDIFHeader *>(frames[index]);
+
+	if (timestamps[index] != stream.getFirstTimestamp() + (int64_t) (2 * frame + nrVDIFFrames % 2) * samplesPerVDIFFrame || header->timestamp(sampleRate) != timestamps[index])
+	  fail("wrong timestamp", frame);
+
+	if (header->samplesPerFrame() != samplesPerVDIFFrame || header->numberOfChannels() != nrChannels)
+	  fail("wrong format", frame);
+
+	for (unsigned byte = 0; byte < Mark5BStream::vdifPayloadSize; byte ++) {
+	  uint8_t in = frame + byte + (nrVDIFFrames % 2) * Mark5BStream::vdifPayloadSize, out = frames[index][header->headerSize() + byte];
+
+	  for (unsigned sample = 0; sample < 4; sample ++)
+	    if (DECODER_LEVEL_2BIT[out >> (2 * sample) & 3] != mark5BLevels[in >> (2 * sample) & 3])
+	      fail("wrong sample", frame);
+	}
+      }
+    }
+  } catch (Stream::EndOfStreamException &) {
+  }
+
+  if (nrVDIFFrames != 2 * (nrFrames - 1) || stream.nrResyncs() != 2) {
+    std::cerr << "Test FAILED: " << nrVDIFFrames << " VDIF frames, " << stream.nrResyncs() << " resyncs" << std::endl;
+    return 1;
+  }
+
+  std::cout << "Test OK" << std::endl;
+  return 0;
+}
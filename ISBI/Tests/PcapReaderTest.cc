@@ -0,0 +1,241 @@
+#include "Common/Config.h"
+
+#include "ISBI/PcapReader.h"
+#include "ISBI/VDIFStream.h"
+#include "ISBI/Tests/TestSupport.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <poll.h>
+
+
+static const unsigned nrFrames = 100, frameSize = 1032, nrChannels = 4, samplesPerFrame = 1000 * 8 / 2 / nrChannels;
+static const double   sampleRate = 1000 * samplesPerFrame; // 1000 frames per second
+static const unsigned port = 4000;
+
+
+static void append(std::string &buffer, const void *data, size_t size)
+{
+  buffer.append(static_cast<const char *>(data), size);
+}
+
+
+static void append16(std::string &buffer, uint16_t value) { append(buffer, &value, sizeof value); }
+static void append32(std::string &buffer, uint32_t value) { append(buffer, &value, sizeof value); }
+
+
+// an Ethernet frame with a VLAN tag, carrying frame number nr to udpPort, or
+// (if fragment) the first fragment of a larger datagram
+static std::string ethernetFrame(unsigned nr, unsigned udpPort, bool fragment = false)
+{
+  std::vector<char> vdif(frameSize);
+  VDIFHeader	    &header = * reinterpret_cast<VDIFHeader *>(vdif.data());
+
+  header.sec_from_epoch = 1000;
+  header.dataframe_in_second = nr;
+  header.ref_epoch = 40;
+  header.dataframe_length = frameSize / 8;
+  header.log2_nchan = 2;
+  header.bits_per_sample = 1;
+
+  for (unsigned byte = 32; byte < frameSize; byte ++)
+    vdif[byte] = nr + byte;
+
+  std::string frame(12, '\x02'); // MAC addresses
+  append16(frame, htons(0x8100));
+  append16(frame, htons(42));
+  append16(frame, htons(0x0800));
+
+  uint8_t ip[20] = { 0x45, 0, 0, 0, 0, 0, 0, 0, 64, 17 };
+  * reinterpret_cast<uint16_t *>(&ip[2]) = htons(20 + 8 + frameSize);
+  * reinterpret_cast<uint16_t *>(&ip[6]) = htons(fragment ? 0x2000 : 0x4000); // more fragments, or don't fragment
+  append(frame, ip, sizeof ip);
+
+  append16(frame, htons(12345));
+  append16(frame, htons(udpPort));
+  append16(frame, htons(8 + frameSize));
+  append16(frame, 0);
+  append(frame, vdif.data(), frameSize);
+  return frame;
+}
+
+
+// the order of the packets in the capture: frames 10 and 11 are swapped,
+// and non-VDIF traffic, a fragment, and a cut-off frame are mixed in
+static std::vector<std::pair<std::string, unsigned>> packets()
+{
+  std::vector<std::pair<std::string, unsigned>> packets; // (packet, frame number)
+
+  for (unsigned nr = 0; nr < nrFrames; nr ++) {
+    unsigned frame = nr == 10 ? 11 : nr == 11 ? 10 : nr;
+    packets.emplace_back(ethernetFrame(frame, port), frame);
+
+    if (nr == 20)
+      packets.emplace_back(ethernetFrame(frame, port + 1), ~0U);
+
+    if (nr == 30)
+      packets.emplace_back(ethernetFrame(frame, port, true), ~0U);
+
+    if (nr == 40)
+      packets.emplace_back(ethernetFrame(frame, port).substr(0, 200), ~0U);
+  }
+
+  return packets;
+}
+
+
+static std::string pcapFile()
+{
+  std::string file;
+  append32(file, 0xA1B2C3D4);
+  append16(file, 2);
+  append16(file, 4);
+  append32(file, 0);
+  append32(file, 0);
+  append32(file, 65535);
+  append32(file, 1); // Ethernet
+
+  for (const std::pair<std::string, unsigned> &packet : packets()) {
+    append32(file, 1700000000);
+    append32(file, 0);
+    append32(file, packet.first.size());
+    append32(file, packet.first.size() + (packet.first.size() == 200 ? 1000 : 0));
+    file += packet.first;
+  }
+
+  return file;
+}
+
+
+static std::string pcapngFile()
+{
+  // a section header, an interface with nanosecond timestamps, and one
+  // enhanced packet block per packet, 1 ms apart
+  std::string file;
+  append32(file, 0x0A0D0D0A);
+  append32(file, 28);
+  append32(file, 0x1A2B3C4D);
+  append16(file, 1);
+  append16(file, 0);
+  append32(file, 0xFFFFFFFF);
+  append32(file, 0xFFFFFFFF);
+  append32(file, 28);
+
+  append32(file, 1);
+  append32(file, 28);
+  append16(file, 1); // Ethernet
+  append16(file, 0);
+  append32(file, 0);
+  append16(file, 9); // if_tsresol
+  append16(file, 1);
+  append32(file, 9); // 10^-9, padded
+  append32(file, 28);
+
+  uint64_t time = 1700000000000000000ULL;
+
+  for (const std::pair<std::string, unsigned> &packet : packets()) {
+    std::string data = packet.first + std::string((4 - packet.first.size() % 4) % 4, '\0');
+    append32(file, 6);
+    append32(file, 32 + data.size());
+    append32(file, 0);
+    append32(file, time >> 32);
+    append32(file, time);
+    append32(file, packet.first.size());
+    append32(file, packet.first.size());
+    file += data;
+    append32(file, 32 + data.size());
+
+    if (packet.second != ~0U)
+      time += 1000000;
+  }
+
+  return file;
+}
+
+
+// reads all frames, waiting for the pacer where it holds them back, and
+// checks that they come in capture order, intact
+static void check(PcapReader &reader, PcapReader::Pacer *pacer)
+{
+  const char *frames[16];
+  int64_t     timestamps[16];
+  unsigned    nrReceived = 0;
+
+  try {
+    for (;;) {
+      unsigned nrRead = reader.read(frames, timestamps, 16);
+
+      if (nrRead == 0) {
+	struct pollfd pollfd = { pacer != nullptr ? pacer->fd() : -1, POLLIN, 0 };
+
+	if (pacer == nullptr || poll(&pollfd, 1, 1000) != 1)
+	  fail("no frames due", nrReceived);
+      }
+
+      for (unsigned index = 0; index < nrRead; index ++, nrReceived ++) {
+	unsigned frame = nrReceived == 10 ? 11 : nrReceived == 11 ? 10 : nrReceived;
+
+	if (timestamps[index] != reader.getFirstTimestamp() + (int64_t) frame * samplesPerFrame)
+	  fail("wrong timestamp", frame);
+
+	for (unsigned byte = 32; byte < frameSize; byte ++)
+	  if (frames[index][byte] != (char) (frame + byte))
+	    fail("corrupt frame", frame);
+      }
+    }
+  } catch (Stream::EndOfStreamException &) {
+  }
+
+  if (nrReceived != nrFrames)
+    fail("missing frames", nrReceived);
+
+  if (reader.statistics().nrPackets != nrFrames + 3 || reader.statistics().nrIgnored != 3)
+    fail("wrong statistics", reader.statistics().nrIgnored);
+}
+
+
+int main()
+{
+  unsigned    udpPort;
+  std::string files;
+
+  PcapReader::parseDescriptor("pcap:4000:/data/*.pcap", udpPort, files);
+
+  if (udpPort != 4000 || files != "/data/*.pcap")
+    fail("wrong descriptor", udpPort);
+
+  TemporaryFile pcap("PcapReaderTest"), pcapng("PcapReaderTest");
+  std::string	pcapContents = pcapFile(), pcapngContents = pcapngFile();
+
+  pcap.write(pcapContents.data(), pcapContents.size());
+  pcap.close();
+  pcapng.write(pcapngContents.data(), pcapngContents.size());
+  pcapng.close();
+
+  {
+    PcapReader reader(pcap.name(), sampleRate, port);
+    check(reader, nullptr);
+  }
+
+  {
+    // 100 ms of capture, replayed at twice its speed
+    PcapReader::Pacer pacer(2);
+    PcapReader	      reader(pcapng.name(), sampleRate, port, &pacer);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    check(reader, &pacer);
+
+    double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (duration < .045 || duration > .5)
+      fail("wrong replay duration", duration * 1000);
+  }
+
+  std::cout << "Test OK" << std::endl;
+  return 0;
+}
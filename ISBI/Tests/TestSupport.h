@@ -0,0 +1,74 @@
+#ifndef ISBI_TESTS_TEST_SUPPORT_H
+#define ISBI_TESTS_TEST_SUPPORT_H
+
+// Helpers shared by the standalone tests, which print "Test OK" or
+// "Test FAILED" and exit nonzero on failure.
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <unistd.h>
+
+
+template <typename T> [[noreturn]] inline void fail(const char *message, const T &value)
+{
+  std::cerr << "Test FAILED: " << message << " (" << value << ')' << std::endl;
+  exit(1);
+}
+
+
+// a file in /tmp, removed when the test ends normally
+
+class TemporaryFile
+{
+  public:
+    TemporaryFile(const std::string &prefix);
+    ~TemporaryFile();
+
+    void write(const void *data, size_t size);
+    void close();
+
+    const char *name() const { return _name.c_str(); }
+
+  private:
+    std::string _name;
+    int		_fd;
+};
+
+
+inline TemporaryFile::TemporaryFile(const std::string &prefix)
+:
+  _name("/tmp/" + prefix + "XXXXXX")
+{
+  if ((_fd = mkstemp(&_name[0])) < 0) {
+    perror("mkstemp");
+    exit(1);
+  }
+}
+
+
+inline TemporaryFile::~TemporaryFile()
+{
+  close();
+  unlink(_name.c_str());
+}
+
+
+inline void TemporaryFile::write(const void *data, size_t size)
+{
+  if (::write(_fd, data, size) != (ssize_t) size)
+    fail("cannot write", _name);
+}
+
+
+inline void TemporaryFile::close()
+{
+  if (_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+}
+
+#endif
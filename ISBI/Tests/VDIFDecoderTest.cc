@@ -0,0 +1,216 @@
+#include "Common/Config.h"
+
+#include "ISBI/VDIFDecoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+
+// compares each decoder that the CPU supports against the reference levels,
+// for all byte values and payload sizes that exercise the vector tails
+
+static void check(const char *name, void (*decode)(const uint8_t *__restrict, size_t, int8_t *__restrict))
+{
+  std::mt19937 generator(12345);
+
+  for (size_t nrBytes : { 0, 1, 3, 31, 32, 33, 63, 64, 65, 256, 1000, 8000 }) {
+    std::vector<uint8_t> in(nrBytes);
+
+    for (size_t i = 0; i < nrBytes; i ++)
+      in[i] = nrBytes >= 256 && i < 256 ? i : generator();
+
+    std::vector<int8_t> out(4 * nrBytes + 1, 0x55);
+    decode(in.data(), nrBytes, out.data());
+
+    for (size_t sample = 0; sample < 4 * nrBytes; sample ++)
+      if (out[sample] != DECODER_LEVEL_2BIT[(in[sample / 4] >> (2 * (sample % 4))) & 0x3]) {
+	std::cerr << "Test FAILED: " << name << " decoder, " << nrBytes << " bytes, sample " << sample << std::endl;
+	exit(1);
+      }
+
+    if (out[4 * nrBytes] != 0x55) {
+      std::cerr << "Test FAILED: " << name << " decoder writes beyond " << nrBytes << " bytes" << std::endl;
+      exit(1);
+    }
+  }
+
+  std::cout << "Test OK: " << name << " decoder" << std::endl;
+}
+
+
+// packs random levels at random offsets and checks that they unpack to the
+// same values, without touching neighbouring samples
+
+static void checkPacking(unsigned nrBits)
+{
+  std::mt19937 generator(54321);
+  std::vector<uint8_t> row(1024);
+
+  for (unsigned trial = 0; trial < 1000; trial ++) {
+    for (uint8_t &byte : row)
+      byte = generator();
+
+    const std::vector<uint8_t> before(row);
+    size_t nrSamplesInRow = row.size() * 8 / nrBits;
+    size_t firstSample = generator() % nrSamplesInRow;
+    size_t nrSamples = generator() % (nrSamplesInRow - firstSample + 1);
+    std::vector<int8_t> samples(nrSamples), unpacked(nrSamplesInRow), original(nrSamplesInRow);
+
+    for (int8_t &sample : samples)
+      sample = nrBits == 2 ? DECODER_LEVEL_2BIT[generator() % 4] : (int) (generator() % 16) - 8;
+
+    unpackSamples(original.data(), before.data(), 0, nrSamplesInRow, nrBits);
+    packSamples(row.data(), firstSample, samples.data(), nrSamples, nrBits);
+    unpackSamples(unpacked.data(), row.data(), 0, nrSamplesInRow, nrBits);
+
+    for (size_t sample = 0; sample < nrSamplesInRow; sample ++)
+      if (unpacked[sample] != (sample >= firstSample && sample < firstSample + nrSamples ? samples[sample - firstSample] : original[sample])) {
+	std::cerr << "Test FAILED: " << nrBits << "-bit packing, sample " << sample << std::endl;
+	exit(1);
+      }
+
+    unpackSamples(unpacked.data(), row.data(), firstSample, nrSamples, nrBits);
+
+    if (!std::equal(samples.begin(), samples.end(), unpacked.begin())) {
+      std::cerr << "Test FAILED: " << nrBits << "-bit unpacking at offset " << firstSample << std::endl;
+      exit(1);
+    }
+  }
+
+  std::cout << "Test OK: " << nrBits << "-bit packing" << std::endl;
+}
+
+
+// 8-bit samples packed into 4 bits saturate, rather than wrap
+
+static void checkPackingSaturates()
+{
+  std::vector<int8_t> samples(256), unpacked(256);
+  std::vector<uint8_t> row(128);
+
+  for (unsigned sample = 0; sample < samples.size(); sample ++)
+    samples[sample] = (int8_t) sample;
+
+  packSamples(row.data(), 0, samples.data(), samples.size(), 4);
+  unpackSamples(unpacked.data(), row.data(), 0, samples.size(), 4);
+
+  for (unsigned sample = 0; sample < samples.size(); sample ++)
+    if (unpacked[sample] != std::min(std::max(samples[sample], (int8_t) -8), (int8_t) 7)) {
+      std::cerr << "Test FAILED: 4-bit packing of " << (int) samples[sample] << " gives " << (int) unpacked[sample] << std::endl;
+      exit(1);
+    }
+
+  std::cout << "Test OK: 4-bit packing saturates" << std::endl;
+}
+
+
+// compares the specialized and generic channel decoders against a direct
+// extraction of each sample from the payload
+
+static int8_t referenceSample(const std::vector<uint8_t> &payload, size_t sample, unsigned nrBits)
+{
+  if (sample * nrBits / 8 >= payload.size())
+    return 0;
+
+  unsigned code = payload[sample * nrBits / 8] >> (sample * nrBits % 8) & ((1 << nrBits) - 1);
+
+  switch (nrBits) {
+    case 1  : return code ? 1 : -1;
+    case 2  : return DECODER_LEVEL_2BIT[code];
+    default : return code - (1 << (nrBits - 1));
+  }
+}
+
+
+static void checkChannelDecoder(unsigned nrBits, unsigned nrChannels)
+{
+  std::mt19937 generator(nrBits * 100 + nrChannels);
+  std::vector<uint8_t> payload(8000);
+
+  for (uint8_t &byte : payload)
+    byte = generator();
+
+  const unsigned maxNrTimes = 64, nrOutputs = 5;
+  const size_t nrTimesInPayload = payload.size() * 8 / nrBits / nrChannels;
+  VDIFDecoder decoder(nrBits, nrChannels, maxNrTimes);
+
+  for (unsigned trial = 0; trial < 1000; trial ++) {
+    unsigned firstTime = generator() % (nrTimesInPayload + 10); // sometimes beyond the payload
+    unsigned nrTimes = generator() % (maxNrTimes + 1);
+    uint32_t channels[nrOutputs];
+    std::vector<int8_t> outputBuffers[nrOutputs];
+    int8_t *outputs[nrOutputs];
+
+    for (unsigned output = 0; output < nrOutputs; output ++) {
+      channels[output] = generator() % (nrChannels + 1); // sometimes a non-existing channel
+      outputBuffers[output].assign(nrTimes, 0x55);
+      outputs[output] = outputBuffers[output].data();
+    }
+
+    decoder.decode(payload.data(), payload.size(), firstTime, nrTimes, channels, outputs, nrOutputs);
+
+    for (unsigned output = 0; output < nrOutputs; output ++)
+      for (unsigned time = 0; time < nrTimes; time ++)
+	if (outputs[output][time] != (channels[output] < nrChannels ? referenceSample(payload, (size_t) (firstTime + time) * nrChannels + channels[output], nrBits) : 0)) {
+	  std::cerr << "Test FAILED: " << decoder.name() << " decoder, time " << firstTime + time << ", channel " << channels[output] << std::endl;
+	  exit(1);
+	}
+  }
+
+  std::cout << "Test OK: " << decoder.name() << " decoder" << std::endl;
+}
+
+
+// counts the states, zeros, and power of a known mix of levels, across the
+// blocks in which SampleStatistics::add() sums
+
+static void checkSampleStatistics()
+{
+  std::vector<int8_t> samples;
+
+  for (unsigned i = 0; i < 100000; i ++)
+    samples.push_back(i % 10 == 0 ? 0 : DECODER_LEVEL_2BIT[i % 10 < 3 ? 0 : i % 10 < 6 ? 1 : i % 10 < 8 ? 2 : 3]);
+
+  SampleStatistics statistics = SampleStatistics(), sum = SampleStatistics();
+  statistics.add(samples.data(), 70000);
+  sum.add(samples.data() + 70000, 30000);
+  sum += statistics;
+
+  if (sum.nrSamples != 100000 || sum.nrZeros != 10000 || sum.stateCounts[0] != 20000 || sum.stateCounts[1] != 30000 || sum.stateCounts[2] != 20000 || sum.stateCounts[3] != 20000 || sum.sumOfSquares != 40000 * 9 + 50000) {
+    std::cerr << "Test FAILED: sample statistics" << std::endl;
+    exit(1);
+  }
+
+  std::cout << "Test OK: sample statistics" << std::endl;
+}
+
+
+int main()
+{
+  check("scalar", decode2bitScalar);
+
+#if defined __x86_64__
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    check("AVX2", decode2bitAVX2);
+
+  if (__builtin_cpu_supports("avx512bw"))
+    check("AVX-512", decode2bitAVX512);
+#endif
+
+  check(decode2bitImplementation(), decode2bit);
+
+  for (unsigned nrBits : { 1, 2, 4, 8 })
+    for (unsigned nrChannels : { 1, 2, 4, 8, 16, 32, 64 })
+      checkChannelDecoder(nrBits, nrChannels);
+
+  checkPacking(2);
+  checkPacking(4);
+  checkPackingSaturates();
+  checkSampleStatistics();
+  return 0;
+}
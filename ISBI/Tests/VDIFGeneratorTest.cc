@@ -0,0 +1,175 @@
+#include "Common/Config.h"
+
+#include "ISBI/VDIFGenerator.h"
+#include "ISBI/VDIFStream.h"
+#include "ISBI/Tests/TestSupport.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <vector>
+
+
+static const int64_t startSecond = 1700000000;
+
+
+// without noise, the samples of a delayed station are those of the
+// reference station, shifted by the delay
+static void testDelays()
+{
+  VDIFGenerator::Format format { 256000, 4, 8, 1024 }; // 256 samples per frame, 1000 frames per second
+  VDIFGenerator		generator(2, format, startSecond, 1);
+  const unsigned	delay = 5, nrFrames = 10, frameSize = generator.frameSize();
+
+  generator.setDelays({ { { 0, 1e-3 } }, { { 0, 1e-3 + delay / format.sampleRate } } });
+
+  std::vector<char> frames[2];
+
+  for (unsigned station = 0; station < 2; station ++) {
+    frames[station].resize(nrFrames * frameSize);
+
+    if (generator.generate(station, 0, nrFrames, frames[station].data()) != nrFrames)
+      fail("lost frames", station);
+  }
+
+  for (unsigned time = delay; time < nrFrames * generator.samplesPerFrame(); time ++)
+    for (unsigned channel = 0; channel < format.nrChannels; channel ++) {
+      auto sample = [&] (unsigned station, unsigned time) {
+	return frames[station][time / 256 * frameSize + 32 + time % 256 * format.nrChannels + channel];
+      };
+
+      if (sample(1, time) != sample(0, time - delay))
+	fail("wrong delay at time", time);
+    }
+}
+
+
+// 2-bit samples hit the four levels about as often as Gaussian noise
+// quantized at +/- 1 sigma does, and stations are correlated
+static void testStatistics()
+{
+  VDIFGenerator::Format format { 8e6, 16, 2, 8000 };
+  VDIFGenerator		generator(2, format, startSecond, .5, 42);
+  const unsigned	nrFrames = 16, frameSize = generator.frameSize();
+  std::vector<char>	frames[2];
+  const double		levels[4] = { -3.3359, -1, 1, 3.3359 };
+  double		counts[4] = { 0, 0, 0, 0 }, sum = 0, sum0 = 0, sum1 = 0;
+
+  for (unsigned station = 0; station < 2; station ++) {
+    frames[station].resize(nrFrames * frameSize);
+    generator.generate(station, 0, nrFrames, frames[station].data());
+  }
+
+  for (unsigned frame = 0; frame < nrFrames; frame ++)
+    for (unsigned byte = 32; byte < frameSize; byte ++)
+      for (unsigned sample = 0; sample < 4; sample ++) {
+	unsigned code0 = frames[0][frame * frameSize + byte] >> (2 * sample) & 3, code1 = frames[1][frame * frameSize + byte] >> (2 * sample) & 3;
+
+	counts[code0] ++;
+	sum  += levels[code0] * levels[code1];
+	sum0 += levels[code0] * levels[code0];
+	sum1 += levels[code1] * levels[code1];
+      }
+
+  double nrSamples = counts[0] + counts[1] + counts[2] + counts[3];
+
+  if (std::abs(counts[0] / nrSamples - .1587) > .01 || std::abs(counts[1] / nrSamples - .3413) > .01)
+    fail("wrong level occupation", counts[0] / nrSamples);
+
+  if (std::abs(sum / std::sqrt(sum0 * sum1) - .44) > .05) // .5, minus the quantization loss
+    fail("wrong correlation", sum / std::sqrt(sum0 * sum1));
+}
+
+
+// the generated frames are valid, except those with fill pattern, and about
+// the requested fractions are lost, invalid, and out of order; the same
+// seed gives the same frames
+static void testImpairments()
+{
+  VDIFGenerator::Format format { 256000, 4, 2, 256 };
+  VDIFGenerator		generator(1, format, startSecond, .1, 7);
+  const unsigned	nrFrames = 20000, frameSize = generator.frameSize();
+
+  generator.setImpairments(VDIFGenerator::Impairments { .1, .1, .05, 4 });
+
+  std::vector<char> frames(nrFrames * frameSize), again(nrFrames * frameSize);
+  unsigned	    nrSent = generator.generate(0, 0, nrFrames, frames.data()), nrInvalid = 0, nrOutOfOrder = 0;
+  std::set<int64_t> timestamps;
+  int64_t	    previous = 0;
+
+  if (generator.generate(0, 0, nrFrames, again.data()) != nrSent || memcmp(frames.data(), again.data(), nrSent * frameSize) != 0)
+    fail("not reproducible", nrSent);
+
+  for (unsigned frame = 0; frame < nrSent; frame ++) {
+    const VDIFHeader &header = * reinterpret_cast<const VDIFHeader *>(&frames[frame * frameSize]);
+
+    if (VDIFStream::checkHeader(header) != HeaderStatus::VALID) {
+      nrInvalid ++;
+      continue;
+    }
+
+    int64_t timestamp = header.timestamp(format.sampleRate);
+
+    if (header.headerSize() + header.dataSize() != frameSize || header.samplesPerFrame() != generator.samplesPerFrame() || timestamp < startSecond * 256000 || timestamp >= (startSecond + nrFrames / 1000) * 256000 || timestamp % 256 != 0)
+      fail("wrong header", frame);
+
+    if (!timestamps.insert(timestamp).second)
+      fail("duplicate frame", frame);
+
+    nrOutOfOrder += timestamp < previous;
+    previous = timestamp;
+  }
+
+  if (std::abs(nrSent - .9 * nrFrames) > .01 * nrFrames)
+    fail("wrong loss fraction", 1 - (double) nrSent / nrFrames);
+
+  if (std::abs(nrInvalid - .05 * nrSent) > .01 * nrSent)
+    fail("wrong invalid fraction", (double) nrInvalid / nrSent);
+
+  if (nrOutOfOrder < .05 * nrSent || nrOutOfOrder > .15 * nrSent)
+    fail("wrong reorder fraction", (double) nrOutOfOrder / nrSent);
+}
+
+
+// the delay tables are read as the correlator stores them
+static void testReadDelays()
+{
+  TemporaryFile file("VDIFGeneratorTest");
+
+  file.close();
+
+  {
+    std::ofstream config(file.name(), std::ios::binary);
+
+    for (uint32_t station = 0, n = 2; station < 2; station ++) {
+      config.write(reinterpret_cast<const char *>(&n), sizeof n);
+
+      for (int64_t time = 0; time < 2; time ++) {
+	double delay = station * 1e-6 + time * 1e-9;
+	int64_t key = time * 1000000;
+
+	config.write(reinterpret_cast<const char *>(&key), sizeof key);
+	config.write(reinterpret_cast<const char *>(&delay), sizeof delay);
+      }
+    }
+  }
+
+  std::vector<std::map<int64_t, double>> delays = VDIFGenerator::readDelays(file.name(), 2);
+
+  if (delays.size() != 2 || delays[1].size() != 2 || delays[1][1000000] != 1e-6 + 1e-9)
+    fail("wrong delays", delays.size());
+}
+
+
+int main()
+{
+  testDelays();
+  testStatistics();
+  testImpairments();
+  testReadDelays();
+
+  std::cout << "Test OK" << std::endl;
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include "Common/Config.h"
+
+#include "ISBI/VDIFReorderWindow.h"
+#include "ISBI/VDIFStream.h"
+#include "ISBI/Tests/TestSupport.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+
+static const unsigned frameSize = 64, timeStep = 100, nrFrames = 1000, batchSize = 16, windowSize = 8;
+
+
+// sends frames locally shuffled, with duplicates and one lost frame, in
+// batches through a reused buffer (as the readers do), and checks that they
+// come out in order, intact, and once; and that oversized frames are dropped
+
+int main()
+{
+  std::mt19937	       generator(1234);
+  std::vector<int64_t> order;
+
+  for (unsigned frame = 0; frame < nrFrames; frame ++)
+    if (frame != 500) // lost
+      order.push_back(frame * timeStep);
+
+  for (unsigned frame = 0; frame + 4 < order.size(); frame += 5)
+    std::swap(order[frame], order[frame + generator() % 5]);
+
+  order.insert(order.begin() + 300, order[290]);
+
+  VDIFReorderWindow    window(windowSize, batchSize, frameSize);
+  std::vector<char>    buffer(batchSize * frameSize);
+  const char	       *frames[batchSize];
+  int64_t	       timestamps[batchSize], expected = 0;
+  unsigned	       nrReceived = 0;
+
+  auto check = [&] (unsigned nrReady) {
+    for (unsigned frame = 0; frame < nrReady; frame ++) {
+      int64_t timestamp = window.timestamps()[frame];
+
+      if (expected == 500 * timeStep)
+	expected += timeStep; // the lost frame
+
+      if (timestamp != expected)
+	fail("out of order", timestamp);
+
+      if (memcmp(window.frames()[frame] + sizeof(VDIFHeader), &timestamp, sizeof timestamp) != 0)
+	fail("corrupt frame", timestamp);
+
+      expected += timeStep;
+      ++ nrReceived;
+    }
+  };
+
+  for (unsigned first = 0; first < order.size(); first += batchSize) {
+    unsigned nrInBatch = std::min((unsigned) order.size() - first, batchSize);
+
+    std::fill(buffer.begin(), buffer.end(), 0x55);
+
+    for (unsigned frame = 0; frame < nrInBatch; frame ++) {
+      VDIFHeader *header = reinterpret_cast<VDIFHeader *>(&buffer[frame * frameSize]);
+
+      memset(header, 0, sizeof(VDIFHeader));
+      header->dataframe_length = frameSize / 8;
+      memcpy(header + 1, &order[first + frame], sizeof(int64_t));
+      frames[frame] = &buffer[frame * frameSize];
+      timestamps[frame] = order[first + frame];
+    }
+
+    check(window.add(frames, timestamps, nrInBatch, timeStep));
+  }
+
+  check(window.add(frames, timestamps, 0, timeStep));
+
+  VDIFReorderWindow::Statistics statistics = window.statistics();
+
+  if (nrReceived != nrFrames - 1 || statistics.nrDuplicates + statistics.nrLate != 1 || statistics.nrReordered == 0) {
+    std::cerr << "Test FAILED: received " << nrReceived << ", " << statistics.nrReordered << " reordered, " << statistics.nrLate << " late, " << statistics.nrDuplicates << " duplicate" << std::endl;
+    return 1;
+  }
+
+  // a frame that does not fit in a slot is dropped, not copied
+  VDIFReorderWindow oversizedWindow(windowSize, batchSize, frameSize);
+  VDIFHeader	    *header = reinterpret_cast<VDIFHeader *>(buffer.data());
+
+  memset(header, 0, sizeof(VDIFHeader));
+  header->dataframe_length = 2 * frameSize / 8;
+  frames[0] = buffer.data();
+  timestamps[0] = 0;
+
+  if (oversizedWindow.add(frames, timestamps, 1, timeStep) != 0 || oversizedWindow.statistics().nrOversized != 1) {
+    std::cerr << "Test FAILED: oversized frame not dropped" << std::endl;
+    return 1;
+  }
+
+  std::cout << "Test OK" << std::endl;
+  return 0;
+}
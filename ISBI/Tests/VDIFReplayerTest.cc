@@ -0,0 +1,109 @@
+#include "Common/Config.h"
+
+#include "ISBI/VDIFReceiver.h"
+#include "ISBI/VDIFReplayer.h"
+#include "ISBI/VDIFStream.h"
+#include "ISBI/Tests/TestSupport.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+
+
+static const unsigned nrFrames = 50, frameSize = 288, samplesPerFrame = 256 * 8 / 2 / 4, nrLoops = 2;
+static const double   sampleRate = 1000 * samplesPerFrame; // 1000 frames per second
+static const int64_t  recordedSecond = 1000000000;
+
+
+// replays a 50 ms recording twice over UDP loopback, and checks that every
+// frame arrives intact, re-stamped to the current time, and not before it
+// was due
+
+int main()
+{
+  TemporaryFile file("VDIFReplayerTest");
+
+  std::vector<char> frame(frameSize);
+  VDIFHeader	    &header = * reinterpret_cast<VDIFHeader *>(frame.data());
+
+  for (unsigned nr = 0; nr < nrFrames; nr ++) {
+    memset(frame.data(), 0, frameSize);
+    header.sec_from_epoch = recordedSecond - VDIFHeader::epochStarts[40];
+    header.dataframe_in_second = 500 + nr;
+    header.ref_epoch = 40;
+    header.dataframe_length = frameSize / 8;
+    header.log2_nchan = 2;
+    header.bits_per_sample = 1;
+
+    for (unsigned byte = 32; byte < frameSize; byte ++)
+      frame[byte] = nr * 7 + byte;
+
+    file.write(frame.data(), frameSize);
+  }
+
+  file.close();
+
+  VDIFReceiver	    receiver("udp:127.0.0.1:4300", sampleRate, 64, 9000);
+  int64_t	    startSecond = time(nullptr) + 1;
+  VDIFReplayer	    replayer([&file] () { return new VDIFStream(file.name(), sampleRate); }, "udp:127.0.0.1:4300", sampleRate, startSecond, nrLoops);
+  std::atomic<bool> stop(false);
+  std::thread	    thread([&] () { replayer.replay(stop); });
+
+  const char *frames[64];
+  int64_t     timestamps[64];
+  unsigned    nrReceived = 0;
+
+  while (nrReceived < nrLoops * nrFrames) {
+    unsigned nrRead = receiver.read(frames, timestamps, 64);
+
+    if (nrRead == 0 && time(nullptr) > startSecond + nrLoops + 2)
+      fail("timeout", nrReceived);
+
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    for (unsigned index = 0; index < nrRead; index ++, nrReceived ++) {
+      unsigned nr = nrReceived % nrFrames, loop = nrReceived / nrFrames;
+      int64_t  expected = (startSecond + loop) * (int64_t) sampleRate + (500 + nr) * samplesPerFrame;
+
+      if (timestamps[index] != expected)
+	fail("wrong timestamp", nrReceived);
+
+      if ((double) now < (expected + samplesPerFrame) / sampleRate * 1e9)
+	fail("sent too early", nrReceived);
+
+      for (unsigned byte = 32; byte < frameSize; byte ++)
+	if (frames[index][byte] != (char) (nr * 7 + byte))
+	  fail("corrupt frame", nrReceived);
+    }
+  }
+
+  thread.join();
+
+  if (replayer.statistics().nrSent != nrLoops * nrFrames)
+    fail("wrong statistics", replayer.statistics().nrSent);
+
+  // once idle, the poll descriptor also becomes readable when the idle
+  // timer expires
+  receiver.setNonBlocking();
+  receiver.startIdleTimer(.02);
+
+  struct pollfd pfd = { receiver.fd(), POLLIN, 0 };
+
+  if (receiver.read(frames, timestamps, 64) != 0 || receiver.idleTimerExpired())
+    fail("idle timer expired early", 0);
+
+  if (poll(&pfd, 1, 1000) != 1 || !receiver.idleTimerExpired())
+    fail("idle timer did not expire", 0);
+
+  if (receiver.idleTimerExpired() || poll(&pfd, 1, 0) != 0)
+    fail("idle timer expired twice", 0);
+
+  std::cout << "Test OK" << std::endl;
+  return 0;
+}
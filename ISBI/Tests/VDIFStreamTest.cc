@@ -0,0 +1,99 @@
+#include "Common/Config.h"
+
+#include "ISBI/VDIFIndex.h"
+#include "ISBI/VDIFStream.h"
+#include "ISBI/Tests/TestSupport.h"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+
+static const unsigned nrFrames = 1000, frameSize = 8032, samplesPerFrame = 8000 * 8 / 2 / 16;
+static const double   sampleRate = 4000 * samplesPerFrame;
+
+
+// writes a file in which one frame is truncated, garbage follows another,
+// and one is replaced by fill pattern, and checks that the stream resyncs
+// and returns every other frame, with all its payload
+
+int main()
+{
+  TemporaryFile file("VDIFStreamTest");
+
+  std::vector<char> frame(frameSize);
+  VDIFHeader	    &header = * reinterpret_cast<VDIFHeader *>(frame.data());
+
+  for (unsigned nr = 0; nr < nrFrames; nr ++) {
+    memset(frame.data(), 0, frameSize);
+    header.sec_from_epoch = 1000 + nr / 4000;
+    header.dataframe_in_second = nr % 4000;
+    header.ref_epoch = 40;
+    header.dataframe_length = frameSize / 8;
+    header.log2_nchan = 4;
+    header.bits_per_sample = 1;
+
+    for (unsigned byte = 32; byte < frameSize; byte ++)
+      frame[byte] = nr * 7 + byte;
+
+    if (nr == 300)
+      for (unsigned word = 0; word < 8; word ++)
+	reinterpret_cast<uint32_t *>(frame.data())[word] = 0x11223344;
+
+    file.write(frame.data(), nr == 100 ? 3000 : frameSize);
+
+    if (nr == 200)
+      file.write("garbage", 7);
+  }
+
+  file.close();
+
+  for (unsigned nrAsyncReads = 0; nrAsyncReads <= 2; nrAsyncReads += 2) {
+    VDIFStream stream(file.name(), sampleRate, nrAsyncReads, 1 << 20);
+    const char *frames[64];
+    int64_t	timestamps[64];
+    unsigned	expected = 0, nrReceived = 0;
+
+    try {
+      for (;;) {
+	unsigned nrRead = stream.read(frames, timestamps, 64);
+
+	for (unsigned index = 0; index < nrRead; index ++, expected ++, nrReceived ++) {
+	  if (expected == 100 || expected == 300)
+	    expected ++; // truncated, fill pattern
+
+	  if (timestamps[index] != stream.getFirstTimestamp() + (int64_t) expected * samplesPerFrame)
+	    fail("wrong timestamp", expected);
+
+	  for (unsigned byte = 32; byte < frameSize; byte ++)
+	    if (frames[index][byte] != (char) (expected * 7 + byte))
+	      fail("corrupt frame", expected);
+	}
+      }
+    } catch (Stream::EndOfStreamException &) {
+    }
+
+    if (nrReceived != nrFrames - 2)
+      fail("missing frames", nrReceived);
+  }
+
+  // the index resyncs the same way, so that each defect is one short run
+  {
+    VDIFIndex index(file.name());
+    const int64_t runOffsets[3] = { 100 * frameSize, 201 * frameSize - (frameSize - 3000), 300 * frameSize - (frameSize - 3000) + 7 };
+
+    if (index.frameSize() != frameSize || index.seconds().size() != 1 || index.seconds()[0].offset != 0)
+      fail("wrong index", 0);
+
+    if (index.invalidRuns().size() != 3)
+      fail("wrong number of invalid runs", index.invalidRuns().size());
+
+    for (unsigned run = 0; run < 3; run ++)
+      if (index.invalidRuns()[run].offset != runOffsets[run] || index.invalidRuns()[run].nrFrames != 1)
+	fail("wrong invalid run", run);
+  }
+
+  unlink(VDIFIndex::sidecarName(file.name()).c_str());
+  std::cout << "Test OK" << std::endl;
+  return 0;
+}
@@ -0,0 +1,81 @@
+#include "Common/Config.h"
+
+#include "ISBI/ValidityBitmap.h"
+#include "ISBI/Tests/TestSupport.h"
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+
+// builds bitmaps from random sets of ranges, some reaching outside the
+// block, and compares the bits, counts, and invalid ranges with the sets
+
+int main()
+{
+  std::mt19937 generator(12345);
+
+  for (unsigned trial = 0; trial < 1000; trial ++) {
+    const unsigned	 nrSamples = generator() % 1000;
+    const TimeStamp	 firstTime(1000000 + generator() % 100, 1);
+    SparseSet<TimeStamp> validData[2];
+    ValidityBitmap	 bitmaps[2];
+
+    for (unsigned set = 0; set < 2; set ++) {
+      for (unsigned range = generator() % 8; range > 0; range --) {
+	TimeStamp begin = firstTime - 100 + generator() % (nrSamples + 200);
+	validData[set].include(begin, begin + generator() % 300);
+      }
+
+      bitmaps[set].assign(validData[set], firstTime, nrSamples);
+
+      if (bitmaps[set].nrSamples() != nrSamples || bitmaps[set].count() != (unsigned) (int64_t) validData[set].subset(firstTime, firstTime + nrSamples).count())
+	fail("wrong count", trial);
+
+      for (unsigned sample = 0; sample < nrSamples; sample ++)
+	if (bitmaps[set].test(sample) != validData[set].test(firstTime + sample))
+	  fail("wrong bit", trial);
+
+      std::vector<bool> invalid(nrSamples, false);
+      unsigned		previousEnd = ~0U;
+
+      bitmaps[set].forEachInvalidRange([&] (unsigned begin, unsigned end) {
+	if (begin >= end || end > nrSamples || begin == previousEnd)
+	  fail("wrong invalid range", trial);
+
+	for (unsigned sample = begin; sample < end; sample ++)
+	  invalid[sample] = true;
+
+	previousEnd = end;
+      });
+
+      for (unsigned sample = 0; sample < nrSamples; sample ++)
+	if (invalid[sample] == validData[set].test(firstTime + sample))
+	  fail("invalid range mismatch", trial);
+    }
+
+    if (ValidityBitmap::countCommon(bitmaps[0], bitmaps[1]) != (unsigned) (int64_t) (validData[0] & validData[1]).subset(firstTime, firstTime + nrSamples).count())
+      fail("wrong common count", trial);
+
+    // a valid run is flagged iff it is shorter than the minimum and lies
+    // between two invalid runs
+    const unsigned minValidRun = generator() % 100;
+    ValidityBitmap coalesced   = bitmaps[0];
+
+    coalesced.flagShortGaps(minValidRun);
+
+    for (unsigned begin = 0, end; begin < nrSamples; begin = end) {
+      for (end = begin + 1; end < nrSamples && bitmaps[0].test(end) == bitmaps[0].test(begin); end ++)
+	;
+
+      bool flagged = bitmaps[0].test(begin) && begin > 0 && end < nrSamples && end - begin < minValidRun;
+
+      for (unsigned sample = begin; sample < end; sample ++)
+	if (coalesced.test(sample) != (bitmaps[0].test(sample) && !flagged))
+	  fail("wrong coalesced bit", trial);
+    }
+  }
+
+  std::cout << "Test OK" << std::endl;
+  return 0;
+}
@@ -0,0 +1,384 @@
+#include "Common/Config.h"
+
+#include "ISBI/VDIFDecoder.h"
+#include "Common/Exceptions/Exception.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined __x86_64__
+#include <immintrin.h>
+#endif
+
+
+namespace {
+  // four decoded samples per byte value, stored such that a single 4-byte
+  // store writes them in sample order
+  const std::array<uint32_t, 256> decodeLUT = [] {
+    std::array<uint32_t, 256> lut;
+
+    for (unsigned byte = 0; byte < 256; ++byte) {
+      int8_t samples[4];
+
+      for (unsigned sample = 0; sample < 4; ++sample)
+        samples[sample] = DECODER_LEVEL_2BIT[(byte >> (2 * sample)) & 0x3];
+
+      memcpy(&lut[byte], samples, sizeof samples);
+    }
+
+    return lut;
+  } ();
+}
+
+
+void decode2bitScalar(const uint8_t *__restrict in, size_t nrBytes, int8_t *__restrict out)
+{
+  for (size_t i = 0; i < nrBytes; ++i)
+    memcpy(out + 4 * i, &decodeLUT[in[i]], sizeof(uint32_t));
+}
+
+
+#if defined __x86_64__
+
+// pshufb-based: the low and high nibble of each byte hold two samples each,
+// which are looked up in a 16-entry table per sample position, after which
+// the four sample streams are interleaved back into time order
+
+__attribute__((target("avx2"))) void decode2bitAVX2(const uint8_t *__restrict in, size_t nrBytes, int8_t *__restrict out)
+{
+  const __m256i firstLevel  = _mm256_setr_epi8(-3, -1, 1, 3, -3, -1, 1, 3, -3, -1, 1, 3, -3, -1, 1, 3,
+					       -3, -1, 1, 3, -3, -1, 1, 3, -3, -1, 1, 3, -3, -1, 1, 3);
+  const __m256i secondLevel = _mm256_setr_epi8(-3, -3, -3, -3, -1, -1, -1, -1, 1, 1, 1, 1, 3, 3, 3, 3,
+					       -3, -3, -3, -3, -1, -1, -1, -1, 1, 1, 1, 1, 3, 3, 3, 3);
+  const __m256i nibbleMask  = _mm256_set1_epi8(0x0F);
+
+  size_t i = 0;
+
+  for (; i + 32 <= nrBytes; i += 32) {
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+    __m256i low   = _mm256_and_si256(bytes, nibbleMask);
+    __m256i high  = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibbleMask);
+
+    __m256i s0 = _mm256_shuffle_epi8(firstLevel, low);
+    __m256i s1 = _mm256_shuffle_epi8(secondLevel, low);
+    __m256i s2 = _mm256_shuffle_epi8(firstLevel, high);
+    __m256i s3 = _mm256_shuffle_epi8(secondLevel, high);
+
+    __m256i s01lo = _mm256_unpacklo_epi8(s0, s1), s01hi = _mm256_unpackhi_epi8(s0, s1);
+    __m256i s23lo = _mm256_unpacklo_epi8(s2, s3), s23hi = _mm256_unpackhi_epi8(s2, s3);
+
+    // per 128-bit lane, q0 .. q3 hold the samples of bytes 0-3 .. 12-15 of that lane
+    __m256i q0 = _mm256_unpacklo_epi16(s01lo, s23lo), q1 = _mm256_unpackhi_epi16(s01lo, s23lo);
+    __m256i q2 = _mm256_unpacklo_epi16(s01hi, s23hi), q3 = _mm256_unpackhi_epi16(s01hi, s23hi);
+
+    __m256i *dst = reinterpret_cast<__m256i *>(out + 4 * i);
+    _mm256_storeu_si256(dst + 0, _mm256_permute2x128_si256(q0, q1, 0x20));
+    _mm256_storeu_si256(dst + 1, _mm256_permute2x128_si256(q2, q3, 0x20));
+    _mm256_storeu_si256(dst + 2, _mm256_permute2x128_si256(q0, q1, 0x31));
+    _mm256_storeu_si256(dst + 3, _mm256_permute2x128_si256(q2, q3, 0x31));
+  }
+
+  decode2bitScalar(in + i, nrBytes - i, out + 4 * i);
+}
+
+
+__attribute__((target("avx512f,avx512bw"))) void decode2bitAVX512(const uint8_t *__restrict in, size_t nrBytes, int8_t *__restrict out)
+{
+  const __m512i firstLevel  = _mm512_broadcast_i32x4(_mm_setr_epi8(-3, -1, 1, 3, -3, -1, 1, 3, -3, -1, 1, 3, -3, -1, 1, 3));
+  const __m512i secondLevel = _mm512_broadcast_i32x4(_mm_setr_epi8(-3, -3, -3, -3, -1, -1, -1, -1, 1, 1, 1, 1, 3, 3, 3, 3));
+  const __m512i nibbleMask  = _mm512_set1_epi8(0x0F);
+
+  size_t i = 0;
+
+  for (; i + 64 <= nrBytes; i += 64) {
+    __m512i bytes = _mm512_loadu_si512(in + i);
+    __m512i low   = _mm512_and_si512(bytes, nibbleMask);
+    __m512i high  = _mm512_and_si512(_mm512_srli_epi16(bytes, 4), nibbleMask);
+
+    __m512i s0 = _mm512_shuffle_epi8(firstLevel, low);
+    __m512i s1 = _mm512_shuffle_epi8(secondLevel, low);
+    __m512i s2 = _mm512_shuffle_epi8(firstLevel, high);
+    __m512i s3 = _mm512_shuffle_epi8(secondLevel, high);
+
+    __m512i s01lo = _mm512_unpacklo_epi8(s0, s1), s01hi = _mm512_unpackhi_epi8(s0, s1);
+    __m512i s23lo = _mm512_unpacklo_epi8(s2, s3), s23hi = _mm512_unpackhi_epi8(s2, s3);
+
+    __m512i q0 = _mm512_unpacklo_epi16(s01lo, s23lo), q1 = _mm512_unpackhi_epi16(s01lo, s23lo);
+    __m512i q2 = _mm512_unpacklo_epi16(s01hi, s23hi), q3 = _mm512_unpackhi_epi16(s01hi, s23hi);
+
+    // transpose the 4x4 matrix of 128-bit lanes
+    __m512i t0 = _mm512_shuffle_i64x2(q0, q1, _MM_SHUFFLE(2, 0, 2, 0));
+    __m512i t1 = _mm512_shuffle_i64x2(q0, q1, _MM_SHUFFLE(3, 1, 3, 1));
+    __m512i t2 = _mm512_shuffle_i64x2(q2, q3, _MM_SHUFFLE(2, 0, 2, 0));
+    __m512i t3 = _mm512_shuffle_i64x2(q2, q3, _MM_SHUFFLE(3, 1, 3, 1));
+
+    int8_t *dst = out + 4 * i;
+    _mm512_storeu_si512(dst +   0, _mm512_shuffle_i64x2(t0, t2, _MM_SHUFFLE(2, 0, 2, 0)));
+    _mm512_storeu_si512(dst +  64, _mm512_shuffle_i64x2(t1, t3, _MM_SHUFFLE(2, 0, 2, 0)));
+    _mm512_storeu_si512(dst + 128, _mm512_shuffle_i64x2(t0, t2, _MM_SHUFFLE(3, 1, 3, 1)));
+    _mm512_storeu_si512(dst + 192, _mm512_shuffle_i64x2(t1, t3, _MM_SHUFFLE(3, 1, 3, 1)));
+  }
+
+  decode2bitAVX2(in + i, nrBytes - i, out + 4 * i);
+}
+
+#endif
+
+
+namespace {
+  struct Implementation {
+    void (*function)(const uint8_t *__restrict, size_t, int8_t *__restrict);
+    const char *name;
+  };
+
+  const Implementation implementation = [] () -> Implementation {
+#if defined __x86_64__
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512bw"))
+      return { decode2bitAVX512, "AVX-512" };
+
+    if (__builtin_cpu_supports("avx2"))
+      return { decode2bitAVX2, "AVX2" };
+#endif
+
+    return { decode2bitScalar, "scalar" };
+  } ();
+}
+
+
+void decode2bit(const uint8_t *__restrict in, size_t nrBytes, int8_t *__restrict out)
+{
+  implementation.function(in, nrBytes, out);
+}
+
+
+const char *decode2bitImplementation()
+{
+  return implementation.name;
+}
+
+
+namespace {
+  inline uint8_t encode(int8_t sample, unsigned nrBits)
+  {
+    // saturate 8-bit input rather than let it wrap
+    return nrBits == 2 ? (std::min(std::max(sample, (int8_t) -3), (int8_t) 3) + 3) >> 1 : std::min(std::max(sample, (int8_t) -8), (int8_t) 7) & 0xF;
+  }
+
+  inline int8_t decode(uint8_t code, unsigned nrBits)
+  {
+    return nrBits == 2 ? DECODER_LEVEL_2BIT[code & 0x3] : (int8_t) (code << 4) >> 4;
+  }
+}
+
+
+void packSamples(uint8_t *row, size_t firstSample, const int8_t *samples, size_t nrSamples, unsigned nrBits)
+{
+  const unsigned samplesPerByte = 8 / nrBits, mask = (1 << nrBits) - 1;
+  size_t sample = 0;
+
+  // read-modify-write the partially covered bytes; store whole bytes at once
+  for (; sample < nrSamples && (firstSample + sample) % samplesPerByte != 0; sample ++) {
+    unsigned shift = (firstSample + sample) % samplesPerByte * nrBits;
+    uint8_t &byte = row[(firstSample + sample) / samplesPerByte];
+    byte = (byte & ~(mask << shift)) | encode(samples[sample], nrBits) << shift;
+  }
+
+  for (uint8_t *dst = row + (firstSample + sample) / samplesPerByte; sample + samplesPerByte <= nrSamples; sample += samplesPerByte) {
+    uint8_t byte = 0;
+
+    for (unsigned i = 0; i < samplesPerByte; i ++)
+      byte |= encode(samples[sample + i], nrBits) << (i * nrBits);
+
+    *dst ++ = byte;
+  }
+
+  for (; sample < nrSamples; sample ++) {
+    unsigned shift = (firstSample + sample) % samplesPerByte * nrBits;
+    uint8_t &byte = row[(firstSample + sample) / samplesPerByte];
+    byte = (byte & ~(mask << shift)) | encode(samples[sample], nrBits) << shift;
+  }
+}
+
+
+void unpackSamples(int8_t *samples, const uint8_t *row, size_t firstSample, size_t nrSamples, unsigned nrBits)
+{
+  const unsigned samplesPerByte = 8 / nrBits;
+  size_t sample = 0;
+
+  for (; sample < nrSamples && (firstSample + sample) % samplesPerByte != 0; sample ++)
+    samples[sample] = decode(row[(firstSample + sample) / samplesPerByte] >> ((firstSample + sample) % samplesPerByte * nrBits), nrBits);
+
+  const uint8_t *src = row + (firstSample + sample) / samplesPerByte;
+  size_t nrBytes = (nrSamples - sample) / samplesPerByte;
+
+  if (nrBits == 2) {
+    decode2bit(src, nrBytes, samples + sample);
+  } else {
+    for (size_t i = 0; i < nrBytes; i ++) {
+      samples[sample + 2 * i]     = decode(src[i], 4);
+      samples[sample + 2 * i + 1] = decode(src[i] >> 4, 4);
+    }
+  }
+
+  for (sample += nrBytes * samplesPerByte; sample < nrSamples; sample ++)
+    samples[sample] = decode(row[(firstSample + sample) / samplesPerByte] >> ((firstSample + sample) % samplesPerByte * nrBits), nrBits);
+}
+
+
+void SampleStatistics::add(const int8_t *samples, unsigned nrSamples)
+{
+  // branch free, with 32-bit counters (in blocks short enough for the sum of
+  // squares), so that the compiler vectorizes it
+  for (unsigned first = 0; first < nrSamples; first += 65536) {
+    unsigned belowMinusOne = 0, negative = 0, positive = 0, aboveOne = 0, zeros = 0, squares = 0;
+
+    for (unsigned i = first; i < std::min(first + 65536, nrSamples); i ++) {
+      int sample = samples[i];
+
+      belowMinusOne += sample < -1;
+      negative	    += sample < 0;
+      positive	    += sample > 0;
+      aboveOne	    += sample > 1;
+      zeros	    += sample == 0;
+      squares	    += sample * sample;
+    }
+
+    nrZeros	   += zeros;
+    sumOfSquares   += squares;
+    stateCounts[0] += belowMinusOne;
+    stateCounts[1] += negative - belowMinusOne;
+    stateCounts[2] += positive - aboveOne;
+    stateCounts[3] += aboveOne;
+  }
+
+  this->nrSamples += nrSamples;
+}
+
+
+SampleStatistics &SampleStatistics::operator += (const SampleStatistics &other)
+{
+  nrSamples    += other.nrSamples;
+  nrZeros      += other.nrZeros;
+  sumOfSquares += other.sumOfSquares;
+
+  for (unsigned state = 0; state < 4; state ++)
+    stateCounts[state] += other.stateCounts[state];
+
+  return *this;
+}
+
+
+namespace {
+  template <unsigned NR_BITS> inline void decodeBytes(const uint8_t *__restrict in, size_t nrBytes, int8_t *__restrict out);
+
+  template <> inline void decodeBytes<1>(const uint8_t *__restrict in, size_t nrBytes, int8_t *__restrict out)
+  {
+    for (size_t i = 0; i < nrBytes; i ++)
+      for (unsigned bit = 0; bit < 8; bit ++)
+	out[8 * i + bit] = (in[i] >> bit & 1) ? 1 : -1;
+  }
+
+  template <> inline void decodeBytes<2>(const uint8_t *__restrict in, size_t nrBytes, int8_t *__restrict out)
+  {
+    decode2bit(in, nrBytes, out);
+  }
+
+  template <> inline void decodeBytes<4>(const uint8_t *__restrict in, size_t nrBytes, int8_t *__restrict out)
+  {
+    for (size_t i = 0; i < nrBytes; i ++) {
+      out[2 * i]     = (in[i] & 0xF) - 8;
+      out[2 * i + 1] = (in[i] >> 4) - 8;
+    }
+  }
+
+  template <> inline void decodeBytes<8>(const uint8_t *__restrict in, size_t nrBytes, int8_t *__restrict out)
+  {
+    for (size_t i = 0; i < nrBytes; i ++)
+      out[i] = in[i] ^ 0x80;
+  }
+}
+
+
+VDIFDecoder::VDIFDecoder(unsigned nrBitsPerSample, unsigned nrChannels, unsigned maxNrTimes)
+:
+  _nrBitsPerSample(nrBitsPerSample),
+  _nrChannels(nrChannels),
+  maxNrTimes(maxNrTimes),
+  decoded((size_t) maxNrTimes * nrChannels + 16) // room for partially used bytes at both ends
+{
+  switch (nrBitsPerSample) {
+    case 1 : function = select<1>(nrChannels, specialized);
+	     break;
+
+    case 2 : function = select<2>(nrChannels, specialized);
+	     break;
+
+    case 4 : function = select<4>(nrChannels, specialized);
+	     break;
+
+    case 8 : function = select<8>(nrChannels, specialized);
+	     break;
+
+    default: throw Exception("unsupported number of VDIF bits per sample: " + std::to_string(nrBitsPerSample));
+  }
+}
+
+
+template <unsigned NR_BITS> VDIFDecoder::Function VDIFDecoder::select(unsigned nrChannels, bool &specialized)
+{
+  specialized = true;
+
+  switch (nrChannels) {
+    case  1 : return &VDIFDecoder::decodeChannels<NR_BITS,  1>;
+    case  2 : return &VDIFDecoder::decodeChannels<NR_BITS,  2>;
+    case  4 : return &VDIFDecoder::decodeChannels<NR_BITS,  4>;
+    case  8 : return &VDIFDecoder::decodeChannels<NR_BITS,  8>;
+    case 16 : return &VDIFDecoder::decodeChannels<NR_BITS, 16>;
+    case 32 : return &VDIFDecoder::decodeChannels<NR_BITS, 32>;
+    default : specialized = false;
+	      return &VDIFDecoder::decodeChannels<NR_BITS, 0>;
+  }
+}
+
+
+template <unsigned NR_BITS, unsigned NR_CHANNELS> void VDIFDecoder::decodeChannels(const uint8_t *payload, size_t payloadBytes, unsigned firstTime, unsigned nrTimes, const uint32_t channels[], int8_t *const outputs[], unsigned nrOutputs)
+{
+  // NR_CHANNELS == 0 selects the generic version
+  constexpr unsigned samplesPerByte = 8 / NR_BITS;
+  const unsigned     nrChannels = NR_CHANNELS != 0 ? NR_CHANNELS : _nrChannels;
+
+  if (nrTimes > maxNrTimes)
+    throw Exception("VDIFDecoder: too many time samples at once");
+
+  const size_t firstSample = (size_t) firstTime * nrChannels;
+  const size_t firstByte = firstSample / samplesPerByte;
+  const size_t endByte = (firstSample + (size_t) nrTimes * nrChannels + samplesPerByte - 1) / samplesPerByte;
+  const size_t nrValidBytes = firstByte < payloadBytes ? std::min(endByte, payloadBytes) - firstByte : 0;
+
+  decodeBytes<NR_BITS>(payload + firstByte, nrValidBytes, decoded.data());
+  std::fill(decoded.begin() + samplesPerByte * nrValidBytes, decoded.begin() + samplesPerByte * (endByte - firstByte), 0);
+
+  const int8_t *__restrict samples = decoded.data() + firstSample % samplesPerByte;
+
+  for (unsigned output = 0; output < nrOutputs; output ++) {
+    int8_t *__restrict dst = outputs[output];
+    const unsigned channel = channels[output];
+
+    if (channel >= nrChannels)
+      memset(dst, 0, nrTimes);
+    else if (nrChannels == 1)
+      memcpy(dst, samples, nrTimes);
+    else
+      for (unsigned time = 0; time < nrTimes; time ++)
+	dst[time] = samples[time * nrChannels + channel];
+  }
+}
+
+
+std::string VDIFDecoder::name() const
+{
+  return std::to_string(_nrBitsPerSample) + "-bit, " + std::to_string(_nrChannels) + " channel" + (_nrChannels != 1 ? "s" : "") + (specialized ? "" : " (generic)") + (_nrBitsPerSample == 2 ? std::string(", ") + decode2bitImplementation() : "");
+}
@@ -0,0 +1,86 @@
+#ifndef ISBI_VDIF_DECODER_H
+#define ISBI_VDIF_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+static constexpr int8_t DECODER_LEVEL_2BIT[] = { -3, -1, 1, 3 };
+
+// Expands nrBytes of 2-bit samples (four per byte, the earliest sample in the
+// least significant bits) to one int8_t level per sample.  decode2bit()
+// dispatches at run time to the fastest implementation the CPU supports.
+
+void decode2bit(const uint8_t *__restrict in, size_t nrBytes, int8_t *__restrict out);
+
+void decode2bitScalar(const uint8_t *__restrict in, size_t nrBytes, int8_t *__restrict out);
+
+#if defined __x86_64__
+void decode2bitAVX2(const uint8_t *__restrict in, size_t nrBytes, int8_t *__restrict out);
+void decode2bitAVX512(const uint8_t *__restrict in, size_t nrBytes, int8_t *__restrict out);
+#endif
+
+const char *decode2bitImplementation();
+
+// Packed ring buffer storage: nrBits (2 or 4) per sample, the earliest sample
+// in the least significant bits.  2-bit samples are stored as VDIF codes and
+// therefore cannot represent 0; 4-bit samples are two's complement.
+
+void packSamples(uint8_t *row, size_t firstSample, const int8_t *samples, size_t nrSamples, unsigned nrBits);
+void unpackSamples(int8_t *samples, const uint8_t *row, size_t firstSample, size_t nrSamples, unsigned nrBits);
+
+
+// Sampler health of one channel, accumulated from decoded samples while they
+// are still in L1.  The states are those of a 2-bit sampler (levels -3, -1,
+// 1, and 3); wider samples are binned at the same thresholds.  Zeros, which
+// the decoders write for missing channels, count in no state.
+
+struct SampleStatistics {
+  uint64_t nrSamples, nrZeros, sumOfSquares, stateCounts[4];
+
+  void add(const int8_t *samples, unsigned nrSamples);
+  SampleStatistics &operator += (const SampleStatistics &);
+
+  double stateFraction(unsigned state) const { return nrSamples > 0 ? (double) stateCounts[state] / nrSamples : 0; }
+  double zeroFraction() const { return nrSamples > 0 ? (double) nrZeros / nrSamples : 0; }
+  double power() const { return nrSamples > 0 ? (double) sumOfSquares / nrSamples : 0; } // mean square level
+};
+
+
+// Expands (part of) a VDIF payload with nrBitsPerSample-bit (1, 2, 4, or 8)
+// offset-binary samples and nrChannels interleaved channels into one int8_t
+// stream per requested channel.  The implementation is specialized once, at
+// construction, on the number of bits and on common channel counts, so that
+// the inner loops have constant shifts and strides.
+
+class VDIFDecoder
+{
+  public:
+    VDIFDecoder(unsigned nrBitsPerSample, unsigned nrChannels, unsigned maxNrTimes);
+
+    // Writes time samples [firstTime, firstTime + nrTimes) of channel
+    // channels[i] to outputs[i], for i < nrOutputs.  Samples beyond the
+    // payload and channels that do not exist are zero.
+    void decode(const uint8_t *payload, size_t payloadBytes, unsigned firstTime, unsigned nrTimes, const uint32_t channels[], int8_t *const outputs[], unsigned nrOutputs)
+    {
+      (this->*function)(payload, payloadBytes, firstTime, nrTimes, channels, outputs, nrOutputs);
+    }
+
+    unsigned nrBitsPerSample() const { return _nrBitsPerSample; }
+    unsigned nrChannels() const { return _nrChannels; }
+    std::string name() const;
+
+  private:
+    typedef void (VDIFDecoder::*Function)(const uint8_t *, size_t, unsigned, unsigned, const uint32_t [], int8_t *const [], unsigned);
+
+    template <unsigned NR_BITS> Function select(unsigned nrChannels, bool &specialized);
+    template <unsigned NR_BITS, unsigned NR_CHANNELS> void decodeChannels(const uint8_t *payload, size_t payloadBytes, unsigned firstTime, unsigned nrTimes, const uint32_t channels[], int8_t *const outputs[], unsigned nrOutputs);
+
+    unsigned		_nrBitsPerSample, _nrChannels, maxNrTimes;
+    bool		specialized;
+    Function		function;
+    std::vector<int8_t> decoded; // one chunk of all channels
+};
+
+#endif
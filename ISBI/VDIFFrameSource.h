@@ -0,0 +1,27 @@
+#ifndef ISBI_VDIF_FRAME_SOURCE_H
+#define ISBI_VDIF_FRAME_SOURCE_H
+
+#include <cstdint>
+
+
+// A recording that is read as a sequence of VDIF frames, the unit that
+// InputBuffer reorders, decodes, and writes into the ring buffer.
+
+class VDIFFrameSource
+{
+  public:
+    virtual ~VDIFFrameSource() noexcept(false) {} // as Stream, which VDIFStream also is
+
+    // Stores pointers to up to maxNrFrames valid frames in frames[], and their
+    // start times (in samples) in timestamps[], and returns their number.  The
+    // frames remain accessible until the next call.  Throws an
+    // EndOfStreamException if no more frames are available.
+    virtual unsigned read(const char *frames[], int64_t timestamps[], unsigned maxNrFrames) = 0;
+
+    // Skips ahead to (shortly before) timestamp, if possible.
+    virtual void seek(int64_t timestamp) = 0;
+
+    virtual int64_t getFirstTimestamp() const = 0;
+};
+
+#endif
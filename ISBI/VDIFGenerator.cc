@@ -0,0 +1,255 @@
+#include "Common/Config.h"
+
+#include "ISBI/VDIFGenerator.h"
+#include "ISBI/VDIFStream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+
+static const uint64_t golden = 0x9E3779B97F4A7C15ULL;
+
+// the streams of random numbers, per kind, station, and channel
+static const uint64_t SKY = 1ULL << 48, NOISE = 2ULL << 48, IMPAIRMENTS = 3ULL << 48;
+
+
+static inline uint64_t mix(uint64_t z)
+{
+  // the splitmix64 finalizer
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+
+static inline float gaussian(uint64_t random)
+{
+  // the sum of four uniform 16-bit numbers; close enough to normal for a
+  // few bits per sample, and much cheaper than Box-Muller
+  unsigned sum = (random & 0xFFFF) + (random >> 16 & 0xFFFF) + (random >> 32 & 0xFFFF) + (random >> 48);
+  return (sum - 131070.0f) * (1 / 37837.23f);
+}
+
+
+static inline double uniform(uint64_t random)
+{
+  return (random >> 11) * 0x1.0p-53;
+}
+
+
+// VDIF codes are offset binary; 2-bit thresholds are at about the optimal
+// +/- 1 sigma, 4- and 8-bit samples have 3 and 16 levels per sigma
+template <unsigned NR_BITS> static inline unsigned quantize(float x);
+
+template <> inline unsigned quantize<1>(float x) { return x >= 0; }
+template <> inline unsigned quantize<2>(float x) { return (x >= -1) + (x >= 0) + (x >= 1); }
+template <> inline unsigned quantize<4>(float x) { return std::min(std::max(std::floor(x * 3), -8.0f), 7.0f) + 8; }
+template <> inline unsigned quantize<8>(float x) { return std::min(std::max(std::floor(x * 16), -128.0f), 127.0f) + 128; }
+
+
+VDIFGenerator::VDIFGenerator(unsigned nrStations, const Format &format, int64_t startSecond, double correlation, uint64_t seed)
+:
+  nrStations(nrStations),
+  format(format),
+  startSecond(startSecond),
+  samplesPerSecond(std::llround(format.sampleRate)),
+  skyAmplitude(std::sqrt(correlation)),
+  noiseAmplitude(std::sqrt(1 - correlation)),
+  seed(mix(seed)),
+  delays(nrStations),
+  impairments { 0, 0, 0, 1 }
+{
+  if ((format.nrBitsPerSample != 1 && format.nrBitsPerSample != 2 && format.nrBitsPerSample != 4 && format.nrBitsPerSample != 8) || format.nrChannels == 0 || (format.nrChannels & (format.nrChannels - 1)) != 0 || format.payloadSize == 0 || format.payloadSize % 8 != 0)
+    throw std::runtime_error("unsupported VDIF format");
+
+  if ((uint64_t) format.payloadSize * 8 % (format.nrBitsPerSample * format.nrChannels) != 0)
+    throw std::runtime_error("a VDIF frame must hold a whole number of samples per channel");
+
+  _samplesPerFrame = (uint64_t) format.payloadSize * 8 / (format.nrBitsPerSample * format.nrChannels);
+
+  if (samplesPerSecond <= 0 || samplesPerSecond % _samplesPerFrame != 0)
+    throw std::runtime_error("the sample rate must be a whole number of VDIF frames per second");
+
+  _framesPerSecond = samplesPerSecond / _samplesPerFrame;
+
+  if (correlation < 0 || correlation > 1)
+    throw std::runtime_error("correlation must be between 0 and 1");
+
+  for (epoch = VDIFHeader::epochStarts.size() - 1; epoch > 0 && VDIFHeader::epochStarts[epoch] > startSecond; epoch --)
+    ;
+}
+
+
+void VDIFGenerator::setDelays(const std::vector<std::map<int64_t, double>> &delays)
+{
+  if (delays.size() != nrStations)
+    throw std::runtime_error("need the delays of every station");
+
+  this->delays = delays;
+}
+
+
+std::vector<std::map<int64_t, double>> VDIFGenerator::readDelays(const std::string &configFile, unsigned nrStations)
+{
+  // per station, the number of entries, followed by (time, delay) pairs;
+  // the rest of the file is not needed here
+  std::ifstream			     config(configFile, std::ios::binary);
+  std::vector<std::map<int64_t, double>> delays(nrStations);
+
+  if (!config.is_open())
+    throw std::runtime_error("Could not open configuration file: " + configFile);
+
+  for (unsigned station = 0; station < nrStations; station ++) {
+    uint32_t n;
+    config.read(reinterpret_cast<char *>(&n), sizeof n);
+
+    for (uint32_t i = 0; i < n && config; i ++) {
+      int64_t time;
+      double  delay;
+
+      config.read(reinterpret_cast<char *>(&time), sizeof time);
+      config.read(reinterpret_cast<char *>(&delay), sizeof delay);
+      delays[station][time] = delay;
+    }
+
+    if (!config)
+      throw std::runtime_error("Failed to read the delays of station " + std::to_string(station) + " from " + configFile);
+  }
+
+  return delays;
+}
+
+
+int64_t VDIFGenerator::delaySamples(unsigned station, int64_t time) const
+{
+  // the delay of the last entry at or before time, or else of the first
+  auto delayAt = [time] (const std::map<int64_t, double> &delays) {
+    if (delays.empty())
+      return 0.0;
+
+    auto entry = delays.upper_bound(time);
+    return entry == delays.begin() ? entry->second : std::prev(entry)->second;
+  };
+
+  // rounded as the correlator does
+  return std::floor((delayAt(delays[station]) - delayAt(delays[0])) * format.sampleRate + .5);
+}
+
+
+uint64_t VDIFGenerator::random(uint64_t stream, uint64_t counter) const
+{
+  return mix(mix(seed ^ mix(stream)) + counter * golden);
+}
+
+
+template <unsigned NR_BITS> void VDIFGenerator::generatePayload(unsigned station, int64_t firstTime, int64_t delay, uint8_t *payload) const
+{
+  // time-major, channels interleaved, the earliest sample in the least
+  // significant bits.  The samples of a channel are computed first, in a
+  // loop that the compiler vectorizes, and then quantized and packed.
+  const unsigned	    samplesPerByte = 8 / NR_BITS, nrChannels = format.nrChannels, log2NrChannels = __builtin_ctz(nrChannels), nrTimes = _samplesPerFrame;
+  const float		    skyAmplitude = this->skyAmplitude, noiseAmplitude = this->noiseAmplitude;
+  static thread_local std::vector<float> samples; // per channel, per time
+
+  samples.resize((size_t) nrTimes * nrChannels);
+
+  for (unsigned channel = 0; channel < nrChannels; channel ++) {
+    const uint64_t skyKey = mix(seed ^ mix(SKY | channel)), noiseKey = mix(seed ^ mix(NOISE | (uint64_t) station << 24 | channel));
+    const uint64_t skyCounter = skyKey + (firstTime - delay) * golden, noiseCounter = noiseKey + firstTime * golden;
+    float	   *__restrict out = &samples[(size_t) channel * nrTimes];
+
+    for (unsigned time = 0; time < nrTimes; time ++)
+      out[time] = skyAmplitude * gaussian(mix(skyCounter + time * golden)) + noiseAmplitude * gaussian(mix(noiseCounter + time * golden));
+  }
+
+  for (unsigned byte = 0; byte < format.payloadSize; byte ++) {
+    unsigned value = 0;
+
+    for (unsigned sample = 0, index = byte * samplesPerByte; sample < samplesPerByte; sample ++, index ++)
+      value |= quantize<NR_BITS>(samples[(size_t) (index & (nrChannels - 1)) * nrTimes + (index >> log2NrChannels)]) << (sample * NR_BITS);
+
+    payload[byte] = value;
+  }
+}
+
+
+void VDIFGenerator::generateFrame(unsigned station, uint64_t frame, char *out) const
+{
+  VDIFHeader *header = reinterpret_cast<VDIFHeader *>(out);
+  int64_t    second = startSecond + frame / _framesPerSecond;
+
+  memset(header, 0, 32);
+  header->sec_from_epoch      = second - VDIFHeader::epochStarts[epoch];
+  header->ref_epoch	      = epoch;
+  header->dataframe_in_second = frame % _framesPerSecond;
+  header->dataframe_length    = frameSize() / 8;
+  header->log2_nchan	      = __builtin_ctz(format.nrChannels);
+  header->station_id	      = station;
+  header->bits_per_sample     = format.nrBitsPerSample - 1;
+
+  int64_t  firstTime = second * samplesPerSecond + (int64_t) header->dataframe_in_second * _samplesPerFrame;
+  int64_t  delay     = delaySamples(station, firstTime);
+  uint8_t *payload   = reinterpret_cast<uint8_t *>(out + 32);
+
+  switch (format.nrBitsPerSample) {
+    case 1 : generatePayload<1>(station, firstTime, delay, payload);
+	     break;
+
+    case 2 : generatePayload<2>(station, firstTime, delay, payload);
+	     break;
+
+    case 4 : generatePayload<4>(station, firstTime, delay, payload);
+	     break;
+
+    case 8 : generatePayload<8>(station, firstTime, delay, payload);
+	     break;
+  }
+}
+
+
+unsigned VDIFGenerator::generate(unsigned station, uint64_t firstFrame, unsigned nrFrames, char *frames) const
+{
+  // four random numbers per frame: lost, reordered, how far, and invalid
+  const uint64_t   stream = IMPAIRMENTS | station;
+  std::vector<uint64_t> order;
+
+  for (uint64_t frame = firstFrame; frame < firstFrame + nrFrames; frame ++)
+    if (impairments.lossFraction == 0 || uniform(random(stream, 4 * frame)) >= impairments.lossFraction)
+      order.push_back(frame);
+
+  if (impairments.reorderFraction > 0) {
+    // a reordered frame is sent up to maxReorderDistance frames later than
+    // its turn; every frame is drawn once, so that a delayed frame is not
+    // carried along further by the frames it passes
+    std::vector<std::pair<double, uint64_t>> sendTimes(order.size());
+
+    for (unsigned index = 0; index < order.size(); index ++) {
+      sendTimes[index] = std::make_pair(index, order[index]);
+
+      if (uniform(random(stream, 4 * order[index] + 1)) < impairments.reorderFraction)
+	sendTimes[index].first += 1.5 + random(stream, 4 * order[index] + 2) % std::max(impairments.maxReorderDistance, 1U);
+    }
+
+    std::stable_sort(sendTimes.begin(), sendTimes.end(), [] (const std::pair<double, uint64_t> &a, const std::pair<double, uint64_t> &b) { return a.first < b.first; });
+
+    for (unsigned index = 0; index < order.size(); index ++)
+      order[index] = sendTimes[index].second;
+  }
+
+#pragma omp parallel for schedule(dynamic)
+  for (unsigned index = 0; index < order.size(); index ++) {
+    char *out = frames + (size_t) index * frameSize();
+
+    if (impairments.invalidFraction > 0 && uniform(random(stream, 4 * order[index] + 3)) < impairments.invalidFraction) {
+      for (unsigned word = 0; word < frameSize() / 4; word ++)
+	reinterpret_cast<uint32_t *>(out)[word] = 0x11223344;
+    } else {
+      generateFrame(station, order[index], out);
+    }
+  }
+
+  return order.size();
+}
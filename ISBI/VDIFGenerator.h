@@ -0,0 +1,71 @@
+#ifndef ISBI_VDIF_GENERATOR_H
+#define ISBI_VDIF_GENERATOR_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+
+// Synthesizes the VDIF frames of a number of stations that observe a common
+// sky signal, each with its own noise and delay, so that the ingest and
+// correlation paths can be benchmarked reproducibly without recordings.
+// Every sample comes from a counter-based random generator, keyed on the
+// seed, station, channel, and time, so that frames can be generated in any
+// order and in parallel, and the same seed always gives the same data.
+// Packet loss, reordering, and invalid (fill pattern) frames can be injected
+// at given rates; these are drawn per frame from the same generator.
+
+class VDIFGenerator
+{
+  public:
+    struct Format {
+      double   sampleRate; // per channel; a whole number of frames per second
+      unsigned nrChannels, nrBitsPerSample, payloadSize; // 1, 2, 4, or 8 bits; payloadSize a multiple of 8 bytes
+    };
+
+    struct Impairments {
+      double   lossFraction, reorderFraction, invalidFraction;
+      unsigned maxReorderDistance; // in frames
+    };
+
+    // startSecond is in seconds since 1970; correlation is the fraction of
+    // the signal power that comes from the sky
+    VDIFGenerator(unsigned nrStations, const Format &, int64_t startSecond, double correlation = .1, uint64_t seed = 0);
+
+    // Per station, delays in seconds, keyed by the time in samples from
+    // which they apply, as in the delay tables of the correlator's
+    // configFile.  The samples of a station at time t + delay(t) - delay of
+    // station 0 (rounded to a whole sample) are those of the sky at time t.
+    void setDelays(const std::vector<std::map<int64_t, double>> &delays);
+    static std::vector<std::map<int64_t, double>> readDelays(const std::string &configFile, unsigned nrStations);
+
+    void setImpairments(const Impairments &impairments) { this->impairments = impairments; }
+
+    unsigned frameSize() const { return 32 + format.payloadSize; }
+    unsigned samplesPerFrame() const { return _samplesPerFrame; }
+    unsigned framesPerSecond() const { return _framesPerSecond; }
+
+    // Generates frames firstFrame .. firstFrame + nrFrames - 1 of station
+    // into frames (room for nrFrames), in the order in which they are sent,
+    // and returns how many are sent.  Reordered frames stay within the
+    // range, so successive ranges should be larger than maxReorderDistance.
+    unsigned generate(unsigned station, uint64_t firstFrame, unsigned nrFrames, char *frames) const;
+
+  private:
+    template <unsigned NR_BITS> void generatePayload(unsigned station, int64_t firstTime, int64_t delay, uint8_t *payload) const;
+    void     generateFrame(unsigned station, uint64_t frame, char *out) const;
+    int64_t  delaySamples(unsigned station, int64_t time) const; // relative to station 0
+    uint64_t random(uint64_t stream, uint64_t counter) const;
+
+    unsigned			    nrStations;
+    Format			    format;
+    int64_t			    startSecond, samplesPerSecond;
+    unsigned			    _samplesPerFrame, _framesPerSecond, epoch;
+    float			    skyAmplitude, noiseAmplitude;
+    uint64_t			    seed;
+    std::vector<std::map<int64_t, double>> delays;
+    Impairments			    impairments;
+};
+
+#endif
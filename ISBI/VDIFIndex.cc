@@ -0,0 +1,280 @@
+#include "Common/Config.h"
+
+#include "ISBI/VDIFIndex.h"
+#include "ISBI/VDIFStream.h"
+#include "Common/Stream/FileStream.h"
+#include "Common/SystemCallException.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+const char VDIFIndex::magic[8] = { 'V', 'D', 'I', 'F', 'I', 'D', 'X', '1' };
+
+
+VDIFIndex::VDIFIndex(const std::string &vdifFileName)
+:
+  vdifFileName(vdifFileName),
+  _frameSize(0),
+  _ordered(true)
+{
+  if (!load()) {
+#pragma omp critical (clog)
+    std::clog << "building seek index for " << vdifFileName << std::endl;
+
+    build();
+
+    try {
+      save();
+    } catch (SystemCallException &ex) {
+#pragma omp critical (clog)
+      std::clog << "could not write " << sidecarName(vdifFileName) << ": " << ex.what() << std::endl;
+    }
+  }
+}
+
+
+std::string VDIFIndex::sidecarName(const std::string &vdifFileName)
+{
+  return vdifFileName + ".index";
+}
+
+
+void VDIFIndex::getFileAttributes(uint64_t &size, int64_t &modificationTime) const
+{
+  struct stat stat;
+
+  if (::stat(vdifFileName.c_str(), &stat) < 0)
+    throw SystemCallException("stat " + vdifFileName);
+
+  size = stat.st_size;
+  modificationTime = stat.st_mtim.tv_sec * 1000000000LL + stat.st_mtim.tv_nsec;
+}
+
+
+void VDIFIndex::build()
+{
+  static const size_t blockSize = 64 << 20;
+
+  FileStream	    file(vdifFileName);
+  std::vector<char> buffer(blockSize);
+  off_t		    bufferOffset = 0;
+  size_t	    bufferSize = 0;
+  uint64_t	    fileSize;
+  int64_t	    modificationTime;
+
+  getFileAttributes(fileSize, modificationTime);
+
+  // makes the size bytes at offset available in the buffer, and returns how
+  // many of them are (fewer at the end of the file)
+  auto fetch = [&] (off_t offset, size_t size) -> size_t {
+    if (offset < bufferOffset || offset + (off_t) size > bufferOffset + (off_t) bufferSize) {
+      ssize_t retval;
+
+      if ((retval = pread(file.fd, buffer.data(), buffer.size(), offset)) < 0)
+	throw SystemCallException("pread " + vdifFileName);
+
+      bufferOffset = offset;
+      bufferSize = retval;
+    }
+
+    return std::min<size_t>(size, bufferOffset + bufferSize - offset);
+  };
+
+  auto at = [&] (off_t offset) {
+    return buffer.data() + (offset - bufferOffset);
+  };
+
+  auto word2 = [] (const char *frame) {
+    return reinterpret_cast<const uint32_t *>(frame)[2];
+  };
+
+  _seconds.clear();
+  _invalidRuns.clear();
+  _ordered = true;
+
+  // the first valid header at any byte offset, confirmed by the next one
+  // unless it is the last frame of the file
+  off_t offset = 0;
+
+  for (;; offset ++) {
+    if (fetch(offset, sizeof(VDIFHeader)) < sizeof(VDIFHeader))
+      throw Exception("no valid VDIF header in " + vdifFileName);
+
+    const VDIFHeader &candidate = *reinterpret_cast<const VDIFHeader *>(at(offset));
+
+    if (VDIFStream::checkHeader(candidate) != HeaderStatus::VALID || 8 * candidate.dataframe_length <= candidate.headerSize() || 8 * candidate.dataframe_length > blockSize / 2)
+      continue;
+
+    size_t frameSize = candidate.headerSize() + candidate.dataSize();
+
+    if ((uint64_t) offset + frameSize + sizeof(VDIFHeader) > fileSize) {
+      if ((uint64_t) offset + frameSize == fileSize)
+	break;
+
+      continue;
+    }
+
+    if (fetch(offset, frameSize + sizeof(VDIFHeader)) == frameSize + sizeof(VDIFHeader) && word2(at(offset + frameSize)) == word2(at(offset)) && VDIFStream::checkHeader(*reinterpret_cast<const VDIFHeader *>(at(offset + frameSize))) == HeaderStatus::VALID)
+      break;
+  }
+
+  const VDIFHeader first = *reinterpret_cast<const VDIFHeader *>(at(offset));
+  const uint32_t   formatWord = word2(at(offset));
+
+  _frameSize = first.headerSize() + first.dataSize();
+
+  auto isFrame = [&] (const char *frame) {
+    const VDIFHeader &header = *reinterpret_cast<const VDIFHeader *>(frame);
+    return word2(frame) == formatWord && header.ref_epoch == first.ref_epoch && VDIFStream::checkHeader(header) == HeaderStatus::VALID;
+  };
+
+  // after a truncated frame or garbage, the next frame may start at any byte
+  // offset; search for it by its format word, as VDIFStream does.  Unless
+  // the file ends first, the header after it must be valid too.
+  auto nextFrame = [&] (off_t from) -> off_t {
+    for (;;) {
+      size_t available = fetch(from, blockSize);
+
+      if (available < _frameSize)
+	return fileSize;
+
+      bool	  atEnd = (uint64_t) from + available == fileSize;
+      const char *begin = at(from), *end = begin + available - _frameSize - (atEnd ? 0 : sizeof(VDIFHeader)) + 1;
+
+      for (const char *frame = begin; (frame = VDIFStream::findFrame(frame, end, formatWord)) != nullptr; frame ++)
+	if (isFrame(frame) && (frame + _frameSize + sizeof(VDIFHeader) > begin + available || isFrame(frame + _frameSize)))
+	  return from + (frame - begin);
+
+      if (atEnd)
+	return fileSize;
+
+      from += end - begin;
+    }
+  };
+
+  // the bytes of a run need not be a multiple of the frame size
+  off_t lastInvalidEnd = -1;
+
+  auto addInvalidRun = [&] (off_t begin, off_t end) {
+    if (_invalidRuns.size() > 0 && lastInvalidEnd == begin)
+      _invalidRuns.back().nrFrames = (end - _invalidRuns.back().offset + _frameSize - 1) / _frameSize;
+    else
+      _invalidRuns.push_back(InvalidRun { begin, (end - begin + _frameSize - 1) / _frameSize });
+
+    lastInvalidEnd = end;
+  };
+
+  auto addFrame = [&] (off_t offset, const VDIFHeader &header) {
+    int64_t second = VDIFHeader::epochStarts[header.ref_epoch] + header.sec_from_epoch;
+
+    if (_seconds.empty() || _seconds.back().second != second) {
+      _ordered &= _seconds.empty() || _seconds.back().second < second;
+      _seconds.push_back(Second { second, offset });
+    }
+  };
+
+  if (offset > 0)
+    addInvalidRun(0, offset);
+
+  while ((uint64_t) offset + _frameSize <= fileSize) {
+    size_t      available = fetch(offset, _frameSize + sizeof(VDIFHeader));
+    const char *frame = at(offset);
+    bool	valid = isFrame(frame);
+
+    if (valid && (available < _frameSize + sizeof(VDIFHeader) || word2(frame + _frameSize) == formatWord || word2(frame + _frameSize) == 0x11223344)) {
+      addFrame(offset, *reinterpret_cast<const VDIFHeader *>(frame));
+      offset += _frameSize;
+    } else {
+      // a valid frame is kept if the next one does not start inside it
+      VDIFHeader header = *reinterpret_cast<const VDIFHeader *>(frame);
+      off_t	 next = nextFrame(offset + 1);
+
+      if (valid && next - offset >= (off_t) _frameSize) {
+	addFrame(offset, header);
+	offset += _frameSize;
+      }
+
+      if (next > offset)
+	addInvalidRun(offset, next);
+
+      offset = next;
+    }
+  }
+}
+
+
+bool VDIFIndex::load()
+{
+  uint64_t fileSize;
+  int64_t  modificationTime;
+
+  getFileAttributes(fileSize, modificationTime);
+
+  try {
+    FileStream file(sidecarName(vdifFileName));
+    FileHeader header;
+
+    file.read(&header, sizeof header);
+
+    if (memcmp(header.magic, magic, sizeof magic) != 0 || header.fileSize != fileSize || header.modificationTime != modificationTime)
+      return false;
+
+    _frameSize = header.frameSize;
+    _ordered = header.ordered;
+    _seconds.resize(header.nrSeconds);
+    _invalidRuns.resize(header.nrInvalidRuns);
+    file.read(_seconds.data(), _seconds.size() * sizeof(Second));
+    file.read(_invalidRuns.data(), _invalidRuns.size() * sizeof(InvalidRun));
+    return true;
+  } catch (SystemCallException &) { // no sidecar file
+    return false;
+  } catch (Stream::EndOfStreamException &) { // truncated
+    return false;
+  }
+}
+
+
+void VDIFIndex::save() const
+{
+  // write a temporary file and rename it, so that concurrent readers never
+  // see a partial index
+  std::string name = sidecarName(vdifFileName), temporaryName = name + ".tmp";
+
+  FileHeader header;
+  memcpy(header.magic, magic, sizeof magic);
+  getFileAttributes(header.fileSize, header.modificationTime);
+  header.frameSize = _frameSize;
+  header.ordered = _ordered;
+  header.nrSeconds = _seconds.size();
+  header.nrInvalidRuns = _invalidRuns.size();
+
+  {
+    FileStream file(temporaryName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    file.write(&header, sizeof header);
+    file.write(_seconds.data(), _seconds.size() * sizeof(Second));
+    file.write(_invalidRuns.data(), _invalidRuns.size() * sizeof(InvalidRun));
+  }
+
+  if (rename(temporaryName.c_str(), name.c_str()) < 0)
+    throw SystemCallException("rename " + temporaryName);
+}
+
+
+off_t VDIFIndex::offsetOf(int64_t second) const
+{
+  if (_seconds.empty())
+    return 0;
+
+  if (!_ordered) // cannot bisect; read everything
+    return _seconds.front().offset;
+
+  auto next = std::upper_bound(_seconds.begin(), _seconds.end(), second, [] (int64_t second, const Second &entry) { return second < entry.second; });
+  return (next == _seconds.begin() ? next : next - 1)->offset;
+}
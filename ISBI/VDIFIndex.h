@@ -0,0 +1,68 @@
+#ifndef ISBI_VDIF_INDEX_H
+#define ISBI_VDIF_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+
+// Maps the seconds in a VDIF file to the offsets of their first frames, so
+// that reading can start at any time without scanning the file.  The index
+// is kept in a sidecar file (<file>.index) and rebuilt when the VDIF file
+// has changed since.
+
+class VDIFIndex
+{
+  public:
+    struct Second {
+      int64_t second; // since 1970
+      int64_t offset; // of the first valid frame in this second
+    };
+
+    // skipped bytes need not be whole frames; nrFrames is rounded up
+    struct InvalidRun {
+      int64_t offset, nrFrames;
+    };
+
+    // loads the sidecar file if it is up to date, otherwise builds the index
+    // and (if possible) writes the sidecar file
+    VDIFIndex(const std::string &vdifFileName);
+
+    static std::string sidecarName(const std::string &vdifFileName);
+
+    void build();
+    bool load();
+    void save() const;
+
+    // offset of the first frame from which reading covers the given second
+    off_t offsetOf(int64_t second) const;
+
+    const std::vector<Second>	  &seconds() const { return _seconds; }
+    const std::vector<InvalidRun> &invalidRuns() const { return _invalidRuns; }
+    uint32_t			  frameSize() const { return _frameSize; }
+    bool			  ordered() const { return _ordered; }
+
+  private:
+    struct FileHeader {
+      char     magic[8];
+      uint64_t fileSize;
+      int64_t  modificationTime; // ns
+      uint32_t frameSize;
+      uint32_t ordered;
+      uint64_t nrSeconds, nrInvalidRuns;
+    };
+
+    static const char magic[8];
+
+    void getFileAttributes(uint64_t &size, int64_t &modificationTime) const;
+
+    std::string		    vdifFileName;
+    uint32_t		    _frameSize;
+    bool		    _ordered;
+    std::vector<Second>	    _seconds;
+    std::vector<InvalidRun> _invalidRuns;
+};
+
+#endif
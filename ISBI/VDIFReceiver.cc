@@ -0,0 +1,229 @@
+#include "Common/Config.h"
+
+#include "ISBI/VDIFReceiver.h"
+#include "Common/Stream/Descriptor.h"
+#include "Common/SystemCallException.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+
+VDIFReceiver::VDIFReceiver(const std::string &descriptor, double sampleRate, unsigned maxNrFrames, unsigned maxFrameSize, size_t socketBufferSize, unsigned busyPollMicroseconds)
+:
+  samplesPerSecond(std::llround(sampleRate)),
+  maxFrameSize(maxFrameSize),
+  frameSize(0),
+  timerFd(-1),
+  pollFd(-1),
+  idleTimerArmed(false),
+  buffer(maxNrFrames * maxFrameSize),
+  controlBuffer(maxNrFrames * CMSG_SPACE(sizeof(uint32_t))),
+  iovecs(maxNrFrames),
+  messages(maxNrFrames),
+  nrReceived(0),
+  nrInvalid(0),
+  nrKernelDrops(0)
+{
+  std::unique_ptr<Stream> stream(createStream(descriptor, true));
+  SocketStream		  *socketStream = dynamic_cast<SocketStream *>(stream.get());
+
+  if (socketStream == nullptr || socketStream->protocol != SocketStream::UDP)
+    throw BadDescriptor(descriptor);
+
+  stream.release();
+  socket.reset(socketStream);
+
+  int fd = socket->fd, on = 1;
+
+  if (socketBufferSize > 0) {
+    int size = socketBufferSize, actualSize;
+    socklen_t length = sizeof actualSize;
+
+    // SO_RCVBUFFORCE may exceed net.core.rmem_max, but needs CAP_NET_ADMIN
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof size) < 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size) < 0)
+      throw SystemCallException("setsockopt(SO_RCVBUF)");
+
+    if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &actualSize, &length) == 0 && (size_t) actualSize < socketBufferSize)
+#pragma omp critical (clog)
+      std::clog << descriptor << ": socket receive buffer is only " << actualSize << " bytes; raise net.core.rmem_max" << std::endl;
+  }
+
+#if defined SO_BUSY_POLL
+  if (busyPollMicroseconds > 0 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busyPollMicroseconds, sizeof busyPollMicroseconds) < 0)
+#pragma omp critical (clog)
+    std::clog << descriptor << ": cannot enable busy polling: " << strerror(errno) << std::endl;
+#endif
+
+  // have the kernel attach its count of dropped datagrams to each message
+  if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof on) < 0)
+    throw SystemCallException("setsockopt(SO_RXQ_OVFL)");
+
+  socket->setTimeout(1); // so that the caller regularly checks whether to stop
+
+  for (unsigned message = 0; message < maxNrFrames; message ++) {
+    iovecs[message].iov_base = &buffer[message * maxFrameSize];
+    iovecs[message].iov_len  = maxFrameSize;
+
+    memset(&messages[message], 0, sizeof(struct mmsghdr));
+    messages[message].msg_hdr.msg_iov    = &iovecs[message];
+    messages[message].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+
+VDIFReceiver::~VDIFReceiver()
+{
+  if (pollFd >= 0)
+    close(pollFd);
+
+  if (timerFd >= 0)
+    close(timerFd);
+}
+
+
+bool VDIFReceiver::isUDPDescriptor(const std::string &descriptor)
+{
+  return descriptor.compare(0, 4, "udp:") == 0;
+}
+
+
+void VDIFReceiver::setNonBlocking()
+{
+  int flags;
+
+  if ((flags = fcntl(socket->fd, F_GETFL)) < 0 || fcntl(socket->fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    throw SystemCallException("fcntl");
+
+  if (pollFd >= 0)
+    return;
+
+  if ((timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+    throw SystemCallException("timerfd_create");
+
+  if ((pollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    throw SystemCallException("epoll_create1");
+
+  // level triggered: the set is readable while either one is
+  struct epoll_event event;
+  event.events = EPOLLIN;
+
+  for (int fd : { socket->fd, timerFd }) {
+    event.data.fd = fd;
+
+    if (epoll_ctl(pollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+      throw SystemCallException("epoll_ctl");
+  }
+}
+
+
+void VDIFReceiver::startIdleTimer(double seconds)
+{
+  if (idleTimerArmed)
+    return;
+
+  struct itimerspec spec = {};
+  int64_t	    nanoseconds = std::max(std::llround(seconds * 1e9), 1LL); // 0 would disarm it
+
+  spec.it_value.tv_sec  = nanoseconds / 1000000000;
+  spec.it_value.tv_nsec = nanoseconds % 1000000000;
+
+  if (timerfd_settime(timerFd, 0, &spec, nullptr) < 0)
+    throw SystemCallException("timerfd_settime");
+
+  idleTimerArmed = true;
+}
+
+
+void VDIFReceiver::stopIdleTimer()
+{
+  if (!idleTimerArmed)
+    return;
+
+  struct itimerspec spec = {}; // also clears an expiration that was not read
+
+  if (timerfd_settime(timerFd, 0, &spec, nullptr) < 0)
+    throw SystemCallException("timerfd_settime");
+
+  idleTimerArmed = false;
+}
+
+
+bool VDIFReceiver::idleTimerExpired()
+{
+  uint64_t nrExpirations;
+
+  if (!idleTimerArmed)
+    return false;
+
+  if (::read(timerFd, &nrExpirations, sizeof nrExpirations) < 0) {
+    if (errno == EAGAIN)
+      return false;
+
+    throw SystemCallException("read timerfd");
+  }
+
+  idleTimerArmed = false;
+  return true;
+}
+
+
+unsigned VDIFReceiver::read(const char *frames[], int64_t timestamps[], unsigned maxNrFrames)
+{
+  maxNrFrames = std::min(maxNrFrames, (unsigned) messages.size());
+
+  for (unsigned message = 0; message < maxNrFrames; message ++) {
+    messages[message].msg_hdr.msg_control    = &controlBuffer[message * CMSG_SPACE(sizeof(uint32_t))];
+    messages[message].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint32_t));
+    messages[message].msg_hdr.msg_flags      = 0;
+  }
+
+  int nrMessages = recvmmsg(socket->fd, messages.data(), maxNrFrames, MSG_WAITFORONE, nullptr);
+
+  if (nrMessages < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return 0;
+
+    throw SystemCallException("recvmmsg");
+  }
+
+  unsigned nrFrames = 0;
+
+  for (int message = 0; message < nrMessages; message ++) {
+    const struct msghdr &header = messages[message].msg_hdr;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg != nullptr; cmsg = CMSG_NXTHDR(const_cast<struct msghdr *>(&header), cmsg))
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+	nrKernelDrops = * reinterpret_cast<const uint32_t *>(CMSG_DATA(cmsg));
+
+    const char	     *frame = static_cast<const char *>(iovecs[message].iov_base);
+    const VDIFHeader *vdifHeader = reinterpret_cast<const VDIFHeader *>(frame);
+    unsigned	     size = messages[message].msg_len;
+
+    if ((header.msg_flags & MSG_TRUNC) || size < sizeof(VDIFHeader) || VDIFStream::checkHeader(*vdifHeader) != HeaderStatus::VALID || vdifHeader->headerSize() + vdifHeader->dataSize() != size || (frameSize != 0 && size != frameSize)) {
+      ++ nrInvalid;
+      continue;
+    }
+
+    frameSize = size;
+    frames[nrFrames] = frame;
+    timestamps[nrFrames ++] = vdifHeader->timestamp(samplesPerSecond, vdifHeader->samplesPerFrame());
+  }
+
+  nrReceived += nrMessages;
+  return nrFrames;
+}
+
+
+VDIFReceiver::Statistics VDIFReceiver::statistics() const
+{
+  return Statistics { nrReceived, nrInvalid, nrKernelDrops };
+}
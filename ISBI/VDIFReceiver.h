@@ -0,0 +1,69 @@
+#ifndef ISBI_VDIF_RECEIVER_H
+#define ISBI_VDIF_RECEIVER_H
+
+#include "Common/Stream/SocketStream.h"
+#include "ISBI/VDIFStream.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+
+// Receives VDIF frames, one per datagram, from a live "udp:host:port" input.
+// Each read() fetches a batch of datagrams with a single recvmmsg() call, so
+// that 10/100 GbE packet rates do not cost one system call per frame.
+
+class VDIFReceiver
+{
+  public:
+    // socketBufferSize 0 keeps the system default; busyPollMicroseconds > 0
+    // lets the kernel spin on the NIC queue instead of sleeping
+    VDIFReceiver(const std::string &descriptor, double sampleRate, unsigned maxNrFrames, unsigned maxFrameSize, size_t socketBufferSize = 0, unsigned busyPollMicroseconds = 0);
+    ~VDIFReceiver();
+
+    static bool isUDPDescriptor(const std::string &descriptor);
+
+    // in non-blocking mode, read() returns 0 at once if nothing is queued;
+    // the caller then waits for fd() to become readable, which it also does
+    // when an idle timer expires
+    void setNonBlocking();
+    int  fd() const { return pollFd >= 0 ? pollFd : socket->fd; }
+
+    // a one-shot timer, e.g., to release held-back frames when no more
+    // arrive; starting an armed timer does not postpone it
+    void startIdleTimer(double seconds);
+    void stopIdleTimer();
+    bool idleTimerExpired(); // disarms it if so
+
+    // Receives at most maxNrFrames valid frames; returns 0 if nothing arrived
+    // within a second (or at all, in non-blocking mode).  The frames remain
+    // valid until the next call.
+    unsigned read(const char *frames[], int64_t timestamps[], unsigned maxNrFrames);
+
+    struct Statistics {
+      uint64_t nrReceived, nrInvalid, nrKernelDrops;
+    };
+
+    Statistics statistics() const;
+
+  private:
+    std::unique_ptr<SocketStream> socket;
+    int64_t			  samplesPerSecond;
+    unsigned			  maxFrameSize, frameSize; // frameSize of the first valid frame; 0 before
+    int				  timerFd, pollFd; // in non-blocking mode: an epoll set of the socket and timer
+    bool			  idleTimerArmed;
+
+    std::vector<char>		  buffer;
+    std::vector<char>		  controlBuffer; // per datagram, for SO_RXQ_OVFL
+    std::vector<struct iovec>	  iovecs;
+    std::vector<struct mmsghdr>	  messages;
+
+    std::atomic<uint64_t>	  nrReceived, nrInvalid;
+    std::atomic<uint32_t>	  nrKernelDrops; // cumulative count maintained by the kernel
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "Common/Config.h"
+
+#include "ISBI/VDIFReorderWindow.h"
+#include "ISBI/VDIFStream.h"
+
+#include <cstring>
+
+
+VDIFReorderWindow::VDIFReorderWindow(unsigned windowSize, unsigned maxNrFrames, unsigned maxFrameSize)
+:
+  windowSize(windowSize),
+  maxFrameSize(maxFrameSize),
+  storage(2 * windowSize * maxFrameSize),
+  sortedFrames(windowSize + maxNrFrames),
+  sortedTimestamps(windowSize + maxNrFrames),
+  firstHeld(0),
+  nrHeld(0),
+  nextTimestamp(0),
+  nextTimestampKnown(false),
+  nrReordered(0),
+  nrLate(0),
+  nrDuplicates(0),
+  nrOversized(0)
+{
+  for (unsigned slot = 2 * windowSize; slot -- > 0;)
+    freeSlots.push_back(slot);
+}
+
+
+unsigned VDIFReorderWindow::add(const char *const frames[], const int64_t timestamps[], unsigned nrFrames, int64_t timeStep)
+{
+  // the frames released by the previous call have been consumed by now
+  freeSlots.insert(freeSlots.end(), slotsToRelease.begin(), slotsToRelease.end());
+  slotsToRelease.clear();
+
+  // move the held frames to the front, then insert the new ones; they
+  // usually arrive in order, so that insertion sort is cheap
+  std::memmove(&sortedFrames[0], &sortedFrames[firstHeld], nrHeld * sizeof(const char *));
+  std::memmove(&sortedTimestamps[0], &sortedTimestamps[firstHeld], nrHeld * sizeof(int64_t));
+
+  unsigned nrSorted = nrHeld;
+
+  for (unsigned frame = 0; frame < nrFrames; frame ++) {
+    int64_t  timestamp = timestamps[frame];
+    unsigned position  = nrSorted;
+
+    // it could not be held back in a slot
+    const VDIFHeader *header = reinterpret_cast<const VDIFHeader *>(frames[frame]);
+
+    if (header->headerSize() + header->dataSize() > maxFrameSize) {
+      ++ nrOversized;
+      continue;
+    }
+
+    if (nextTimestampKnown && timestamp < nextTimestamp) {
+      ++ nrLate;
+      continue;
+    }
+
+    while (position > 0 && sortedTimestamps[position - 1] > timestamp)
+      -- position;
+
+    if (position > 0 && sortedTimestamps[position - 1] == timestamp) {
+      ++ nrDuplicates;
+      continue;
+    }
+
+    if (position < nrSorted) {
+      ++ nrReordered;
+      std::memmove(&sortedFrames[position + 1], &sortedFrames[position], (nrSorted - position) * sizeof(const char *));
+      std::memmove(&sortedTimestamps[position + 1], &sortedTimestamps[position], (nrSorted - position) * sizeof(int64_t));
+    }
+
+    sortedFrames[position] = frames[frame];
+    sortedTimestamps[position] = timestamp;
+    ++ nrSorted;
+  }
+
+  // release everything up to the first gap that may still be filled: one
+  // that is followed by at most windowSize frames and is not too wide
+  unsigned nrReady = 0;
+
+  for (int64_t expected = nextTimestamp; nrReady < nrSorted; expected = sortedTimestamps[nrReady ++] + timeStep)
+    if (nrFrames > 0 && (nrReady > 0 || nextTimestampKnown) && sortedTimestamps[nrReady] != expected && nrSorted - nrReady <= windowSize && sortedTimestamps[nrReady] - expected <= windowSize * timeStep)
+      break;
+
+  for (unsigned frame = 0; frame < nrReady; frame ++)
+    if (inStorage(sortedFrames[frame]))
+      slotsToRelease.push_back((sortedFrames[frame] - storage.data()) / maxFrameSize);
+
+  // copy the frames that are held back, as the reader will reuse its buffer
+  for (unsigned frame = nrReady; frame < nrSorted; frame ++)
+    if (!inStorage(sortedFrames[frame])) {
+      const VDIFHeader *header = reinterpret_cast<const VDIFHeader *>(sortedFrames[frame]);
+      char	       *copy	= &storage[freeSlots.back() * maxFrameSize];
+
+      freeSlots.pop_back();
+      std::memcpy(copy, header, header->headerSize() + header->dataSize());
+      sortedFrames[frame] = copy;
+    }
+
+  if (nrReady > 0) {
+    nextTimestamp = sortedTimestamps[nrReady - 1] + timeStep;
+    nextTimestampKnown = true;
+  }
+
+  firstHeld = nrReady;
+  nrHeld = nrSorted - nrReady;
+  return nrReady;
+}
+
+
+VDIFReorderWindow::Statistics VDIFReorderWindow::statistics() const
+{
+  return Statistics { nrReordered, nrLate, nrDuplicates, nrOversized };
+}
@@ -0,0 +1,48 @@
+#ifndef ISBI_VDIF_REORDER_WINDOW_H
+#define ISBI_VDIF_REORDER_WINDOW_H
+
+#include <cstdint>
+#include <vector>
+
+
+// Puts the frames of successive reads in timestamp order.  Frames that
+// follow a gap are held back (copied, as the reader reuses its buffers) for
+// as long as at most windowSize frames are waiting, in the hope that the
+// missing frames arrive late.  Duplicates, frames older than what was
+// already released, and frames larger than maxFrameSize are dropped.
+
+class VDIFReorderWindow
+{
+  public:
+    VDIFReorderWindow(unsigned windowSize, unsigned maxNrFrames, unsigned maxFrameSize);
+
+    // Adds nrFrames frames; returns how many frames are ready, in order, in
+    // frames() and timestamps().  These remain valid until the next call.
+    // Adding no frames releases everything that is held back.
+    unsigned add(const char *const frames[], const int64_t timestamps[], unsigned nrFrames, int64_t timeStep);
+
+    const char *const *frames() const { return sortedFrames.data(); }
+    const int64_t     *timestamps() const { return sortedTimestamps.data(); }
+    unsigned	      nrHeldFrames() const { return nrHeld; }
+
+    struct Statistics {
+      uint64_t nrReordered, nrLate, nrDuplicates, nrOversized;
+    };
+
+    Statistics statistics() const;
+
+  private:
+    bool inStorage(const char *frame) const { return frame >= storage.data() && frame < storage.data() + storage.size(); }
+
+    unsigned		      windowSize, maxFrameSize;
+    std::vector<char>	      storage; // 2 * windowSize frames: those still held, and those released by the previous call
+    std::vector<unsigned>     freeSlots, slotsToRelease;
+    std::vector<const char *> sortedFrames;
+    std::vector<int64_t>      sortedTimestamps;
+    unsigned		      firstHeld, nrHeld;
+    int64_t		      nextTimestamp;
+    bool		      nextTimestampKnown;
+    uint64_t		      nrReordered, nrLate, nrDuplicates, nrOversized;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "Common/Config.h"
+
+#include "ISBI/VDIFReplayer.h"
+#include "Common/Stream/Descriptor.h"
+#include "Common/SystemCallException.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+
+
+static const int64_t lateThreshold = 1000000; // ns
+
+
+static int64_t floorDiv(int64_t a, int64_t b)
+{
+  return a / b - (a % b < 0);
+}
+
+
+static int64_t now()
+{
+  struct timespec time;
+
+  if (clock_gettime(CLOCK_REALTIME, &time) < 0)
+    throw SystemCallException("clock_gettime");
+
+  return time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+
+VDIFReplayer::VDIFReplayer(const Opener &open, const std::string &descriptor, double sampleRate, int64_t startSecond, unsigned nrLoops, unsigned maxNrFrames)
+:
+  open(open),
+  samplesPerSecond(std::llround(sampleRate)),
+  startSecond(startSecond),
+  shift(0),
+  nrLoops(nrLoops),
+  headers(maxNrFrames),
+  iovecs(2 * maxNrFrames),
+  messages(maxNrFrames),
+  nrSent(0),
+  nrLate(0),
+  maxLateness(0)
+{
+  std::unique_ptr<Stream> stream(createStream(descriptor, false));
+  SocketStream		  *socketStream = dynamic_cast<SocketStream *>(stream.get());
+
+  if (socketStream == nullptr || socketStream->protocol != SocketStream::UDP)
+    throw BadDescriptor(descriptor);
+
+  stream.release();
+  socket.reset(socketStream);
+
+  for (unsigned message = 0; message < maxNrFrames; message ++) {
+    memset(&messages[message], 0, sizeof(struct mmsghdr));
+    messages[message].msg_hdr.msg_iov	 = &iovecs[2 * message];
+    messages[message].msg_hdr.msg_iovlen = 2;
+  }
+}
+
+
+int64_t VDIFReplayer::dueTime(int64_t timestamp, const char *frame) const
+{
+  // when the last sample of the frame was taken
+  int64_t end = timestamp + shift + reinterpret_cast<const VDIFHeader *>(frame)->samplesPerFrame();
+
+  return floorDiv(end, samplesPerSecond) * 1000000000LL + (end - floorDiv(end, samplesPerSecond) * samplesPerSecond) * 1000000000LL / samplesPerSecond;
+}
+
+
+bool VDIFReplayer::sleepUntil(int64_t time, const std::atomic<bool> &stop)
+{
+  // in steps of at most a second, so that stop is noticed while waiting for
+  // the start time
+  for (int64_t current; !stop && (current = now()) < time;) {
+    int64_t	    until = std::min(time, current + (int64_t) 1000000000);
+    struct timespec timespec = { (time_t) (until / 1000000000), (long) (until % 1000000000) };
+
+    if (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &timespec, nullptr) != 0 && errno != EINTR)
+      throw SystemCallException("clock_nanosleep");
+  }
+
+  return !stop;
+}
+
+
+void VDIFReplayer::send(const char *frames[], const int64_t timestamps[], unsigned nrFrames, const std::atomic<bool> &stop)
+{
+  for (unsigned first = 0; first < nrFrames;) {
+    // wait for the first frame, then send it with all others that are due
+    if (!sleepUntil(dueTime(timestamps[first], frames[first]), stop))
+      return;
+
+    int64_t  current = now();
+    unsigned last    = first;
+
+    for (; last < nrFrames && dueTime(timestamps[last], frames[last]) <= current; last ++) {
+      const VDIFHeader *header	 = reinterpret_cast<const VDIFHeader *>(frames[last]);
+      unsigned		headerSize = header->headerSize();
+      int64_t		lateness   = current - dueTime(timestamps[last], frames[last]);
+
+      memcpy(&headers[last], header, headerSize);
+      headers[last].sec_from_epoch = header->sec_from_epoch + shift / samplesPerSecond;
+
+      iovecs[2 * last    ].iov_base = &headers[last];
+      iovecs[2 * last    ].iov_len  = headerSize;
+      iovecs[2 * last + 1].iov_base = const_cast<char *>(frames[last] + headerSize);
+      iovecs[2 * last + 1].iov_len  = header->dataSize();
+
+      if (lateness > lateThreshold)
+	++ nrLate;
+
+      if (lateness > maxLateness)
+	maxLateness = lateness;
+    }
+
+    while (first < last) {
+      int nrMessages = sendmmsg(socket->fd, &messages[first], last - first, 0);
+
+      if (nrMessages < 0) {
+	// a connected UDP socket reports an earlier unreachable destination
+	// on the next send; the receiver may simply not be running yet
+	if (errno == EINTR || errno == ECONNREFUSED)
+	  continue;
+
+	throw SystemCallException("sendmmsg");
+      }
+
+      first  += nrMessages;
+      nrSent += nrMessages;
+    }
+  }
+}
+
+
+void VDIFReplayer::replay(const std::atomic<bool> &stop)
+{
+  std::vector<const char *> frames(messages.size());
+  std::vector<int64_t>	    timestamps(messages.size());
+
+  for (unsigned loop = 0; (nrLoops == 0 || loop < nrLoops) && !stop; loop ++) {
+    std::unique_ptr<VDIFFrameSource> source(open());
+    int64_t			     firstSecond = floorDiv(source->getFirstTimestamp(), samplesPerSecond), end = source->getFirstTimestamp();
+
+    if (loop == 0)
+      shift = (startSecond - firstSecond) * samplesPerSecond;
+
+    try {
+      while (!stop) {
+	unsigned nrFrames = source->read(frames.data(), timestamps.data(), frames.size());
+
+	for (unsigned frame = 0; frame < nrFrames; frame ++)
+	  end = std::max(end, timestamps[frame] + reinterpret_cast<const VDIFHeader *>(frames[frame])->samplesPerFrame());
+
+	send(frames.data(), timestamps.data(), nrFrames, stop);
+      }
+    } catch (Stream::EndOfStreamException &) {
+    }
+
+    // the next loop starts in the second after this one ends
+    shift += (floorDiv(end + samplesPerSecond - 1, samplesPerSecond) - firstSecond) * samplesPerSecond;
+  }
+}
+
+
+VDIFReplayer::Statistics VDIFReplayer::statistics() const
+{
+  return Statistics { nrSent, nrLate, maxLateness };
+}
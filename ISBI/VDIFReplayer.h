@@ -0,0 +1,64 @@
+#ifndef ISBI_VDIF_REPLAYER_H
+#define ISBI_VDIF_REPLAYER_H
+
+#include "Common/Stream/SocketStream.h"
+#include "ISBI/VDIFFrameSource.h"
+#include "ISBI/VDIFStream.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+
+// Sends a recording to a "udp:host:port" destination as a station would, so
+// that the real-time mode of the correlator, which drops late blocks and
+// output, can be load tested without a telescope.  Each frame is re-stamped
+// to wall-clock time and sent when its last sample would have been taken.
+// The recording is shifted by a whole number of seconds, so only the second
+// in the header changes.  Frames go out in batches with sendmmsg(), the
+// header from a re-stamped copy and the payload straight from the input.
+
+class VDIFReplayer
+{
+  public:
+    typedef std::function<VDIFFrameSource * ()> Opener; // e.g., creates a VDIFScanReader
+
+    // The first second of the recording is replayed at startSecond (since
+    // 1970); nrLoops 0 replays it over and over, each loop continuing in the
+    // second after the previous one ends.
+    VDIFReplayer(const Opener &, const std::string &descriptor, double sampleRate, int64_t startSecond, unsigned nrLoops = 1, unsigned maxNrFrames = 64);
+
+    // Sends frames until the recording ends or stop is set.
+    void replay(const std::atomic<bool> &stop);
+
+    struct Statistics {
+      uint64_t nrSent, nrLate; // late: sent more than a millisecond after it was due
+      int64_t  maxLateness;    // in ns
+    };
+
+    Statistics statistics() const;
+
+  private:
+    void	   send(const char *frames[], const int64_t timestamps[], unsigned nrFrames, const std::atomic<bool> &stop);
+    int64_t	   dueTime(int64_t timestamp, const char *frame) const; // in ns since 1970
+    static bool	   sleepUntil(int64_t time, const std::atomic<bool> &stop);
+
+    Opener			  open;
+    std::unique_ptr<SocketStream> socket;
+    int64_t			  samplesPerSecond, startSecond, shift; // shift in samples
+    unsigned			  nrLoops;
+
+    std::vector<VDIFHeader>	  headers; // the re-stamped copies
+    std::vector<struct iovec>	  iovecs;  // per frame, header and payload
+    std::vector<struct mmsghdr>	  messages;
+
+    std::atomic<uint64_t>	  nrSent, nrLate;
+    std::atomic<int64_t>	  maxLateness;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "Common/Config.h"
+
+#include "ISBI/VDIFScanReader.h"
+#include "Common/Stream/Descriptor.h"
+#include "Common/Stream/Stream.h"
+#include "Common/SystemCallException.h"
+
+#include <fstream>
+#include <iostream>
+
+#include <glob.h>
+
+
+VDIFScanReader::VDIFScanReader(const std::vector<std::string> &fileNames, const Opener &open)
+:
+  names(fileNames),
+  open(open),
+  currentFile(0)
+{
+  if (names.empty())
+    throw BadDescriptor("no input files");
+
+  current.reset(open(names[0]));
+  firstTimestamp = current->getFirstTimestamp();
+  openNextFile();
+}
+
+
+std::vector<std::string> VDIFScanReader::fileNames(const std::string &descriptor)
+{
+  std::vector<std::string> names;
+
+  if (descriptor.compare(0, 5, "list:") == 0) {
+    std::ifstream list(descriptor.substr(5));
+    std::string	  name;
+
+    if (!list)
+      throw BadDescriptor(descriptor);
+
+    while (std::getline(list, name))
+      if (!name.empty() && name[0] != '#')
+	names.push_back(name);
+  } else if (descriptor.find_first_of("*?[") != std::string::npos) {
+    glob_t matches;
+
+    switch (glob(descriptor.c_str(), GLOB_ERR, nullptr, &matches)) {
+      case 0 :		  for (size_t match = 0; match < matches.gl_pathc; match ++)
+			    names.push_back(matches.gl_pathv[match]);
+
+			  globfree(&matches);
+			  break;
+
+      case GLOB_NOMATCH : break;
+
+      default :		  globfree(&matches);
+			  throw SystemCallException("glob " + descriptor);
+    }
+  } else {
+    names.push_back(descriptor);
+  }
+
+  if (names.empty())
+    throw BadDescriptor(descriptor);
+
+  return names;
+}
+
+
+void VDIFScanReader::openNextFile()
+{
+  if (currentFile + 1 < names.size())
+    next = std::async(std::launch::async, [this, name = names[currentFile + 1]] {
+      return std::unique_ptr<VDIFFrameSource>(open(name));
+    });
+}
+
+
+bool VDIFScanReader::nextFile()
+{
+  if (following == nullptr && next.valid())
+    following = next.get();
+
+  if (following == nullptr)
+    return false;
+
+  current = std::move(following);
+  ++ currentFile;
+  openNextFile();
+  return true;
+}
+
+
+unsigned VDIFScanReader::read(const char *frames[], int64_t timestamps[], unsigned maxNrFrames)
+{
+  // the frames of the previous call are no longer needed, so the drained
+  // file can be closed before the next one is read
+  for (;;)
+    try {
+      return current->read(frames, timestamps, maxNrFrames);
+    } catch (Stream::EndOfStreamException &) {
+      if (!nextFile())
+	throw;
+
+#pragma omp critical (clog)
+      std::clog << "continuing with " << names[currentFile] << std::endl;
+    }
+}
+
+
+void VDIFScanReader::seek(int64_t timestamp)
+{
+  // a file ends where the next one starts
+  for (;;) {
+    if (following == nullptr && next.valid())
+      following = next.get();
+
+    if (following == nullptr || following->getFirstTimestamp() > timestamp)
+      break;
+
+#pragma omp critical (clog)
+    std::clog << "skipping " << names[currentFile] << std::endl;
+
+    nextFile();
+  }
+
+  current->seek(timestamp);
+}
@@ -0,0 +1,54 @@
+#ifndef ISBI_VDIF_SCAN_READER_H
+#define ISBI_VDIF_SCAN_READER_H
+
+#include "ISBI/VDIFFrameSource.h"
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Plays the consecutive scan files of a station back as one stream of
+// frames, without having to concatenate them first.  While a file drains,
+// the next one is opened in the background, so that its first blocks are
+// already mapped or read when the switch happens.
+
+class VDIFScanReader : public VDIFFrameSource
+{
+  public:
+    typedef std::function<VDIFFrameSource * (const std::string &fileName)> Opener; // e.g., creates a VDIFStream
+
+    VDIFScanReader(const std::vector<std::string> &fileNames, const Opener &);
+
+    // A descriptor is a file name, a glob pattern (e.g., "b004_ib_no*.vdif",
+    // in name order), or "list:<file>" with one file name per line.
+    static std::vector<std::string> fileNames(const std::string &descriptor);
+
+    // As VDIFStream::read(); throws an EndOfStreamException after the last
+    // frame of the last file.
+    unsigned read(const char *frames[], int64_t timestamps[], unsigned maxNrFrames) override;
+
+    // Skips the files that end before timestamp, then seeks within the file
+    // that contains it.
+    void seek(int64_t timestamp) override;
+
+    int64_t getFirstTimestamp() const override { return firstTimestamp; }
+
+  private:
+    void openNextFile();
+    bool nextFile();
+
+    std::vector<std::string>			    names;
+    Opener					    open;
+
+    unsigned					    currentFile;
+    std::unique_ptr<VDIFFrameSource>		    current;
+    std::future<std::unique_ptr<VDIFFrameSource>>   next; // opening currentFile + 1; waited for on destruction
+    std::unique_ptr<VDIFFrameSource>		    following; // currentFile + 1, once taken from next
+    int64_t					    firstTimestamp;
+};
+
+#endif
@@ -1,4 +1,6 @@
 #include "VDIFStream.h"
+#include "ISBI/VDIFIndex.h"
+#include "Common/SystemCallException.h"
 
 #include <iostream>
 #include <algorithm>
@@ -6,140 +8,399 @@
 #include <stdlib.h>
 #include <cstdint>
 #include <stdexcept>
-#include <chrono>
+#include <array>
+#include <cmath>
+#include <ctime>
 #include <vector>
 #include <cstring>
 
+#if defined __x86_64__
+#include <immintrin.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 constexpr uint32_t HEADER_SIZE = 32; // bytes
 constexpr uint32_t DATA_SIZE = 8000; // bytes
-constexpr std::size_t READ_BUFFER_SIZE = 1u << 20;
 
-VDIFStream::VDIFStream(std::string inputFile, double sampleRate) 
-  : ioBuffer(READ_BUFFER_SIZE), firstHeaderFound(false), invalidFrames(0), numberOfFrames(0), sampleRate(sampleRate), dataSize(0), headerSize(0) { 
-    file.rdbuf()->pubsetbuf(ioBuffer.data(), ioBuffer.size());
-    file.open(inputFile, std::ios::binary);
+VDIFStream::VDIFStream(std::string inputFile, double sampleRate, unsigned nrAsyncReads, size_t asyncReadSize, bool directIO) 
+  : fileName(inputFile), file(inputFile), ioMode(BUFFERED), fileSize(0), nrAsyncReads(nrAsyncReads), asyncReadSize(asyncReadSize), directIO(directIO), window(nullptr), windowOffset(0), windowSize(0), readAheadOffset(0), position(0), firstHeaderFound(false), invalidFrames(0), numberOfFrames(0), nrResyncs(0), nrSkippedBytes(0), sampleRate(sampleRate), samplesPerSecond(std::llround(sampleRate)), dataSize(0), headerSize(0), samplesPerFrame(0) { 
     std::cout << "Created a new VDIFStream object for " << inputFile << std::endl;
 
-    if (!file.is_open()) { throw std::runtime_error("Failed to open " + inputFile + " file!"); }
-    if (!readFirstHeader()) { throw std::runtime_error("Could not find a valid header!"); }
+    struct stat stat;
+
+    if (fstat(file.fd, &stat) < 0)
+      throw SystemCallException("fstat " + inputFile);
+
+    if (S_ISREG(stat.st_mode)) {
+      fileSize = stat.st_size;
+
+      if (nrAsyncReads > 0) {
+        ioMode = ASYNC;
+        asyncReader.reset(new AsyncFileReader(inputFile, 0, asyncReadSize, nrAsyncReads, directIO));
+      } else {
+        ioMode = MAPPED;
+      }
+    }
 
+    if (!readFirstHeader()) { throw std::runtime_error("Could not find a valid header!"); }
 
     dataSize = firstHeader.dataSize();
     headerSize = firstHeader.headerSize();
-
-    file.clear();
-    file.seekg(static_cast<off_t>(numberOfFrames) * (headerSize + dataSize), std::ios::beg);
-    if (!file) { throw std::runtime_error("Failed to seek to the first frame!"); }
+    samplesPerFrame = firstHeader.samplesPerFrame();
+    formatWord = reinterpret_cast<const uint32_t *>(&firstHeader)[2];
+    framesPerSecond = samplesPerFrame > 0 ? (samplesPerSecond + samplesPerFrame - 1) / samplesPerFrame : 0;
+    lastSecond = firstHeader.sec_from_epoch;
   }
 
 bool VDIFStream::readFirstHeader() {
-  while (file.read(reinterpret_cast<char*>(&currentHeader), HEADER_SIZE)) {
-    if (checkHeader() == HeaderStatus::VALID) {
-      std::memcpy(&firstHeader, &currentHeader, HEADER_SIZE);
+  for (; prepare(HEADER_SIZE, HEADER_SIZE + DATA_SIZE) >= HEADER_SIZE; position += HEADER_SIZE + DATA_SIZE) {
+    const VDIFHeader &header = *reinterpret_cast<const VDIFHeader *>(current());
+
+    if (checkHeader(header) == HeaderStatus::VALID) {
+      std::memcpy(&firstHeader, &header, HEADER_SIZE);
       firstHeaderFound = true;
 
-      const off_t offset = static_cast<off_t>(numberOfFrames) * (HEADER_SIZE + DATA_SIZE);
-      std::cout << "Found first valid header at offset: " << offset << std::endl;
+      std::cout << "Found first valid header at offset: " << position << std::endl;
       return true;
     }
 
     ++invalidFrames;
     ++numberOfFrames;
-    file.ignore(DATA_SIZE);
   }
 
   return false;
 }
 
-void VDIFStream::read(char* frame) {
-  const std::streamsize frameBytes = static_cast<std::streamsize>(headerSize + dataSize);
+unsigned VDIFStream::read(const char *frames[], int64_t timestamps[], unsigned maxNrFrames) {
+  const size_t frameSize = headerSize + dataSize;
+  unsigned nrFrames = 0;
+
+  while (nrFrames == 0) {
+    // all returned frames must lie within the same window, as the next
+    // prepare() may unmap the current one
+    size_t available = prepare(frameSize, maxNrFrames * frameSize);
+
+    if (available == 0)
+      throw EndOfStreamException("VDIFStream::read EOF reached");
+
+    while (nrFrames < maxNrFrames && available >= frameSize) {
+      const char *frame = current();
+      const VDIFHeader &header = *reinterpret_cast<const VDIFHeader *>(frame);
+
+      const bool valid = reinterpret_cast<const uint32_t *>(frame)[2] == formatWord && checkHeader(header) == HeaderStatus::VALID;
+      const uint32_t nextWord = available >= 2 * frameSize ? reinterpret_cast<const uint32_t *>(frame + frameSize)[2] : formatWord;
+
+      if (valid && (nextWord == formatWord || nextWord == 0x11223344)) {
+        frames[nrFrames ++] = frame;
+        lastSecond = header.sec_from_epoch;
+        position += frameSize;
+        available -= frameSize;
+        numberOfFrames++;
+      } else {
+        // a truncated frame or garbage shifts all later frames; continue
+        // at the next frame, wherever it starts.  A valid frame is kept if
+        // the next one does not start inside it.
+        off_t start = position;
+        bool found = resync(available);
+        size_t skipped = position - start;
+
+        if (valid && skipped >= frameSize) {
+          frames[nrFrames ++] = frame;
+          lastSecond = header.sec_from_epoch;
+          skipped -= frameSize;
+        } else {
+          ++invalidFrames;
+        }
+
+        nrSkippedBytes += skipped;
+        numberOfFrames++;
+
+        if (!found)
+          break; // continue searching after prepare() fetched more data
+
+        if (position - start != static_cast<off_t>(frameSize)) {
+          std::cout << "Lost VDIF frame alignment at offset " << start << ", resynced at " << position << std::endl;
+          ++nrResyncs;
+        }
+
+        available -= position - start;
+      }
+    }
+  }
+
+  // all frames have the same size, so the number of samples per frame is
+  // known and the conversion is integer arithmetic only
+  for (unsigned frame = 0; frame < nrFrames; ++frame)
+    timestamps[frame] = reinterpret_cast<const VDIFHeader *>(frames[frame])->timestamp(samplesPerSecond, samplesPerFrame);
+
+  return nrFrames;
+}
+
+static const char *findWordScalar(const char *begin, const char *end, uint32_t word)
+{
+  for (const char *ptr = begin; ptr + sizeof word <= end; ptr ++)
+    if (memcmp(ptr, &word, sizeof word) == 0)
+      return ptr;
+
+  return nullptr;
+}
+
+
+#if defined __x86_64__
+__attribute__((target("avx2"))) static const char *findWordAVX2(const char *begin, const char *end, uint32_t word)
+{
+  // compares 32 byte offsets at once: four shifted loads, one per byte of
+  // the word
+  const __m256i byte0 = _mm256_set1_epi8(word), byte1 = _mm256_set1_epi8(word >> 8);
+  const __m256i byte2 = _mm256_set1_epi8(word >> 16), byte3 = _mm256_set1_epi8(word >> 24);
+  const char *ptr = begin;
+
+  for (; ptr + 32 + sizeof word - 1 <= end; ptr += 32) {
+    __m256i match01 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) ptr), byte0), _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (ptr + 1)), byte1));
+    __m256i match23 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (ptr + 2)), byte2), _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (ptr + 3)), byte3));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(match01, match23));
 
-  file.read(frame, frameBytes);
-  if (file.gcount() != frameBytes) {
-    if (file.eof()) throw EndOfStreamException("VDIFStream::read EOF reached");
-    throw EndOfStreamException("VDIFStream::read incomplete frame read");
+    if (mask != 0)
+      return ptr + __builtin_ctz(mask);
   }
 
-  std::memcpy(&currentHeader, frame, headerSize);
-  if (checkHeader() != HeaderStatus::VALID) {
-    const off_t expectedOffset = static_cast<off_t>(numberOfFrames) * (headerSize + dataSize);
-    std::cout << "Invalid header found at offset " << expectedOffset << std::endl;
-    findNextValidHeader();
+  return findWordScalar(ptr, end, word);
+}
+#endif
+
+
+static const char *findWord(const char *begin, const char *end, uint32_t word)
+{
+  static const bool haveAVX2 = [] {
+#if defined __x86_64__
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+  } ();
+
+#if defined __x86_64__
+  if (haveAVX2)
+    return findWordAVX2(begin, end, word);
+#endif
+
+  return findWordScalar(begin, end, word);
+}
+
+
+const char *VDIFStream::findFrame(const char *begin, const char *end, uint32_t formatWord) {
+  const char *word = findWord(begin + 8, end + 8 + sizeof formatWord - 1, formatWord);
+  return word != nullptr ? word - 8 : nullptr;
+}
+
+
+bool VDIFStream::isNextFrame(const VDIFHeader &header) const {
+  // a plausible successor of the last valid frame: same format and epoch,
+  // a frame number that exists, and at most a minute later
+  return reinterpret_cast<const uint32_t *>(&header)[2] == formatWord &&
+         header.legacy_mode == firstHeader.legacy_mode &&
+         header.ref_epoch == firstHeader.ref_epoch &&
+         checkHeader(header) == HeaderStatus::VALID &&
+         header.dataframe_in_second < framesPerSecond &&
+         static_cast<uint32_t>(header.sec_from_epoch) + 1 >= lastSecond && header.sec_from_epoch <= lastSecond + 60;
+}
+
+
+bool VDIFStream::resync(size_t available) {
+  // Finds the first plausible header after position that is followed by a
+  // full frame in the window.  If the next header is in the window too, it
+  // must be plausible and continue the frame numbering of the first.  This
+  // replaces findNextValidHeader(), which only tried whole-frame strides and
+  // never recovered from a byte-level slip.
+  const size_t frameSize = headerSize + dataSize;
+  const char  *base = current(), *end = base + available - frameSize + 1;
+
+  for (const char *frame = base + 1; (frame = findFrame(frame, end, formatWord)) != nullptr; frame ++) {
+    const VDIFHeader &header = *reinterpret_cast<const VDIFHeader *>(frame);
+
+    if (!isNextFrame(header))
+      continue;
 
-    file.read(frame, frameBytes);
-    if (file.gcount() != frameBytes) {
-      if (file.eof()) throw EndOfStreamException("VDIFStream::read EOF reached");
-      throw EndOfStreamException("VDIFStream::read incomplete frame read");
+    size_t offset = frame - base;
+
+    if (offset + 2 * frameSize <= available) {
+      const VDIFHeader &next = *reinterpret_cast<const VDIFHeader *>(frame + frameSize);
+      uint64_t frameNr = static_cast<uint64_t>(header.sec_from_epoch) * framesPerSecond + header.dataframe_in_second;
+      uint64_t nextNr  = static_cast<uint64_t>(next.sec_from_epoch) * framesPerSecond + next.dataframe_in_second;
+
+      if (!isNextFrame(next) || nextNr < frameNr || nextNr > frameNr + 1)
+        continue;
     }
 
-    std::memcpy(&currentHeader, frame, headerSize);
+    position += offset;
+    return true;
   }
 
-  numberOfFrames++;
+  // keep the last bytes that may hold the start of a frame
+  position += available - frameSize + 1;
+  return false;
 }
 
-void VDIFStream::findNextValidHeader() {
-  while (true) {
-    numberOfFrames++;
+void VDIFStream::seek(int64_t timestamp) {
+  if (ioMode == BUFFERED) {
+    std::cout << "Cannot seek in " << fileName << std::endl;
+    return;
+  }
 
-    file.read(reinterpret_cast<char*>(&currentHeader), headerSize);
-    if (file.gcount() != static_cast<std::streamsize>(headerSize)) {
-      throw EndOfStreamException("VDIFStream::findNextValidHeader: truncated header");
-    }
+  int64_t second = timestamp / samplesPerSecond;
 
-    if (checkHeader() == HeaderStatus::VALID) {
-      file.seekg(-static_cast<std::streamoff>(headerSize), std::ios::cur);
-      if (!file) {
-        throw EndOfStreamException("VDIFStream::findNextValidHeader: seek failed");
-      }
-      return;
-    }
+  if (second <= VDIFHeader::epochStarts[firstHeader.ref_epoch] + firstHeader.sec_from_epoch)
+    return;
 
-    ++invalidFrames;
-    file.ignore(dataSize);
-    if (!file) {
-      throw EndOfStreamException("VDIFStream::findNextValidHeader: skip failed");
+  VDIFIndex index(fileName);
+  off_t offset = index.offsetOf(second);
+
+  if (index.frameSize() != headerSize + dataSize || offset <= position)
+    return;
+
+  std::cout << "Seeking to offset " << offset << " in " << fileName << std::endl;
+
+  // forget the current window; the next prepare() maps or reads from offset
+  if (ioMode == MAPPED && window != nullptr && munmap(window, windowSize) < 0)
+    throw SystemCallException("munmap");
+
+  window = nullptr;
+  windowOffset = 0;
+  windowSize = 0;
+  position = offset;
+
+  if (ioMode == ASYNC) {
+    asyncReader.reset();
+    asyncReader.reset(new AsyncFileReader(fileName, offset, asyncReadSize, nrAsyncReads, directIO));
+  }
+}
+
+size_t VDIFStream::prepare(size_t minBytes, size_t wantedBytes) {
+  size_t available = bytesInWindow();
+
+  if (available < wantedBytes) {
+    switch (ioMode) {
+      case MAPPED:   if (position + available < fileSize)
+                       remap(wantedBytes);
+
+                     break;
+
+      case BUFFERED: refill(wantedBytes);
+                     break;
+
+      // only move to the next block if not even minBytes are left, so that
+      // at most one frame is copied per block
+      case ASYNC:    while (bytesInWindow() < minBytes && nextBlock())
+                       ;
+
+                     break;
     }
+
+    available = bytesInWindow();
   }
+
+  if (ioMode == MAPPED && readAheadOffset < windowOffset + static_cast<off_t>(windowSize) && position + static_cast<off_t>(READ_AHEAD_SIZE) > readAheadOffset) {
+    // ask the kernel to fetch the next part of the window
+    size_t size = std::min(READ_AHEAD_SIZE, windowOffset + windowSize - readAheadOffset);
+
+    if (madvise(window + (readAheadOffset - windowOffset), size, MADV_WILLNEED) < 0)
+      throw SystemCallException("madvise");
+
+    readAheadOffset += size;
+  }
+
+  return available >= minBytes ? available : 0;
+}
+
+void VDIFStream::remap(size_t wantedBytes) {
+  static const off_t pageSize = sysconf(_SC_PAGESIZE);
+
+  if (window != nullptr && munmap(window, windowSize) < 0)
+    throw SystemCallException("munmap");
+
+  window = nullptr;
+  windowOffset = position & ~(pageSize - 1);
+  windowSize = std::min(std::max(MAP_WINDOW_SIZE, position - windowOffset + wantedBytes), fileSize - windowOffset);
+
+  void *ptr = mmap(nullptr, windowSize, PROT_READ, MAP_SHARED, file.fd, windowOffset);
+
+  if (ptr == MAP_FAILED)
+    throw SystemCallException("mmap");
+
+  window = static_cast<char *>(ptr);
+  readAheadOffset = windowOffset;
+
+  if (madvise(window, windowSize, MADV_SEQUENTIAL) < 0)
+    throw SystemCallException("madvise");
+}
+
+void VDIFStream::refill(size_t wantedBytes) {
+  // move the remainder of the buffer to the front, and read the rest
+  size_t available = bytesInWindow();
+
+  if (readBuffer.size() < wantedBytes)
+    readBuffer.resize(wantedBytes);
+
+  std::memmove(readBuffer.data(), readBuffer.data() + (position - windowOffset), available);
+  window = readBuffer.data();
+  windowOffset = position;
+  windowSize = available;
+
+  try {
+    while (windowSize < wantedBytes)
+      windowSize += file.tryRead(window + windowSize, wantedBytes - windowSize);
+  } catch (EndOfStreamException &) {
+  }
+}
+
+bool VDIFStream::nextBlock() {
+  size_t carrySize = bytesInWindow();
+  AsyncFileReader::Block block = asyncReader->next(current(), carrySize);
+
+  window = const_cast<char *>(block.data);
+  windowOffset = block.offset;
+  windowSize = block.size;
+
+  return block.size > carrySize; // false at end of file
 }
 
 
 VDIFStream::~VDIFStream() {
   std::cout << "Total frames read: " <<  numberOfFrames << std::endl;
-  file.close();
+
+  if (nrResyncs > 0)
+    std::cout << fileName << ": resynced " << nrResyncs << " times, skipping " << nrSkippedBytes << " bytes" << std::endl;
+
+  if (ioMode == MAPPED && window != nullptr)
+    munmap(window, windowSize);
 }
 
-int64_t VDIFHeader::timestamp(double sample_rate) const {
+// reference epochs start on January 1st and July 1st, every year since 2000
+const std::array<int64_t, 64> VDIFHeader::epochStarts = [] {
+  std::array<int64_t, 64> starts;
+
+  for (unsigned epoch = 0; epoch < starts.size(); ++epoch) {
     std::tm date{};
-    date.tm_year = 2000 + ref_epoch / 2 - 1900;
-    date.tm_mon = (ref_epoch & 1) ? 6 : 0;
+    date.tm_year = 2000 + epoch / 2 - 1900;
+    date.tm_mon = (epoch & 1) ? 6 : 0;
     date.tm_mday = 1;
-    date.tm_hour = 0;
-    date.tm_min = 0;
-    date.tm_sec = 0;
 
-    std::time_t time = timegm(&date);
-    auto time_point = std::chrono::system_clock::from_time_t(time);
+    starts[epoch] = timegm(&date);
+  }
+
+  return starts;
+}();
 
-    auto exact_time = time_point + std::chrono::seconds(sec_from_epoch);
-    int64_t out =  static_cast<int64_t>(std::chrono::duration_cast<std::chrono::seconds>(exact_time.time_since_epoch()).count() * sample_rate 
-           + dataframe_in_second * samplesPerFrame());
-    return out;
+int64_t VDIFHeader::timestamp(double sample_rate) const {
+  return static_cast<int64_t>((epochStarts[ref_epoch] + sec_from_epoch) * sample_rate + dataframe_in_second * samplesPerFrame());
 }
 
 void VDIFHeader::decode2bit(const std::array<char, maxPacketSize>& frame,
                             std::vector<int8_t>& out) const {
-  static const std::array<int8_t, 256 * 4> decodeLUT = []() {
-    std::array<int8_t, 256 * 4> lut{};
-    for (unsigned byte = 0; byte < 256; ++byte) {
-      lut[byte * 4 + 0] = DECODER_LEVEL_2BIT[(byte >> 0) & 0x3];
-      lut[byte * 4 + 1] = DECODER_LEVEL_2BIT[(byte >> 2) & 0x3];
-      lut[byte * 4 + 2] = DECODER_LEVEL_2BIT[(byte >> 4) & 0x3];
-      lut[byte * 4 + 3] = DECODER_LEVEL_2BIT[(byte >> 6) & 0x3];
-    }
-    return lut;
-  }();
-
   const std::size_t payloadBytes = static_cast<std::size_t>(dataSize());
   const uint8_t* data =
       reinterpret_cast<const uint8_t*>(frame.data() + headerSize());
@@ -155,13 +416,8 @@ void VDIFHeader::decode2bit(const std::array<char, maxPacketSize>& frame,
   const std::size_t fullBytes = decodedSamples / 4;
   const std::size_t tail      = decodedSamples % 4;
 
-  for (std::size_t i = 0; i < fullBytes; ++i) {
-    const int8_t* decoded = &decodeLUT[static_cast<std::size_t>(data[i]) * 4];
-    std::copy_n(decoded, 4, out.begin() + i * 4);
-  }
+  ::decode2bit(data, fullBytes, out.data());
 
-  if (tail != 0) {
-    const int8_t* decoded = &decodeLUT[static_cast<std::size_t>(data[fullBytes]) * 4];
-    std::copy_n(decoded, tail, out.begin() + fullBytes * 4);
-  }
+  for (std::size_t i = 0; i < tail; ++i)
+    out[fullBytes * 4 + i] = DECODER_LEVEL_2BIT[(data[fullBytes] >> (2 * i)) & 0x3];
 }
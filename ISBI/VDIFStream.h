@@ -3,14 +3,16 @@
 
 #include "Common/Stream/FileStream.h"
 #include "Common/TimeStamp.h"
+#include "ISBI/AsyncFileReader.h"
+#include "ISBI/VDIFDecoder.h"
+#include "ISBI/VDIFFrameSource.h"
 
-#include <fstream>
 #include <array>
 #include <complex>
 #include <vector>
 #include <ctime>
+#include <memory>
 
-static constexpr int8_t DECODER_LEVEL_2BIT[] = { -3, -1, 1, 3 };
 static constexpr uint32_t maxPacketSize = 8032;
 
 enum HeaderStatus {
@@ -39,7 +41,10 @@ struct VDIFHeader {
   uint32_t      user_data2,user_data3,user_data4;
 
   
+  static const std::array<int64_t, 64> epochStarts; // per ref_epoch, in seconds since 1970
+
   int64_t timestamp(double sample_rate) const;
+  int64_t timestamp(int64_t samplesPerSecond, uint32_t samplesPerFrame) const;
   uint32_t dataSize() const;
   uint32_t headerSize() const;
   uint32_t samplesPerFrame() const;
@@ -70,35 +75,87 @@ struct VDIFHeader {
 
 };
 
-class VDIFStream : public Stream {
+class VDIFStream : public Stream, public VDIFFrameSource {
   private:
-    std::ifstream file;
-    std::vector<char> ioBuffer;
-
-    VDIFHeader firstHeader, currentHeader;
+    // Regular files are memory mapped in windows of MAP_WINDOW_SIZE bytes, so
+    // that frames can be handed out without copying, or are read in large
+    // blocks by an AsyncFileReader that keeps multiple reads in flight.
+    // Other files (e.g., named pipes) are read into readBuffer.
+    static constexpr size_t MAP_WINDOW_SIZE = 1UL << 30;
+    static constexpr size_t READ_AHEAD_SIZE = 64UL << 20;
+
+    enum IOMode { MAPPED, BUFFERED, ASYNC };
+
+    std::string fileName;
+    FileStream file;
+    IOMode ioMode;
+    size_t fileSize;
+    std::unique_ptr<AsyncFileReader> asyncReader;
+    unsigned nrAsyncReads;
+    size_t asyncReadSize;
+    bool directIO;
+
+    char *window; // mapped or read part of the file
+    off_t windowOffset; // file offset of window[0]
+    size_t windowSize;
+    off_t readAheadOffset;
+    std::vector<char> readBuffer;
+
+    off_t position; // file offset of the next frame
+
+    VDIFHeader firstHeader;
 
     bool firstHeaderFound;
 
     uint32_t invalidFrames;
     uint32_t numberOfFrames;
+    uint32_t nrResyncs;
+    uint64_t nrSkippedBytes;
 
     double sampleRate;
+    int64_t samplesPerSecond;
     uint32_t dataSize;
     uint32_t headerSize;
+    uint32_t samplesPerFrame;
+
+    // after a truncated frame or garbage, frames are searched for at any
+    // byte offset, by their format word (word 2), which does not change
+    uint32_t formatWord;
+    uint32_t framesPerSecond;
+    uint32_t lastSecond; // sec_from_epoch of the last valid frame
 
     bool readFirstHeader();
-    void findNextValidHeader();
-    HeaderStatus checkHeader();
+    bool isNextFrame(const VDIFHeader &) const;
+    bool resync(size_t available);
+    size_t prepare(size_t minBytes, size_t wantedBytes);
+    void remap(size_t wantedBytes);
+    void refill(size_t wantedBytes);
+    bool nextBlock();
+    const char *current() const { return window + (position - windowOffset); }
+    size_t bytesInWindow() const { return position < windowOffset + static_cast<off_t>(windowSize) ? windowOffset + windowSize - position : 0; }
   public:
-    VDIFStream(std::string inputFile, double sampleRate);
+    static HeaderStatus checkHeader(const VDIFHeader &);
 
-    void read(char* frame);
+    // the first frame that starts in [begin, end), at any byte offset, with
+    // the given format word (word 2 of its header), or nullptr
+    static const char *findFrame(const char *begin, const char *end, uint32_t formatWord);
+
+    // nrAsyncReads > 0 selects asynchronous reads of asyncReadSize bytes,
+    // optionally bypassing the page cache, instead of memory mapping
+    VDIFStream(std::string inputFile, double sampleRate, unsigned nrAsyncReads = 0, size_t asyncReadSize = 8UL << 20, bool directIO = false);
+
+    unsigned read(const char *frames[], int64_t timestamps[], unsigned maxNrFrames) override;
 
     // NOT USED, they come from Stream class.
     size_t tryWrite(const void *ptr, size_t size) { return 0; }
     size_t tryRead(void *ptr, size_t size) { return 0; }
 
-    int64_t getFirstTimestamp() const;
+    // Skips (using a VDIFIndex) to the first frame of the second that
+    // contains timestamp, if that lies ahead.  Only works on regular files.
+    void seek(int64_t timestamp) override;
+
+    int64_t getFirstTimestamp() const override;
+    const VDIFHeader &getFirstHeader() const { return firstHeader; }
     ~VDIFStream();
 };
 
@@ -114,20 +171,22 @@ inline uint32_t VDIFHeader::numberOfChannels() const {
   return 1 << log2_nchan;
 }
 
+inline int64_t VDIFHeader::timestamp(int64_t samplesPerSecond, uint32_t samplesPerFrame) const {
+  return (epochStarts[ref_epoch] + sec_from_epoch) * samplesPerSecond + static_cast<int64_t>(dataframe_in_second) * samplesPerFrame;
+}
+
 inline uint32_t VDIFHeader::samplesPerFrame() const {
   uint32_t bps = bits_per_sample + 1;
   return dataSize() * 8 / bps / numberOfChannels();
 }
 
-inline HeaderStatus VDIFStream::checkHeader() {
-  if (((uint32_t *)&currentHeader)[0] == 0x11223344 ||
-      ((uint32_t *)&currentHeader)[1] == 0x11223344 ||
-      ((uint32_t *)&currentHeader)[2] == 0x11223344 ||
-      ((uint32_t *)&currentHeader)[3] == 0x11223344) {
-    return HeaderStatus::INVALID;
-  } else if (currentHeader.ref_epoch == 0  && currentHeader.sec_from_epoch == 0) {
+inline HeaderStatus VDIFStream::checkHeader(const VDIFHeader &header) {
+  // test all words for the fill pattern without branching between them
+  const uint32_t *words = reinterpret_cast<const uint32_t *>(&header);
+  bool fill = (words[0] == 0x11223344) | (words[1] == 0x11223344) | (words[2] == 0x11223344) | (words[3] == 0x11223344);
+
+  if (fill || (header.ref_epoch == 0 && header.sec_from_epoch == 0))
     return HeaderStatus::INVALID;
-  }
 
   return HeaderStatus::VALID;
 }
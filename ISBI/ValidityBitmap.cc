@@ -0,0 +1,95 @@
+#include "Common/Config.h"
+
+#include "ISBI/ValidityBitmap.h"
+
+#include <utility>
+
+
+ValidityBitmap::ValidityBitmap(unsigned nrSamples)
+:
+  _nrSamples(nrSamples),
+  words((nrSamples + 63) / 64, 0)
+{
+}
+
+
+void ValidityBitmap::assign(const SparseSet<TimeStamp> &validData, const TimeStamp &firstTime, unsigned nrSamples)
+{
+  _nrSamples = nrSamples;
+  words.assign((nrSamples + 63) / 64, 0);
+
+  for (const SparseSet<TimeStamp>::range &range : validData.getRanges()) {
+    int64_t begin = std::max<int64_t>(range.begin - firstTime, 0), end = std::min<int64_t>(range.end - firstTime, nrSamples);
+
+    if (begin >= end)
+      continue;
+
+    // the partial words at both ends, and whole words in between
+    unsigned firstWord = begin / 64, lastWord = (end - 1) / 64;
+    uint64_t firstMask = ~0ULL << (begin % 64), lastMask = ~0ULL >> (63 - (end - 1) % 64);
+
+    if (firstWord == lastWord) {
+      words[firstWord] |= firstMask & lastMask;
+    } else {
+      words[firstWord] |= firstMask;
+      std::fill(words.begin() + firstWord + 1, words.begin() + lastWord, ~0ULL);
+      words[lastWord] |= lastMask;
+    }
+  }
+}
+
+
+void ValidityBitmap::clear(unsigned begin, unsigned end)
+{
+  unsigned firstWord = begin / 64, lastWord = (end - 1) / 64;
+  uint64_t firstMask = ~0ULL << (begin % 64), lastMask = ~0ULL >> (63 - (end - 1) % 64);
+
+  if (firstWord == lastWord) {
+    words[firstWord] &= ~(firstMask & lastMask);
+  } else {
+    words[firstWord] &= ~firstMask;
+    std::fill(words.begin() + firstWord + 1, words.begin() + lastWord, 0);
+    words[lastWord] &= ~lastMask;
+  }
+}
+
+
+void ValidityBitmap::flagShortGaps(unsigned minValidRun)
+{
+  // collect first: clearing a gap while iterating would change the runs
+  std::vector<std::pair<unsigned, unsigned>> gaps;
+  unsigned previousEnd = 0;
+  bool     hasPrevious = false;
+
+  forEachInvalidRange([&] (unsigned begin, unsigned end) {
+    if (hasPrevious && begin - previousEnd < minValidRun)
+      gaps.emplace_back(previousEnd, begin);
+
+    previousEnd = end, hasPrevious = true;
+  });
+
+  for (const std::pair<unsigned, unsigned> &gap : gaps)
+    clear(gap.first, gap.second);
+}
+
+
+unsigned ValidityBitmap::count() const
+{
+  unsigned count = 0;
+
+  for (uint64_t word : words)
+    count += __builtin_popcountll(word);
+
+  return count;
+}
+
+
+unsigned ValidityBitmap::countCommon(const ValidityBitmap &a, const ValidityBitmap &b)
+{
+  unsigned count = 0;
+
+  for (size_t word = 0, nrWords = std::min(a.words.size(), b.words.size()); word < nrWords; word ++)
+    count += __builtin_popcountll(a.words[word] & b.words[word]);
+
+  return count;
+}
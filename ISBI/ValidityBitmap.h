@@ -0,0 +1,75 @@
+#ifndef ISBI_VALIDITY_BITMAP_H
+#define ISBI_VALIDITY_BITMAP_H
+
+#include "Common/SparseSet.h"
+#include "Common/TimeStamp.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+
+// One bit per sample of a block of a station, set where the station has
+// valid data.  The block is the station's delay-compensated window, so that
+// bits of different stations with the same index belong together: the
+// number of bits that two bitmaps have in common is the exact number of
+// samples that a baseline correlates.  Flagged samples are masked where the
+// block is used, rather than cleared in the ring buffer beforehand (unless
+// a GPU with unified memory reads the ring buffer in place).
+
+class ValidityBitmap
+{
+  public:
+    ValidityBitmap(unsigned nrSamples = 0);
+
+    // bit i is set iff validData contains firstTime + i
+    void assign(const SparseSet<TimeStamp> &validData, const TimeStamp &firstTime, unsigned nrSamples);
+
+    unsigned nrSamples() const { return _nrSamples; }
+    unsigned count() const;
+    bool     test(unsigned sample) const { return words[sample / 64] >> (sample % 64) & 1; }
+
+    // the number of samples valid in both
+    static unsigned countCommon(const ValidityBitmap &, const ValidityBitmap &);
+
+    // calls function(begin, end) for each maximal run of invalid samples
+    template <typename Function> void forEachInvalidRange(Function function) const;
+
+    // flags the valid runs shorter than minValidRun that lie between two
+    // invalid runs, so that the invalid runs merge and are masked at once
+    void flagShortGaps(unsigned minValidRun);
+
+  private:
+    void clear(unsigned begin, unsigned end);
+
+    unsigned		  _nrSamples;
+    std::vector<uint64_t> words; // bits beyond nrSamples are zero
+};
+
+
+template <typename Function> inline void ValidityBitmap::forEachInvalidRange(Function function) const
+{
+  // skip whole words of valid samples; find run boundaries with ctz
+  for (unsigned begin = 0; begin < _nrSamples;) {
+    unsigned word = begin / 64;
+    uint64_t invalid = ~words[word] & (~0ULL << (begin % 64));
+
+    while (invalid == 0 && ++ word < words.size())
+      invalid = ~words[word];
+
+    if (word == words.size() || (begin = 64 * word + __builtin_ctzll(invalid)) >= _nrSamples)
+      return;
+
+    uint64_t valid = words[word] & (~0ULL << (begin % 64));
+
+    while (valid == 0 && ++ word < words.size())
+      valid = words[word];
+
+    unsigned end = word == words.size() ? _nrSamples : std::min(64 * word + __builtin_ctzll(valid), _nrSamples);
+
+    function(begin, end);
+    begin = end;
+  }
+}
+
+#endif
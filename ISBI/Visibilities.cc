@@ -12,7 +12,26 @@
 Visibilities::Visibilities(const ISBI_Parset &ps, unsigned subband)
 :
   ps(ps),
-  hostVisibilities(boost::extents[ps.nrBaselines()][ps.nrOutputChannelsPerSubband()][ps.nrVisibilityPolarizations()]),
+
+  hostVisibilities(boost::extents[ps.nrBaselines()][ps.nrOutputChannelsPerSubband()][ps.nrVisibilityPolarizations()], [&] () {
+    HostAllocator allocator(ps.visibilitiesMemory());
+    allocator.prefault = ps.prefaultHostMemory();
+    allocator.pin = ps.pinHostMemory();
+
+    if (ps.visibilitiesPlacement() != ISBI_Parset::DefaultPlacement) {
+      if (allocator.kind == HostAllocator::Pinned)
+	allocator.kind = HostAllocator::Plain;
+
+      allocator.prefault = true;
+
+      if (ps.visibilitiesPlacement() == ISBI_Parset::InterleavedPlacement)
+	allocator.place = [] (NUMAMemory &memory) { memory.interleave(); };
+      else
+	allocator.node = ps.outputBufferNodes()[subband];
+    }
+
+    return allocator;
+  } ()),
   subband(subband)
 {
   memset(&header, 0, sizeof header);
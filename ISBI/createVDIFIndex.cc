@@ -0,0 +1,42 @@
+// Builds (or validates) the seek index of each VDIF file given on the command
+// line, so that the correlator does not have to scan them at startup.
+
+#include "Common/Config.h"
+
+#include "Common/Exceptions/Exception.h"
+#include "ISBI/VDIFIndex.h"
+
+#include <iostream>
+
+
+int main(int argc, char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " file.vdif ..." << std::endl;
+    return 1;
+  }
+
+  int status = 0;
+
+  for (int arg = 1; arg < argc; arg ++) {
+    try {
+      VDIFIndex index(argv[arg]);
+      int64_t	nrInvalidFrames = 0;
+
+      for (const VDIFIndex::InvalidRun &run : index.invalidRuns())
+	nrInvalidFrames += run.nrFrames;
+
+      std::cout << argv[arg] << ": frame size " << index.frameSize() << ", " << index.seconds().size() << " seconds";
+
+      if (index.seconds().size() > 0)
+	std::cout << " (" << index.seconds().front().second << " .. " << index.seconds().back().second << ')';
+
+      std::cout << ", " << nrInvalidFrames << " invalid frames in " << index.invalidRuns().size() << " runs" << (index.ordered() ? "" : ", NOT time ordered") << std::endl;
+    } catch (Exception &ex) {
+      std::cerr << argv[arg] << ": " << ex.what() << std::endl;
+      status = 1;
+    }
+  }
+
+  return status;
+}
@@ -0,0 +1,136 @@
+// Writes synthetic VDIF data of a number of stations, one output per station,
+// for benchmarks of the ingest and correlation paths.  An output is a file,
+// a named pipe ("pipe:<name>"), or a UDP destination ("udp:<host>:<port>",
+// one frame per datagram).  See VDIFGenerator for what is generated.
+
+#include "Common/Config.h"
+
+#include "Common/Exceptions/Exception.h"
+#include "Common/Stream/Descriptor.h"
+#include "Common/Stream/SocketStream.h"
+#include "ISBI/VDIFGenerator.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+int main(int argc, char **argv)
+{
+  using namespace boost::program_options;
+
+  std::string		    outputs, configFile, constantDelays;
+  VDIFGenerator::Format	    format { 8e6, 16, 2, 8000 };
+  VDIFGenerator::Impairments impairments { 0, 0, 0, 8 };
+  int64_t		    startSecond = time(nullptr);
+  double		    duration = 10, correlation = .1, speed = 0;
+  uint64_t		    seed = 0;
+
+  options_description allowed_options("usage: generateVDIF -o output,... [options]");
+
+  allowed_options.add_options()
+    ("help,h", "print this message")
+    ("outputDescriptors,o", value<std::string>(&outputs)->required()) // one per station
+    ("sampleRate", value<double>(&format.sampleRate)) // per channel
+    ("nrChannels", value<unsigned>(&format.nrChannels))
+    ("nrBitsPerSample", value<unsigned>(&format.nrBitsPerSample)) // 1, 2, 4, or 8
+    ("payloadSize", value<unsigned>(&format.payloadSize)) // bytes per frame
+    ("startTime", value<int64_t>(&startSecond)) // seconds since 1970; default: now
+    ("duration", value<double>(&duration)) // seconds
+    ("correlation", value<double>(&correlation)) // fraction of the power from the common sky signal
+    ("seed", value<uint64_t>(&seed))
+    ("configFile", value<std::string>(&configFile)) // the delay tables, as read by the correlator
+    ("delays", value<std::string>(&constantDelays)) // or constant delays per station, in seconds
+    ("lossFraction", value<double>(&impairments.lossFraction))
+    ("reorderFraction", value<double>(&impairments.reorderFraction))
+    ("maxReorderDistance", value<unsigned>(&impairments.maxReorderDistance)) // in frames
+    ("invalidFraction", value<double>(&impairments.invalidFraction)) // frames replaced by fill pattern
+    ("speed", value<double>(&speed)) // relative to real time; 0: as fast as possible
+  ;
+
+  try {
+    variables_map vm;
+    store(parse_command_line(argc, argv, allowed_options), vm);
+
+    if (vm.count("help")) {
+      std::cout << allowed_options << std::endl;
+      return 0;
+    }
+
+    notify(vm);
+
+    std::vector<std::string> descriptors;
+    boost::split(descriptors, outputs, boost::is_any_of(","));
+
+    unsigned	  nrStations = descriptors.size();
+    VDIFGenerator generator(nrStations, format, startSecond, correlation, seed);
+
+    if (!configFile.empty()) {
+      generator.setDelays(VDIFGenerator::readDelays(configFile, nrStations));
+    } else if (!constantDelays.empty()) {
+      std::vector<std::string>		     values;
+      std::vector<std::map<int64_t, double>> delays(nrStations);
+
+      boost::split(values, constantDelays, boost::is_any_of(","));
+
+      if (values.size() != nrStations)
+	throw Exception("need one delay per station");
+
+      for (unsigned station = 0; station < nrStations; station ++)
+	delays[station][0] = std::stod(values[station]);
+
+      generator.setDelays(delays);
+    }
+
+    generator.setImpairments(impairments);
+
+    std::vector<std::unique_ptr<Stream>> streams;
+    std::vector<bool>			 datagrams; // one write per frame
+
+    for (const std::string &descriptor : descriptors) {
+      streams.emplace_back(createStream(descriptor, false));
+
+      SocketStream *socket = dynamic_cast<SocketStream *>(streams.back().get());
+      datagrams.push_back(socket != nullptr && socket->protocol == SocketStream::UDP);
+    }
+
+    // in batches of about a millisecond, but longer than a reordering
+    const unsigned frameSize = generator.frameSize();
+    const unsigned nrFramesPerBatch = std::max(generator.framesPerSecond() / 1000, 4 * impairments.maxReorderDistance + 1);
+    const uint64_t nrFrames = std::llround(duration * generator.framesPerSecond());
+    std::vector<char> frames((size_t) nrFramesPerBatch * frameSize);
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    for (uint64_t firstFrame = 0; firstFrame < nrFrames; firstFrame += nrFramesPerBatch) {
+      unsigned nrFramesInBatch = std::min((uint64_t) nrFramesPerBatch, nrFrames - firstFrame);
+
+      if (speed > 0)
+	std::this_thread::sleep_until(startTime + std::chrono::duration<double>(firstFrame / (speed * generator.framesPerSecond())));
+
+      for (unsigned station = 0; station < nrStations; station ++) {
+	unsigned nrGenerated = generator.generate(station, firstFrame, nrFramesInBatch, frames.data());
+
+	if (datagrams[station])
+	  for (unsigned frame = 0; frame < nrGenerated; frame ++)
+	    streams[station]->write(&frames[(size_t) frame * frameSize], frameSize);
+	else
+	  streams[station]->write(frames.data(), (size_t) nrGenerated * frameSize);
+      }
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::clog << "generated " << nrFrames << " frames per station, " << nrStations << " stations, in " << elapsed << " s (" << nrStations * nrFrames * frameSize / elapsed * 1e-9 << " GB/s)" << std::endl;
+  } catch (std::exception &ex) {
+    std::cerr << argv[0] << ": " << ex.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -35,6 +35,7 @@ void printSettings(const ISBI_Parset &ps){
   std::clog << "sample rate = " << ps.sampleRate() << std::endl;
   std::clog << "subband bandwidth = " << ps.subbandBandwidth() << std::endl;
   std::clog << "max delay = " << ps.maxDelay() << std::endl;
+  std::clog << "ring buffer = " << ps.nrRingBufferSamplesPerSubband() << " samples/subband (minimum " << ps.minNrRingBufferSamplesPerSubband() << "), " << ps.nrRingBufferBytes() / 1e9 << " GB in total" << std::endl;
   std::clog << "mapping = ";
   for (int i = 0; i < ps.channelMapping().size(); i++)
     std::clog << ps.channelMapping()[i] << " ";
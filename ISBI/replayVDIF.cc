@@ -0,0 +1,130 @@
+// Replays VDIF recordings over UDP in real time, re-stamped to the current
+// time, to load test the real-time mode of the correlator on a single box.
+// There is one output per station; if there are fewer inputs than outputs,
+// the inputs are reused in turn, so that a few recordings can feed any
+// number of stations.  An input is a VDIF file, a glob pattern, or
+// "list:<file>", as for the correlator.  See VDIFReplayer.
+
+#include "Common/Config.h"
+
+#include "ISBI/VDIFReplayer.h"
+#include "ISBI/VDIFScanReader.h"
+#include "ISBI/VDIFStream.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+
+#include <atomic>
+#include <csignal>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+static std::atomic<bool> stop(false);
+
+
+static void stopReplay(int)
+{
+  stop = true;
+}
+
+
+int main(int argc, char **argv)
+{
+  using namespace boost::program_options;
+
+  std::string inputs, outputs;
+  double      sampleRate;
+  int64_t     startSecond = time(nullptr) + 5;
+  unsigned    nrLoops = 1;
+
+  options_description allowed_options("usage: replayVDIF -i input,... -o udp:host:port,... --sampleRate Hz [options]");
+
+  allowed_options.add_options()
+    ("help,h", "print this message")
+    ("inputDescriptors,i", value<std::string>(&inputs)->required())
+    ("outputDescriptors,o", value<std::string>(&outputs)->required()) // one per station
+    ("sampleRate", value<double>(&sampleRate)->required()) // per channel
+    ("startTime", value<int64_t>(&startSecond)) // seconds since 1970 at which the recordings start; default: in 5 seconds
+    ("nrLoops", value<unsigned>(&nrLoops)) // 0: forever
+  ;
+
+  try {
+    variables_map vm;
+    store(parse_command_line(argc, argv, allowed_options), vm);
+
+    if (vm.count("help")) {
+      std::cout << allowed_options << std::endl;
+      return 0;
+    }
+
+    notify(vm);
+
+    std::vector<std::string> inputDescriptors, outputDescriptors;
+    boost::split(inputDescriptors, inputs, boost::is_any_of(","));
+    boost::split(outputDescriptors, outputs, boost::is_any_of(","));
+
+    std::vector<std::unique_ptr<VDIFReplayer>> replayers;
+
+    for (unsigned station = 0; station < outputDescriptors.size(); station ++) {
+      std::vector<std::string> fileNames = VDIFScanReader::fileNames(inputDescriptors[station % inputDescriptors.size()]);
+
+      replayers.emplace_back(new VDIFReplayer([fileNames, sampleRate] () {
+	return new VDIFScanReader(fileNames, [sampleRate] (const std::string &fileName) {
+	  return new VDIFStream(fileName, sampleRate);
+	});
+      }, outputDescriptors[station], sampleRate, startSecond, nrLoops));
+    }
+
+    signal(SIGINT, stopReplay);
+    signal(SIGTERM, stopReplay);
+
+    std::clog << "replaying " << replayers.size() << " stations from " << startSecond << " (" << startSecond - time(nullptr) << " s from now)" << std::endl;
+
+    std::vector<std::thread> threads;
+    std::atomic<unsigned>    nrRunning(replayers.size());
+
+    for (std::unique_ptr<VDIFReplayer> &replayer : replayers)
+      threads.emplace_back([&replayer, &nrRunning] () {
+	try {
+	  replayer->replay(stop);
+	} catch (std::exception &ex) {
+	  std::cerr << "replayVDIF: " << ex.what() << std::endl;
+	  stop = true;
+	}
+
+	-- nrRunning;
+      });
+
+    // once per second, whether the replay keeps up; a load test of the
+    // correlator is only meaningful if the input arrives in time
+    for (uint64_t previousNrSent = 0; nrRunning > 0;) {
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+
+      VDIFReplayer::Statistics total { 0, 0, 0 };
+
+      for (const std::unique_ptr<VDIFReplayer> &replayer : replayers) {
+	VDIFReplayer::Statistics statistics = replayer->statistics();
+	total.nrSent	  += statistics.nrSent;
+	total.nrLate	  += statistics.nrLate;
+	total.maxLateness  = std::max(total.maxLateness, statistics.maxLateness);
+      }
+
+      if (total.nrSent > 0)
+	std::clog << "sent " << total.nrSent - previousNrSent << " frames/s, " << total.nrLate << " late in total, at most " << total.maxLateness * 1e-6 << " ms" << std::endl;
+
+      previousNrSent = total.nrSent;
+    }
+
+    for (std::thread &thread : threads)
+      thread.join();
+  } catch (std::exception &ex) {
+    std::cerr << argv[0] << ": " << ex.what() << std::endl;
+    return 1;
+  }
+
+  return stop ? 1 : 0;
+}